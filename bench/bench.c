@@ -0,0 +1,425 @@
+/*
+** bench - Single-threaded allocator microbenchmarks
+**
+** Uses whatever malloc() the process resolves, so the same binary measures
+** glibc and, with LD_PRELOAD=./libft_malloc.so, ft_malloc. `make bench`
+** runs both and writes one table.
+**
+** Usage: bench [-a label] [-n scale] [-H] [name ...]
+**   -a   allocator column value (default "system")
+**   -n   multiply every iteration count (default 1)
+**   -H   do not print the header row
+**   name run only these benchmarks
+**
+** Output is tab separated, one row per benchmark:
+**   benchmark  allocator  ops  ns_per_op  max_rss_kb
+**
+** Each benchmark runs in a fork()ed child, so max_rss_kb is that
+** benchmark's own peak (wait4() rusage) and heaps do not carry over.
+** Sizes and orders come from a fixed-seed generator: every run and every
+** allocator sees the same sequence.
+*/
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef uint64_t	(*t_bench_fn)(uint64_t scale);
+
+typedef struct s_bench
+{
+	const char	*name;
+	t_bench_fn	fn;				/* Returns the number of calls made */
+}	t_bench;
+
+static uint64_t	g_rng = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t	rng(void)
+{
+	g_rng ^= g_rng << 13;
+	g_rng ^= g_rng >> 7;
+	g_rng ^= g_rng << 17;
+	return (g_rng);
+}
+
+static void	*xmalloc(size_t size)
+{
+	void	*p;
+
+	p = malloc(size);
+	if (!p)
+	{
+		fprintf(stderr, "bench: malloc(%zu) failed\n", size);
+		_exit(1);
+	}
+	*(volatile char *)p = 1;
+	return (p);
+}
+
+static void	*xrealloc(void *ptr, size_t size)
+{
+	void	*p;
+
+	p = realloc(ptr, size);
+	if (!p)
+	{
+		fprintf(stderr, "bench: realloc(%zu) failed\n", size);
+		_exit(1);
+	}
+	return (p);
+}
+
+static void	*xcalloc(size_t n, size_t size)
+{
+	void	*p;
+
+	p = calloc(n, size);
+	if (!p)
+	{
+		fprintf(stderr, "bench: calloc(%zu, %zu) failed\n", n, size);
+		_exit(1);
+	}
+	return (p);
+}
+
+/*
+** Fixed-size churn: one malloc/free pair per iteration, with a small
+** window of live blocks so the allocator cannot hand back the same block
+** every time. One size per ft_malloc zone type: TINY, SMALL, MEDIUM, and
+** LARGE (over FT_MMAP_THRESHOLD, one mapping per block).
+*/
+
+static uint64_t	churn(uint64_t iters, size_t size)
+{
+	void		*win[32];
+	uint64_t	i;
+
+	memset(win, 0, sizeof(win));
+	for (i = 0; i < iters; i++)
+	{
+		free(win[i & 31]);
+		win[i & 31] = xmalloc(size);
+	}
+	for (i = 0; i < 32; i++)
+		free(win[i]);
+	return (iters * 2);
+}
+
+static uint64_t	churn_tiny(uint64_t scale)
+{
+	return (churn(1000000 * scale, 64));
+}
+
+static uint64_t	churn_small(uint64_t scale)
+{
+	return (churn(1000000 * scale, 512));
+}
+
+static uint64_t	churn_medium(uint64_t scale)
+{
+	return (churn(100000 * scale, 16 * 1024));
+}
+
+static uint64_t	churn_large(uint64_t scale)
+{
+	return (churn(20000 * scale, 1024 * 1024));
+}
+
+/*
+** Random sizes in [1, 4096] over 4096 slots: each iteration frees a random
+** slot and refills it.
+*/
+
+static uint64_t	random_1_4096(uint64_t scale)
+{
+	void		**slots;
+	uint64_t	i;
+	uint64_t	n;
+	size_t		k;
+
+	slots = xcalloc(4096, sizeof(void *));
+	n = 250000 * scale;
+	for (i = 0; i < n; i++)
+	{
+		k = rng() & 4095;
+		free(slots[k]);
+		slots[k] = xmalloc(rng() % 4096 + 1);
+	}
+	for (k = 0; k < 4096; k++)
+		free(slots[k]);
+	free(slots);
+	return (n * 2);
+}
+
+/*
+** realloc growth chains: buffers growing by small steps (string
+** builders) and geometrically (vectors), with other blocks interleaved.
+*/
+
+static uint64_t	realloc_chain(uint64_t chains, size_t step, size_t mult,
+	size_t max)
+{
+	void		*p;
+	void		*other;
+	uint64_t	ops;
+	uint64_t	c;
+	size_t		size;
+
+	ops = 0;
+	for (c = 0; c < chains; c++)
+	{
+		p = NULL;
+		other = NULL;
+		for (size = 16; size <= max; size = size * mult + step)
+		{
+			p = xrealloc(p, size);
+			((char *)p)[size - 1] = 1;
+			if ((ops & 7) == 0)
+			{
+				free(other);
+				other = xmalloc(48);
+				ops += 2;
+			}
+			ops++;
+		}
+		free(p);
+		free(other);
+		ops += 2;
+	}
+	return (ops);
+}
+
+static uint64_t	realloc_grow_step(uint64_t scale)
+{
+	return (realloc_chain(2000 * scale, 32, 1, 8192));
+}
+
+static uint64_t	realloc_grow_double(uint64_t scale)
+{
+	return (realloc_chain(1000 * scale, 0, 2, 1024 * 1024));
+}
+
+/*
+** Allocate-all then free-all, sizes in [16, 1024].
+*/
+
+#define FILL_COUNT	100000
+
+static void	shuffle(void **v, size_t n)
+{
+	void	*tmp;
+	size_t	i;
+	size_t	j;
+
+	for (i = n - 1; i > 0; i--)
+	{
+		j = rng() % (i + 1);
+		tmp = v[i];
+		v[i] = v[j];
+		v[j] = tmp;
+	}
+}
+
+static uint64_t	fill_free(uint64_t scale, int order)
+{
+	void		**v;
+	uint64_t	r;
+	size_t		i;
+
+	v = xcalloc(FILL_COUNT, sizeof(void *));
+	for (r = 0; r < 5 * scale; r++)
+	{
+		for (i = 0; i < FILL_COUNT; i++)
+			v[i] = xmalloc(rng() % 1009 + 16);
+		if (order == 2)
+			shuffle(v, FILL_COUNT);
+		for (i = 0; i < FILL_COUNT; i++)
+			free(v[order == 0 ? FILL_COUNT - 1 - i : i]);
+	}
+	free(v);
+	return (5 * scale * FILL_COUNT * 2);
+}
+
+static uint64_t	fill_free_lifo(uint64_t scale)
+{
+	return (fill_free(scale, 0));
+}
+
+static uint64_t	fill_free_fifo(uint64_t scale)
+{
+	return (fill_free(scale, 1));
+}
+
+static uint64_t	fill_free_random(uint64_t scale)
+{
+	return (fill_free(scale, 2));
+}
+
+/*
+** Long-lived plus short-lived mix: 10000 long-lived blocks replaced at
+** random one time in ten, while short-lived blocks die within 16
+** allocations.
+*/
+
+static uint64_t	mixed_lifetime(uint64_t scale)
+{
+	void		**lng;
+	void		*shrt[16];
+	uint64_t	i;
+	uint64_t	n;
+	size_t		k;
+
+	lng = xcalloc(10000, sizeof(void *));
+	memset(shrt, 0, sizeof(shrt));
+	for (k = 0; k < 10000; k++)
+		lng[k] = xmalloc(rng() % 2048 + 16);
+	n = 1000000 * scale;
+	for (i = 0; i < n; i++)
+	{
+		if (rng() % 10 == 0)
+		{
+			k = rng() % 10000;
+			free(lng[k]);
+			lng[k] = xmalloc(rng() % 2048 + 16);
+		}
+		else
+		{
+			free(shrt[i & 15]);
+			shrt[i & 15] = xmalloc(rng() % 256 + 8);
+		}
+	}
+	for (k = 0; k < 10000; k++)
+		free(lng[k]);
+	for (k = 0; k < 16; k++)
+		free(shrt[k]);
+	free(lng);
+	return (10000 * 2 + n * 2);
+}
+
+static const t_bench	g_benches[] = {
+	{"churn_tiny", churn_tiny},
+	{"churn_small", churn_small},
+	{"churn_medium", churn_medium},
+	{"churn_large", churn_large},
+	{"random_1_4096", random_1_4096},
+	{"realloc_grow_step", realloc_grow_step},
+	{"realloc_grow_double", realloc_grow_double},
+	{"fill_free_lifo", fill_free_lifo},
+	{"fill_free_fifo", fill_free_fifo},
+	{"fill_free_random", fill_free_random},
+	{"mixed_lifetime", mixed_lifetime},
+	{NULL, NULL}
+};
+
+static uint64_t	now_ns(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+}
+
+/*
+** run_one()
+**
+** The child reports ops and elapsed time through a pipe; the parent adds
+** the child's peak RSS.
+*/
+
+static int	run_one(const t_bench *b, const char *label, uint64_t scale)
+{
+	uint64_t		res[2];
+	struct rusage	ru;
+	int				fds[2];
+	int				status;
+	pid_t			pid;
+
+	if (pipe(fds) != 0)
+		return (-1);
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0)
+		return (-1);
+	if (pid == 0)
+	{
+		close(fds[0]);
+		res[1] = now_ns();
+		res[0] = b->fn(scale);
+		res[1] = now_ns() - res[1];
+		if (write(fds[1], res, sizeof(res)) != sizeof(res))
+			_exit(1);
+		_exit(0);
+	}
+	close(fds[1]);
+	if (read(fds[0], res, sizeof(res)) != sizeof(res))
+		res[0] = 0;
+	close(fds[0]);
+	if (wait4(pid, &status, 0, &ru) < 0 || !WIFEXITED(status)
+		|| WEXITSTATUS(status) != 0 || res[0] == 0)
+	{
+		fprintf(stderr, "bench: %s failed under %s\n", b->name, label);
+		return (-1);
+	}
+	printf("%s\t%s\t%llu\t%.1f\t%ld\n", b->name, label,
+		(unsigned long long)res[0], (double)res[1] / (double)res[0],
+		ru.ru_maxrss);
+	return (0);
+}
+
+static int	selected(const char *name, int argc, char **argv, int first)
+{
+	int	i;
+
+	if (first >= argc)
+		return (1);
+	for (i = first; i < argc; i++)
+		if (strcmp(argv[i], name) == 0)
+			return (1);
+	return (0);
+}
+
+int	main(int argc, char **argv)
+{
+	const char	*label;
+	uint64_t	scale;
+	int			header;
+	int			ret;
+	int			opt;
+	int			i;
+
+	label = "system";
+	scale = 1;
+	header = 1;
+	while ((opt = getopt(argc, argv, "a:n:H")) != -1)
+	{
+		if (opt == 'a')
+			label = optarg;
+		else if (opt == 'n')
+			scale = strtoull(optarg, NULL, 10);
+		else if (opt == 'H')
+			header = 0;
+		else
+		{
+			fprintf(stderr, "usage: bench [-a label] [-n scale] [-H] "
+				"[name ...]\n");
+			return (2);
+		}
+	}
+	if (scale == 0)
+		scale = 1;
+	if (header)
+		printf("benchmark\tallocator\tops\tns_per_op\tmax_rss_kb\n");
+	ret = 0;
+	for (i = 0; g_benches[i].name; i++)
+		if (selected(g_benches[i].name, argc, argv, optind)
+			&& run_one(&g_benches[i], label, scale) != 0)
+			ret = 1;
+	return (ret);
+}
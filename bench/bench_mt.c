@@ -0,0 +1,373 @@
+/*
+** bench_mt - Multi-threaded allocator scalability benchmarks
+**
+** Like bench.c, measures whatever malloc() the process resolves. ft_malloc
+** must be built with USE_MALLOC_LOCK=1 to be thread safe; `make bench-mt`
+** does that and runs both allocators.
+**
+** Usage: bench_mt [-a label] [-t max_threads] [-n scale] [-H] [name ...]
+**   -a   allocator column value (default "system")
+**   -t   run at 1, 2, 4, ... threads, then at this many (default: CPUs
+**        online)
+**   -n   multiply the per-thread work (default 1)
+**   -H   do not print the header row
+**
+** Benchmarks:
+**   larson      server simulation: every thread replaces random blocks in
+**               its own working set, then the sets rotate between threads
+**               so most frees hit blocks another thread allocated
+**   prodcons    threads paired as producer and consumer over a SPSC ring:
+**               every block is freed by a thread that did not allocate it
+**   local_churn each thread allocates and frees only its own blocks
+**
+** Output is tab separated, one row per benchmark and thread count:
+**   benchmark  allocator  threads  ops  ops_per_sec  efficiency
+** efficiency = ops_per_sec / (threads * ops_per_sec at 1 thread); 1.0 is
+** linear scaling. Every thread does the same amount of work, so wall time
+** at N threads should stay flat when the allocator scales.
+*/
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LARSON_SLOTS	1024
+#define LARSON_ROUNDS	20
+#define RING_SIZE		1024
+
+typedef struct s_ring
+{
+	void			*slot[RING_SIZE];
+	uint64_t		head;
+	char			pad[64];			/* Producer and consumer lines */
+	uint64_t		tail;
+}	t_ring;
+
+typedef struct s_run
+{
+	int					threads;
+	uint64_t			work;			/* Per-thread iterations */
+	pthread_barrier_t	barrier;
+	void				***sets;		/* larson working sets */
+	t_ring				*rings;			/* prodcons, one per pair */
+}	t_run;
+
+typedef struct s_worker	t_worker;
+typedef void			(*t_bench_fn)(t_worker *w);
+
+struct s_worker
+{
+	t_run		*run;
+	t_bench_fn	fn;
+	int			id;
+	uint64_t	rng;
+	uint64_t	ops;
+};
+
+typedef struct s_bench
+{
+	const char	*name;
+	t_bench_fn	fn;
+	uint64_t	work;				/* Per-thread iterations at scale 1 */
+}	t_bench;
+
+static uint64_t	rng(t_worker *w)
+{
+	w->rng ^= w->rng << 13;
+	w->rng ^= w->rng >> 7;
+	w->rng ^= w->rng << 17;
+	return (w->rng);
+}
+
+static void	*xmalloc(size_t size)
+{
+	void	*p;
+
+	p = malloc(size);
+	if (!p)
+	{
+		fprintf(stderr, "bench_mt: malloc(%zu) failed\n", size);
+		exit(1);
+	}
+	*(volatile char *)p = 1;
+	return (p);
+}
+
+/*
+** larson: work / LARSON_ROUNDS replacements per round; after each round
+** thread i takes over the set of thread i + 1.
+*/
+
+static void	bench_larson(t_worker *w)
+{
+	t_run		*run;
+	void		**set;
+	uint64_t	per_round;
+	uint64_t	i;
+	int			r;
+	size_t		k;
+
+	run = w->run;
+	set = run->sets[w->id];
+	for (k = 0; k < LARSON_SLOTS; k++)
+		set[k] = xmalloc(rng(w) % 1009 + 16);
+	w->ops += LARSON_SLOTS;
+	per_round = run->work / LARSON_ROUNDS;
+	for (r = 0; r < LARSON_ROUNDS; r++)
+	{
+		set = run->sets[(w->id + r) % run->threads];
+		pthread_barrier_wait(&run->barrier);
+		for (i = 0; i < per_round; i++)
+		{
+			k = rng(w) % LARSON_SLOTS;
+			free(set[k]);
+			set[k] = xmalloc(rng(w) % 1009 + 16);
+		}
+		w->ops += per_round * 2;
+		pthread_barrier_wait(&run->barrier);
+	}
+	for (k = 0; k < LARSON_SLOTS; k++)
+		free(set[k]);
+	w->ops += LARSON_SLOTS;
+}
+
+/*
+** prodcons: even ids produce into ring id / 2, odd ids consume from it.
+** With one thread the same thread alternates between both roles.
+*/
+
+static int	ring_push(t_ring *r, void *p)
+{
+	uint64_t	head;
+
+	head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+	if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == RING_SIZE)
+		return (0);
+	r->slot[head & (RING_SIZE - 1)] = p;
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	return (1);
+}
+
+static void	*ring_pop(t_ring *r)
+{
+	uint64_t	tail;
+	void		*p;
+
+	tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+	if (tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE))
+		return (NULL);
+	p = r->slot[tail & (RING_SIZE - 1)];
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+	return (p);
+}
+
+static void	bench_prodcons(t_worker *w)
+{
+	t_ring		*ring;
+	uint64_t	i;
+	void		*p;
+
+	ring = &w->run->rings[w->id / 2];
+	for (i = 0; i < w->run->work; i++)
+	{
+		if (w->run->threads == 1 || (w->id & 1) == 0)
+		{
+			p = xmalloc(rng(w) % 497 + 16);
+			while (!ring_push(ring, p))
+				sched_yield();
+		}
+		if (w->run->threads == 1 || (w->id & 1) == 1)
+		{
+			while ((p = ring_pop(ring)) == NULL)
+				sched_yield();
+			free(p);
+		}
+	}
+	w->ops += w->run->work * (w->run->threads == 1 ? 2 : 1);
+}
+
+static void	bench_local_churn(t_worker *w)
+{
+	void		*win[64];
+	uint64_t	i;
+
+	memset(win, 0, sizeof(win));
+	for (i = 0; i < w->run->work; i++)
+	{
+		free(win[i & 63]);
+		win[i & 63] = xmalloc(rng(w) % 497 + 16);
+	}
+	for (i = 0; i < 64; i++)
+		free(win[i]);
+	w->ops += w->run->work * 2;
+}
+
+static const t_bench	g_benches[] = {
+	{"larson", bench_larson, 200000},
+	{"prodcons", bench_prodcons, 200000},
+	{"local_churn", bench_local_churn, 500000},
+	{NULL, NULL, 0}
+};
+
+static uint64_t	now_ns(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+}
+
+static void	*worker_main(void *arg)
+{
+	t_worker	*w;
+
+	w = arg;
+	w->fn(w);
+	return (NULL);
+}
+
+/*
+** run_one()
+**
+** Returns ops/s of 'b' at 'threads' threads, 0 on failure.
+*/
+
+static double	run_one(const t_bench *b, int threads, uint64_t scale,
+	uint64_t *ops)
+{
+	t_run		run;
+	t_worker	*workers;
+	pthread_t	*tids;
+	uint64_t	elapsed;
+	int			i;
+
+	memset(&run, 0, sizeof(run));
+	run.threads = threads;
+	run.work = b->work * scale;
+	pthread_barrier_init(&run.barrier, NULL, (unsigned)threads);
+	workers = calloc((size_t)threads, sizeof(*workers));
+	tids = calloc((size_t)threads, sizeof(*tids));
+	run.sets = calloc((size_t)threads, sizeof(void **));
+	run.rings = calloc((size_t)(threads / 2 + 1), sizeof(t_ring));
+	for (i = 0; i < threads; i++)
+		run.sets[i] = calloc(LARSON_SLOTS, sizeof(void *));
+	elapsed = now_ns();
+	for (i = 0; i < threads; i++)
+	{
+		workers[i].run = &run;
+		workers[i].id = i;
+		workers[i].rng = 0x9e3779b97f4a7c15ULL * (uint64_t)(i + 1);
+		workers[i].fn = b->fn;
+		if (pthread_create(&tids[i], NULL, worker_main, &workers[i]) != 0)
+		{
+			fprintf(stderr, "bench_mt: pthread_create failed\n");
+			exit(1);
+		}
+	}
+	*ops = 0;
+	for (i = 0; i < threads; i++)
+	{
+		pthread_join(tids[i], NULL);
+		*ops += workers[i].ops;
+	}
+	elapsed = now_ns() - elapsed;
+	for (i = 0; i < threads; i++)
+		free(run.sets[i]);
+	free(run.sets);
+	free(run.rings);
+	free(tids);
+	free(workers);
+	pthread_barrier_destroy(&run.barrier);
+	return (elapsed ? (double)*ops * 1e9 / (double)elapsed : 0.0);
+}
+
+static int	selected(const char *name, int argc, char **argv, int first)
+{
+	int	i;
+
+	if (first >= argc)
+		return (1);
+	for (i = first; i < argc; i++)
+		if (strcmp(argv[i], name) == 0)
+			return (1);
+	return (0);
+}
+
+/*
+** Thread counts double, and the last one is always max_threads even when
+** it is not a power of two.
+*/
+
+static int	next_count(int threads, long max_threads)
+{
+	if (threads == max_threads)
+		return (threads + 1);
+	if (threads * 2 > max_threads)
+		return ((int)max_threads);
+	return (threads * 2);
+}
+
+int	main(int argc, char **argv)
+{
+	const char	*label;
+	uint64_t	scale;
+	uint64_t	ops;
+	double		base;
+	double		rate;
+	long		max_threads;
+	int			header;
+	int			opt;
+	int			threads;
+	int			i;
+
+	label = "system";
+	scale = 1;
+	header = 1;
+	max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "a:t:n:H")) != -1)
+	{
+		if (opt == 'a')
+			label = optarg;
+		else if (opt == 't')
+			max_threads = strtol(optarg, NULL, 10);
+		else if (opt == 'n')
+			scale = strtoull(optarg, NULL, 10);
+		else if (opt == 'H')
+			header = 0;
+		else
+		{
+			fprintf(stderr, "usage: bench_mt [-a label] [-t max_threads] "
+				"[-n scale] [-H] [name ...]\n");
+			return (2);
+		}
+	}
+	if (scale == 0)
+		scale = 1;
+	if (max_threads < 1)
+		max_threads = 1;
+	if (header)
+		printf("benchmark\tallocator\tthreads\tops\tops_per_sec\tefficiency\n");
+	for (i = 0; g_benches[i].name; i++)
+	{
+		if (!selected(g_benches[i].name, argc, argv, optind))
+			continue ;
+		base = 0.0;
+		for (threads = 1; threads <= max_threads; threads = next_count(threads,
+			max_threads))
+		{
+			rate = run_one(&g_benches[i], threads, scale, &ops);
+			if (threads == 1)
+				base = rate;
+			printf("%s\t%s\t%d\t%llu\t%.0f\t%.3f\n", g_benches[i].name, label,
+				threads, (unsigned long long)ops, rate,
+				base > 0.0 ? rate / (base * threads) : 0.0);
+			fflush(stdout);
+		}
+	}
+	return (0);
+}
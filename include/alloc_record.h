@@ -0,0 +1,69 @@
+#ifndef ALLOC_RECORD_H
+# define ALLOC_RECORD_H
+
+# include <stdint.h>
+
+/*
+** Allocation recording (tools/ft_record.c, tools/ft_replay.c)
+**
+** libft_record.so is an LD_PRELOAD interposer that sits in front of
+** whatever allocator the process uses (libft_malloc.so through ./run, or
+** glibc) and writes every malloc/calloc/realloc/free call to a file:
+**
+**   FT_RECORD=app.rec ./run ./app
+**   FT_RECORD=app.rec LD_PRELOAD=./libft_record.so ./app     (glibc)
+**
+** A file holds one process. With "%p" in the name (FT_RECORD=app.%p.rec)
+** each process writes its own, named after its pid; without, only the
+** first process to open the file records.
+**
+** Pointers are not recorded as addresses but as allocation ids, so the
+** sequence can be replayed against any allocator:
+**
+**   ./ft_replay app.rec                                      (glibc)
+**   LD_PRELOAD=./libft_malloc.so ./ft_replay app.rec
+**
+** File layout: one ft_rec_hdr_t, then ft_rec_event_t records in call
+** order (the recorder serialises them). Native endian.
+*/
+
+# define FT_RECORD_ENV		"FT_RECORD"
+# define FT_RECORD_MAGIC	"FTREC001"
+# define FT_RECORD_VERSION	1
+
+/*
+** Event types
+**
+** MALLOC   id = new allocation, size = requested bytes (calloc: n * size)
+** FREE     old_id = freed allocation (0: not allocated while recording)
+** REALLOC  old_id = input (0 for realloc(NULL, n)), id = result (0 if the
+**          call freed or failed), size = requested bytes
+*/
+
+# define FT_REC_MALLOC		1
+# define FT_REC_FREE		2
+# define FT_REC_REALLOC		3
+
+typedef struct s_rec_hdr
+{
+	char		magic[8];		/* FT_RECORD_MAGIC, not NUL terminated */
+	uint32_t	version;		/* FT_RECORD_VERSION */
+	uint32_t	event_size;		/* sizeof(ft_rec_event_t) */
+}	t_rec_hdr;
+
+typedef t_rec_hdr	ft_rec_hdr_t;
+
+typedef struct s_rec_event
+{
+	uint8_t		op;				/* FT_REC_* */
+	uint8_t		reserved[3];
+	uint32_t	thread;			/* Recorder thread index, from 0 */
+	uint64_t	ts_ns;			/* Nanoseconds since recording started */
+	uint64_t	size;
+	uint64_t	id;
+	uint64_t	old_id;
+}	t_rec_event;
+
+typedef t_rec_event	ft_rec_event_t;
+
+#endif
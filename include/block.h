@@ -3,6 +3,7 @@
 
 # include <stddef.h>
 # include <stdint.h>
+# include "align.h"
 
 #ifndef SHOW_MORE
 # define SHOW_MORE 0
@@ -25,6 +26,24 @@
 ** Design decision: We use double-linked lists for both the address-order
 ** list and free list. This allows O(1) removal and easy coalescing of
 ** adjacent free blocks.
+**
+** Out-of-band layout (make OOB=1, FT_OOB_META)
+**
+** The ft_block_t of a non-LARGE block no longer sits in front of its data:
+** each such zone keeps its descriptors in a dense side table, mapped apart
+** from the zone, plus one index entry per FT_ALIGN_SIZE granule of the
+** zone to find the descriptor of a user pointer. User data is packed
+** back to back:
+**
+**   zone:       [ft_zone_t][data][data][data]...
+**   side table: [index: uint32_t per granule][ft_block_t][ft_block_t]...
+**
+** An overrun now lands in the next allocation instead of the allocator's
+** lists, free-list and coalescing scans only touch the side table, and
+** after fork() the pages holding only user data are never written by the
+** allocator. A LARGE zone keeps its single descriptor right after the
+** zone header. Code outside block.c reaches the data through
+** ft_block_start() and ft_block_data_ptr() and works with both layouts.
 */
 
 typedef struct s_block
@@ -36,6 +55,8 @@ typedef struct s_block
 	#endif
 	
 	uint8_t			is_free;	/* 1 if free, 0 if allocated */
+	uint8_t			size_class;	/* Statistics class of the request (see stats.h) */
+	uint8_t			flags;		/* FT_BLOCK_* flags, reset on every allocation */
 
 	/* Address-order list - tracks all blocks in memory order (also free blocks -> ALL) */
 	struct s_block	*prev;			/* Previous block in address order */
@@ -46,21 +67,62 @@ typedef struct s_block
 	struct s_block	*next_free;		/* Next free block */
 
 	uint32_t	magic;		/* Magic number for validation (0xDEADBEEF) */
+	uint32_t	slack;		/* size - requested bytes, allocated blocks only */
 	void		*zone;			/* Pointer back to ft_zone_t */
+#ifdef FT_OOB_META
+	uint8_t		*data;			/* Start of the block's memory in the zone */
+#endif
 }	t_block;
 
 typedef t_block	ft_block_t;
 
 # define FT_ALLOC_MAGIC 0xDEADBEEF
 
+/*
+** Block flags
+**
+** FT_BLOCK_SAMPLED: the allocation is tracked by the heap profiler
+** FT_BLOCK_LIFE:    the allocation is a lifetime sample (lifetime.h)
+*/
+
+# define FT_BLOCK_SAMPLED	(1 << 0)
+# define FT_BLOCK_LIFE		(1 << 1)
+
+/*
+** ft_block_set_request() / ft_block_requested()
+**
+** An allocated block remembers how many bytes were asked for as the
+** difference to its size, kept in the padding after 'magic' so the
+** header does not grow. The difference is at most a page plus headers
+** for LARGE blocks and less for the others; it saturates at UINT32_MAX.
+*/
+
+static inline void	ft_block_set_request(ft_block_t *block, size_t user_size)
+{
+	size_t	slack;
+
+	slack = block->size - user_size;
+	block->slack = slack > UINT32_MAX ? UINT32_MAX : (uint32_t)slack;
+}
+
+static inline size_t	ft_block_requested(const ft_block_t *block)
+{
+	return (block->size - block->slack);
+}
+
 /*
 ** FT_BLOCK_HDR_SIZE - Size of block header (aligned)
 **
 ** This is a define to be consistent with our other size constants.
-** The block header sits at the beginning of each memory block.
+** The block header sits at the beginning of each memory block, except in
+** the out-of-band layout where blocks hold user data only.
 */
 
+#ifdef FT_OOB_META
+# define FT_BLOCK_HDR_SIZE 0
+#else
 # define FT_BLOCK_HDR_SIZE (sizeof(ft_block_t))
+#endif
 
 /*
 ** FT_MIN_BLOCK_SIZE - Minimum useful block size
@@ -75,7 +137,11 @@ typedef t_block	ft_block_t;
 ** Used when splitting blocks to ensure the remainder is useful.
 */
 
+#ifdef FT_OOB_META
+# define FT_MIN_BLOCK_SIZE (FT_ALIGN_SIZE)
+#else
 # define FT_MIN_BLOCK_SIZE (FT_BLOCK_HDR_SIZE)
+#endif
 
 /*
 ** ft_alloc_hdr_is_valid()
@@ -96,6 +162,22 @@ static inline int	ft_block_is_valid(const ft_block_t *hdr)
 	return (hdr && hdr->magic == FT_ALLOC_MAGIC);
 }
 
+/*
+** ft_block_start()
+**
+** First byte of the zone covered by a block: its header, or its data in
+** the out-of-band layout. A block spans [start, start + size).
+*/
+
+static inline uint8_t	*ft_block_start(const ft_block_t *block)
+{
+#ifdef FT_OOB_META
+	return (block->data);
+#else
+	return ((uint8_t *)block);
+#endif
+}
+
 /*
 ** ft_block_data_ptr()
 **
@@ -111,7 +193,7 @@ static inline int	ft_block_is_valid(const ft_block_t *hdr)
 
 static inline void	*ft_block_data_ptr(ft_block_t *block)
 {
-	return ((void *)((uint8_t *)block + FT_BLOCK_HDR_SIZE));
+	return ((void *)(ft_block_start(block) + FT_BLOCK_HDR_SIZE));
 }
 
 /*
@@ -126,13 +208,29 @@ static inline void	*ft_block_data_ptr(ft_block_t *block)
 ** Context: Used when we have an allocation header and need to find
 ** the block it belongs to (though typically we store block pointer
 ** in the allocation header itself).
+**
+** In the out-of-band layout the descriptor is looked up in the side table
+** of the zone holding 'ptr'; NULL if no block starts there.
 */
 
+#ifdef FT_OOB_META
+
+ft_block_t	*ft_block_lookup(void *ptr);
+
+static inline ft_block_t	*ft_block_from_data_ptr(void *ptr)
+{
+	return (ft_block_lookup(ptr));
+}
+
+#else
+
 static inline ft_block_t	*ft_block_from_data_ptr(void *ptr)
 {
 	return ((ft_block_t *)((uint8_t *)ptr - FT_BLOCK_HDR_SIZE));
 }
 
+#endif
+
 /*
 ** Block manipulation functions (implemented in block.c)
 */
@@ -208,5 +306,23 @@ int			ft_block_can_merge(ft_block_t *a, ft_block_t *b);
 
 void		ft_block_merge(ft_block_t *a, ft_block_t *b);
 
+#ifdef FT_OOB_META
+
+/*
+** ft_block_desc_new()
+**
+** Takes a descriptor from a zone's side table for a block starting at
+** 'data' and indexes it. Only the side table fields are set: the caller
+** goes on with ft_block_init().
+**
+** @param zone: Zone (ft_zone_t) with a side table
+** @param data: Start of the block in the zone
+** @return: The descriptor
+*/
+
+ft_block_t	*ft_block_desc_new(void *zone, uint8_t *data);
+
+#endif
+
 #endif
 
@@ -0,0 +1,168 @@
+#ifndef CONF_H
+# define CONF_H
+
+# include <stddef.h>
+# include <stdint.h>
+# include "size_class.h"
+
+/*
+** Runtime tunables (FT_MALLOC_CONF)
+**
+** The compile-time defaults from zone.h and prefault.h can be overridden
+** per process, without rebuilding the library, through the FT_MALLOC_CONF
+** environment variable:
+**
+**   FT_MALLOC_CONF=tiny_max:256,small_max:2048,small_zone_pages:64
+**
+** Format: comma separated key:value pairs. Values are decimal and accept
+** a k/m/g suffix (powers of 1024). Unknown keys, and values that are
+** malformed or do not fit in a size_t, are reported on stderr and ignored.
+** tiny_max, small_max and mmap_threshold are capped (see below) and
+** rounded up to a size class (see size_class.h).
+**
+** Keys:
+**   tiny_max          Largest TINY request in bytes     (FT_TINY_MAX)
+**   small_max         Largest SMALL request in bytes    (FT_SMALL_MAX)
+**   mmap_threshold    Largest MEDIUM request in bytes, larger ones are
+**                     mapped on their own; small_max turns MEDIUM off
+**                     (FT_MMAP_THRESHOLD)
+**   tiny_zone_pages   Pages per TINY zone               (FT_TINY_ZONE_PAGES)
+**   small_zone_pages  Pages per SMALL zone              (FT_SMALL_ZONE_PAGES)
+**   medium_zone_pages Pages per MEDIUM zone             (FT_MEDIUM_ZONE_PAGES)
+**   prefault          FT_PREFAULT_* flags               (FT_PREFAULT_MODE)
+**   prefault_large    Minimum populated LARGE zone      (FT_PREFAULT_LARGE_MIN)
+**   trim_threshold    Empty zone bytes kept mapped      (FT_TRIM_THRESHOLD)
+**   prof_sample       Mean bytes between heap profiler samples, 0 = off
+**                     (FT_PROF_SAMPLE, only with make PROFILING=1)
+**   guard_sample      Mean allocations between guard-page samples,
+**                     0 = off (FT_GUARD_SAMPLE, only with make GUARD=1)
+**   guard_left        1: guarded objects start at their slot and catch
+**                     underflows instead of overflows (see guard.h)
+**   numa              1: place zones on the calling thread's NUMA node
+**   numa_nodes        Simulated node count for numa:1, 0 = detect
+**                     (see numa.h)
+**   decay_ms          Half-life in ms of unused free memory before a
+**                     background thread purges it, 0 = off (FT_DECAY_MS,
+**                     needs USE_MALLOC_LOCK=1, see trim.h)
+**   life_sample       Mean allocations between lifetime samples, 0 = off
+**                     (FT_LIFE_SAMPLE, only with make LIFETIME=1, see
+**                     lifetime.h)
+**
+** The string is parsed once, at library load, without calling malloc().
+*/
+
+# define FT_CONF_ENV "FT_MALLOC_CONF"
+
+/*
+** FT_ZONE_MIN_ALLOCS - Minimum allocations a TINY/SMALL zone must hold
+**
+** Zone sizes given through FT_MALLOC_CONF are raised to honour this, as
+** the compile-time defaults do (see zone.h).
+*/
+
+# define FT_ZONE_MIN_ALLOCS 100
+
+/*
+** FT_CONF_SMALL_LIMIT - Largest tiny_max and small_max accepted
+** FT_CONF_MMAP_LIMIT  - Largest mmap_threshold accepted
+**
+** A zone holds FT_ZONE_MIN_ALLOCS (FT_MEDIUM_MIN_ALLOCS) of its largest
+** request, so an unbounded limit would ask for zones mmap() cannot give.
+*/
+
+# define FT_CONF_SMALL_LIMIT (64 * 1024)
+# define FT_CONF_MMAP_LIMIT  (4 * 1024 * 1024)
+
+/*
+** FT_MEDIUM_MIN_ALLOCS - Same for MEDIUM zones, of mmap_threshold bytes
+*/
+
+# define FT_MEDIUM_MIN_ALLOCS 8
+
+/*
+** FT_TRIM_THRESHOLD - Bytes of empty non-LARGE zones kept mapped
+**
+** Once empty zones hold more than this, the next zone to become empty is
+** unmapped. The default keeps every zone, like the allocator always did.
+*/
+
+#ifndef FT_TRIM_THRESHOLD
+# define FT_TRIM_THRESHOLD ((size_t)-1)
+#endif
+
+/*
+** FT_DECAY_MS - Default half-life of unused free memory, 0 = no decay
+*/
+
+#ifndef FT_DECAY_MS
+# define FT_DECAY_MS 0
+#endif
+
+/*
+** ft_conf_t - Effective tunables
+*/
+
+typedef struct s_conf
+{
+	uint8_t	loaded;				/* 1 once FT_MALLOC_CONF was parsed */
+	size_t	tiny_max;			/* Largest TINY request */
+	size_t	small_max;			/* Largest SMALL request */
+	size_t	mmap_threshold;		/* Largest MEDIUM request */
+	size_t	tiny_zone_pages;	/* Pages per TINY zone */
+	size_t	small_zone_pages;	/* Pages per SMALL zone */
+	size_t	medium_zone_pages;	/* Pages per MEDIUM zone */
+	size_t	trim_threshold;		/* Empty zone bytes kept mapped */
+	size_t	prof_sample;		/* Mean bytes between profiler samples */
+	size_t	guard_sample;		/* Mean allocations between guard samples */
+	size_t	guard_left;			/* Guarded objects against the front page */
+	size_t	numa;				/* Zones placed per NUMA node */
+	size_t	numa_nodes;			/* Simulated node count, 0 = detect */
+	size_t	decay_ms;			/* Half-life of unused free memory */
+	size_t	life_sample;		/* Mean allocations between lifetime samples */
+	uint8_t	class_zone[FT_CLASS_COUNT];	/* Zone type of each size class */
+}	t_conf;
+
+typedef t_conf	ft_conf_t;
+
+/*
+** Global configuration (defined in conf.c)
+*/
+
+extern ft_conf_t	g_ft_conf;
+
+/*
+** ft_conf_load()
+**
+** Parses FT_MALLOC_CONF and applies it. Runs as a library constructor,
+** and lazily from ft_conf_get() when malloc() is called before that.
+*/
+
+void	ft_conf_load(void);
+
+/*
+** ft_conf_set()
+**
+** Changes one tunable at runtime, by its FT_MALLOC_CONF key, and keeps
+** the configuration consistent.
+**
+** @param key: Key name (see above)
+** @param value: New value
+** @return: 0 on success, -1 for an unknown key
+*/
+
+int		ft_conf_set(const char *key, size_t value);
+
+/*
+** ft_conf_get()
+**
+** Returns the effective configuration, loading it on first use.
+*/
+
+static inline const ft_conf_t	*ft_conf_get(void)
+{
+	if (!g_ft_conf.loaded)
+		ft_conf_load();
+	return (&g_ft_conf);
+}
+
+#endif
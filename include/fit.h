@@ -25,16 +25,21 @@
 **
 ** Implements first-fit allocation strategy.
 ** Searches zones of the given type for the first free block large enough.
+** Nursery zones only serve nursery allocations, and the other zones only
+** serve the others (see lifetime.h).
 **
-** @param type: Zone type to search (FT_ZONE_TINY, FT_ZONE_SMALL)
+** @param type: Zone type to search (FT_ZONE_TINY, FT_ZONE_SMALL,
+**   FT_ZONE_MEDIUM)
 ** @param size: Minimum block size needed
+** @param nursery: 1 for an allocation predicted short-lived
 ** @param out_zone: Output parameter - pointer to zone containing the block
 ** @return: Pointer to suitable free block, or NULL if none found
 **
 ** Context: Called by malloc to find available space before creating new zones.
 */
 
-ft_block_t	*ft_first_fit(uint8_t type, size_t size, ft_zone_t **out_zone);
+ft_block_t	*ft_first_fit(uint8_t type, size_t size, int nursery,
+	ft_zone_t **out_zone);
 
 #endif
 
@@ -0,0 +1,98 @@
+#ifndef GUARD_H
+# define GUARD_H
+
+# include <stddef.h>
+# include <stdint.h>
+
+/*
+** Sampled guard-page allocations
+**
+** About one allocation in 'guard_sample' (FT_MALLOC_CONF key, 0 = off)
+** is served from a separate pool of slots instead of a zone. Every slot
+** sits between two PROT_NONE pages and the object is placed against the
+** trailing one (the leading one with guard_left:1), so the first access
+** past its end (before its start) faults. Objects stay 16-byte aligned:
+** an overflow smaller than the rounding of the size goes unnoticed.
+**
+** Freed slots are protected again and reused oldest first, so they stay
+** in quarantine as long as the pool allows and a use-after-free faults
+** too. On such a fault, or on a double or invalid free of a pooled
+** pointer, the allocating and freeing call stacks are written to stderr
+** and the process dies. Faults outside the pool go to the handler that
+** was installed before.
+**
+** The pool is reserved on the first sampled allocation; only live slots
+** are backed by memory. Requests larger than a slot, and samples taken
+** while every slot is live, are served by the zones as usual.
+**
+** Enabled with: make GUARD=1
+*/
+
+#ifndef FT_GUARD_SAMPLE
+# define FT_GUARD_SAMPLE		1000
+#endif
+
+# define FT_GUARD_SLOTS			1024
+# define FT_GUARD_SLOT_PAGES	4
+# define FT_GUARD_DEPTH			16
+# define FT_GUARD_SKIP			2
+
+/*
+** Pool bounds (defined in guard.c), 0 until the pool exists
+*/
+
+extern uintptr_t	g_guard_base;
+extern size_t		g_guard_size;
+
+/*
+** Per-thread countdown to the next sample
+*/
+
+extern __thread int64_t	t_guard_left
+	__attribute__((tls_model("initial-exec")));
+
+/*
+** ft_guard_sample()
+**
+** Called by malloc() before the allocator lock is taken. Returns a pooled
+** object when this allocation is sampled, NULL otherwise.
+*/
+
+void	*ft_guard_sample(size_t size);
+
+static inline void	*ft_guard_malloc(size_t size)
+{
+	if (--t_guard_left > 0)
+		return (NULL);
+	return (ft_guard_sample(size));
+}
+
+/*
+** ft_guard_owns()
+**
+** Tells whether a pointer belongs to the guard pool.
+*/
+
+static inline int	ft_guard_owns(const void *ptr)
+{
+	return ((uintptr_t)ptr - g_guard_base < g_guard_size);
+}
+
+/*
+** ft_guard_free()
+**
+** Protects the slot of a pooled pointer and queues it for reuse. Reports
+** and aborts on a double or invalid free.
+*/
+
+void	ft_guard_free(void *ptr);
+
+/*
+** ft_guard_realloc()
+**
+** realloc() of a pooled pointer: the data always moves out of the slot.
+*/
+
+void	*ft_guard_realloc(void *ptr, size_t size);
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef HEAP_PROF_H
+# define HEAP_PROF_H
+
+# include <stddef.h>
+# include <stdint.h>
+
+/*
+** Sampling heap profiler
+**
+** Records the call stack of about one allocation every 'prof_sample'
+** bytes (FT_MALLOC_CONF key, Poisson sampling: the distance between two
+** samples follows an exponential distribution of that mean, so every
+** byte has the same chance of being picked whatever the allocation
+** pattern). Sampled blocks are tracked until they are freed.
+**
+** The profile is written in the legacy gperftools heap format, which
+** pprof reads directly:
+**
+**   heap profile: 3: 1572864 [ 12: 6291456] @ heap_v2/524288
+**    1: 524288 [ 4: 2097152] @ 0x401234 0x401567 0x7f...
+**   ...
+**   MAPPED_LIBRARIES:
+**   <copy of /proc/self/maps>
+**
+** Each line gives, per call stack, in-use objects/bytes and cumulative
+** objects/bytes since startup. pprof scales the samples back up using the
+** rate in the header.
+**
+** Enabled with: make PROFILING=1
+** Output: ft_malloc_prof_dump(), and at exit to $FT_MALLOC_PROF
+**         (default: ft_malloc_<pid>.heap)
+*/
+
+# define FT_PROF_ENV			"FT_MALLOC_PROF"
+
+#ifndef FT_PROF_SAMPLE
+# define FT_PROF_SAMPLE			(512 * 1024)
+#endif
+
+/*
+** Table capacities - allocated with mmap() on first sample
+**
+** FT_PROF_MAX_STACKS distinct call stacks, FT_PROF_MAX_LIVE sampled
+** blocks alive at the same time (must be a power of two). Samples that
+** do not fit are counted in 'dropped' and ignored.
+*/
+
+# define FT_PROF_DEPTH			32
+# define FT_PROF_SKIP			2
+# define FT_PROF_MAX_STACKS		4096
+# define FT_PROF_MAX_LIVE		65536
+
+/*
+** Call stack captured for an allocation that is about to be sampled
+** (depth 0: none)
+*/
+
+typedef struct s_prof_trace
+{
+	int		depth;
+	void	*pcs[FT_PROF_DEPTH + FT_PROF_SKIP];
+}	ft_prof_trace_t;
+
+/*
+** ft_prof_capture()
+**
+** First half of the sampling hook, called by malloc()/realloc() before
+** taking the allocator lock: capturing a stack may itself allocate the
+** first time. Fills 'trace' only if 'size' more bytes reach the next
+** sample.
+**
+** @param size: Requested size
+** @param trace: Filled with the caller's stack, or depth 0
+*/
+
+void	ft_prof_capture(size_t size, ft_prof_trace_t *trace);
+
+/*
+** ft_prof_record()
+**
+** Second half, under the allocator lock once the block exists: counts
+** the bytes towards the next sample and, when it is due, records the
+** block with the stack taken by ft_prof_capture().
+**
+** @param ptr: Pointer about to be returned to the program
+** @param size: Requested size
+** @param trace: Stack captured before the lock
+*/
+
+void	ft_prof_record(void *ptr, size_t size, const ft_prof_trace_t *trace);
+
+/*
+** ft_prof_on_free()
+**
+** Forgets a sampled block. Called by _free() under the allocator lock,
+** only for blocks flagged FT_BLOCK_SAMPLED.
+**
+** @param ptr: User pointer being freed
+*/
+
+void	ft_prof_on_free(void *ptr);
+
+/*
+** ft_malloc_prof_dump()
+**
+** Writes the current profile.
+**
+** @param path: Output file (NULL: $FT_MALLOC_PROF or the default name)
+** @return: 0 on success, -1 if the file could not be written
+*/
+
+int		ft_malloc_prof_dump(const char *path);
+
+#endif
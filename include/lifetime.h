@@ -0,0 +1,97 @@
+#ifndef LIFETIME_H
+# define LIFETIME_H
+
+# include <stddef.h>
+# include <stdint.h>
+
+/*
+** Call-site lifetime prediction
+**
+** A few long-lived objects scattered among short-lived ones keep zones
+** from ever becoming empty. This mode predicts which call sites allocate
+** short-lived objects and keeps those objects apart.
+**
+** The return address of a malloc() or realloc() call names its site.
+** About one allocation in 'life_sample' (FT_MALLOC_CONF key, 0 = stop
+** learning) is tracked until it is freed. Its lifetime is measured in
+** bytes allocated meanwhile, the allocator's own clock:
+**   - shorter than FT_LIFE_SHORT adds one to the site's score
+**   - longer takes FT_LIFE_PENALTY off it, since a long-lived object in a
+**     nursery zone pins that zone
+**
+** Sites scoring FT_LIFE_NURSERY or more are predicted short-lived. Their
+** TINY/SMALL/MEDIUM allocations go to nursery zones, which hold nothing
+** else. A nursery zone therefore empties out as a whole. It is then
+** reused by the next nursery allocations, or unmapped when another zone
+** of its type is already empty.
+**
+** Sites share FT_LIFE_SITES slots by hash of their address. A sample
+** from another site takes the slot over and starts from a zero score.
+** At most FT_LIFE_MAX_LIVE samples (a power of two) are alive at once.
+** Samples that do not fit are ignored.
+**
+** Enabled with: make LIFETIME=1
+*/
+
+#ifndef FT_LIFE_SAMPLE
+# define FT_LIFE_SAMPLE		64
+#endif
+#ifndef FT_LIFE_SHORT
+# define FT_LIFE_SHORT		(1024 * 1024)
+#endif
+
+# define FT_LIFE_SITES		1024
+# define FT_LIFE_MAX_LIVE	4096
+# define FT_LIFE_PENALTY	4
+# define FT_LIFE_NURSERY	4
+# define FT_LIFE_SCORE_MAX	16
+
+/*
+** ft_life_nursery()
+**
+** Tells whether an allocation from 'site' goes to a nursery zone. Called
+** by _malloc() under the allocator lock, for every TINY/SMALL/MEDIUM
+** request.
+*/
+
+int		ft_life_nursery(const void *site);
+
+/*
+** ft_life_on_malloc()
+**
+** Advances the clock and takes a sample now and then. Called by _malloc()
+** under the allocator lock, once the block is allocated.
+**
+** @param ptr: Pointer about to be returned to the program
+** @param site: Return address of the malloc()/realloc() call
+** @param size: Requested size
+*/
+
+void	ft_life_on_malloc(void *ptr, const void *site, size_t size);
+
+/*
+** ft_life_on_free()
+**
+** Scores the site of a sample that ends. Called by _free() under the
+** allocator lock, only for blocks flagged FT_BLOCK_LIFE.
+**
+** @param ptr: User pointer being freed
+*/
+
+void	ft_life_on_free(void *ptr);
+
+/*
+** ft_life_on_move()
+**
+** Carries a sample over to the block a moving realloc() copied it to, so
+** a buffer grown by realloc() is not taken for many short-lived objects.
+** Called by _realloc() under the allocator lock, only for blocks flagged
+** FT_BLOCK_LIFE, before the old block is freed.
+**
+** @param old_ptr: User pointer being moved
+** @param new_ptr: User pointer it moves to
+*/
+
+void	ft_life_on_move(void *old_ptr, void *new_ptr);
+
+#endif
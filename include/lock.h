@@ -0,0 +1,32 @@
+#ifndef LOCK_H
+# define LOCK_H
+
+/*
+** Allocator lock
+**
+** With USE_MALLOC_LOCK every public entry point runs under one global
+** mutex (defined in malloc.c). Other translation units that read or
+** modify the zone lists from outside malloc/free/realloc (statistics,
+** introspection, ...) take the same lock through these macros.
+**
+** Without USE_MALLOC_LOCK the macros evaluate to 0 and the allocator is
+** not thread-safe.
+*/
+
+#ifdef USE_MALLOC_LOCK
+
+# include <pthread.h>
+
+extern pthread_mutex_t	g_mutex;
+
+# define MALLOC_PREACTION   pthread_mutex_lock(&g_mutex)
+# define MALLOC_POSTACTION  pthread_mutex_unlock(&g_mutex)
+
+#else
+
+# define MALLOC_PREACTION   (0)
+# define MALLOC_POSTACTION  (0)
+
+#endif /* USE_MALLOC_LOCK */
+
+#endif
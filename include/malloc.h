@@ -80,5 +80,104 @@ void	*realloc(void *ptr, size_t size);
 
 void	show_alloc_mem(void);
 
+/*
+** show_alloc_mem_ex()
+**
+** show_alloc_mem() with a choice of sections and output. The output is
+** buffered (one write() per few KB) and produced under the allocator
+** lock, so it is one consistent snapshot. show_alloc_mem() is
+** show_alloc_mem_ex(FT_SHOW_ALLOCS, 1).
+**
+** Flags:
+** - FT_SHOW_ALLOCS:    one line per allocation (the show_alloc_mem() format)
+** - FT_SHOW_SUMMARY:   per-zone totals under each zone line
+** - FT_SHOW_FREE:      free blocks too, "start - end : N bytes free"
+** - FT_SHOW_HEXDUMP:   first FT_SHOW_HEXDUMP_MAX bytes of each allocation
+**                      (with FT_SHOW_ALLOCS)
+** - FT_SHOW_HISTOGRAM: requested sizes in power-of-two buckets, after Total
+**
+** @param flags: FT_SHOW_* bits
+** @param fd: Where to write
+*/
+
+# define FT_SHOW_ALLOCS			(1 << 0)
+# define FT_SHOW_SUMMARY		(1 << 1)
+# define FT_SHOW_FREE			(1 << 2)
+# define FT_SHOW_HEXDUMP		(1 << 3)
+# define FT_SHOW_HISTOGRAM		(1 << 4)
+# define FT_SHOW_HEXDUMP_MAX	64
+
+void	show_alloc_mem_ex(int flags, int fd);
+
+/*
+** glibc-compatible statistics and tuning
+**
+** mallinfo2() and mallopt() mirror the glibc extensions of the same name
+** so that monitoring agents and programs tuning glibc keep working when
+** ft_malloc is preloaded. The structure layout and the M_* values match
+** glibc's <malloc.h>.
+*/
+
+# ifndef M_TRIM_THRESHOLD
+#  define M_TRIM_THRESHOLD	-1
+#  define M_TOP_PAD			-2
+#  define M_MMAP_THRESHOLD	-3
+#  define M_MMAP_MAX		-4
+# endif
+
+struct mallinfo2
+{
+	size_t	arena;		/* Bytes mapped for non-LARGE zones */
+	size_t	ordblks;	/* Free blocks in non-LARGE zones */
+	size_t	smblks;		/* Unused (always 0) */
+	size_t	hblks;		/* Number of LARGE allocations */
+	size_t	hblkhd;		/* Bytes mapped for LARGE allocations */
+	size_t	usmblks;	/* Unused (always 0) */
+	size_t	fsmblks;	/* Unused (always 0) */
+	size_t	uordblks;	/* Allocated bytes in non-LARGE zones */
+	size_t	fordblks;	/* Free bytes in non-LARGE zones */
+	size_t	keepcost;	/* Bytes held by empty, releasable zones */
+};
+
+/*
+** mallinfo2()
+**
+** Returns allocator statistics. O(1): the counters are maintained by
+** malloc() and free() as they go, the heap is never walked.
+*/
+
+struct mallinfo2	mallinfo2(void);
+
+/*
+** mallopt()
+**
+** Adjusts a tunable. Supported parameters:
+** - M_MMAP_THRESHOLD: requests above it get a dedicated mapping (LARGE),
+**                     i.e. the MEDIUM limit (mmap_threshold in conf.h)
+** - M_TRIM_THRESHOLD: empty non-LARGE zones are unmapped once empty
+**                     zones hold more than this many bytes
+**
+** @return: 1 on success, 0 for an unsupported parameter or bad value
+*/
+
+int		mallopt(int param, int value);
+
+/*
+** malloc_trim()
+**
+** Returns free memory to the OS without unmapping live zones: every whole
+** page inside a free block is released with madvise(MADV_DONTNEED) (block
+** headers stay in place), and non-LARGE zones without any allocation are
+** unmapped. The first 'pad' bytes of free resident memory found are kept.
+** Meant to be called after a load spike, to shed RSS; it walks every
+** zone, O(zones + free blocks).
+**
+** ft_malloc_trim() returns the number of resident bytes released;
+** malloc_trim() returns 1 if memory was released, 0 otherwise, as glibc's.
+*/
+
+int		malloc_trim(size_t pad);
+size_t	ft_malloc_trim(size_t pad);
+
 #endif
 
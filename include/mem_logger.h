@@ -48,14 +48,48 @@
 #define MEM_LOGGER_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 /*
 ** mem_logger_dump()
 **
-** Dumps current state to JSON.
+** Dumps current state to JSON: the whole heap, or with
+** MALLOC_LOG_FORMAT=delta only what changed since the previous dump
+** (full keyframe every MALLOC_LOG_KEYFRAME dumps).
 */
 void mem_logger_dump(void);
 
+/*
+** Indexed log (MALLOC_LOG_INDEX=1, or trace2json -i)
+**
+** The snapshots are written as usual, then, when the process exits, a
+** footer lets a reader seek to any snapshot without parsing the ones
+** before it:
+**
+**   [snapshot 0][snapshot 1]...[snapshot N-1]
+**   [u64 offset[N]]                   byte offset of each snapshot
+**   [ft_log_index_trailer_t]          last 24 bytes of the file
+**
+** Snapshot i spans offset[i] to offset[i + 1] (the index itself for the
+** last one). FT_LOG_INDEX_KEYFRAME is set in the offsets of full
+** snapshots; a delta snapshot is rebuilt from the closest keyframe
+** before it. Integers are little endian (native on supported targets).
+** The log file is truncated by the first dump instead of appended to.
+*/
+
+#define FT_LOG_INDEX_ENV      "MALLOC_LOG_INDEX"
+#define FT_LOG_INDEX_MAGIC    "FTIDX001"
+#define FT_LOG_INDEX_KEYFRAME (1ULL << 63)
+
+typedef struct s_log_index_trailer
+{
+	char     magic[8];      /* FT_LOG_INDEX_MAGIC, not NUL terminated */
+	uint64_t count;         /* Number of snapshots */
+	uint64_t index_offset;  /* Byte offset of offset[0] */
+} t_log_index_trailer;
+
+typedef t_log_index_trailer ft_log_index_trailer_t;
+
 /*
 ** Wrappers (implemented in mem_logger.c)
 */
@@ -0,0 +1,152 @@
+#ifndef MEM_TRACE_H
+# define MEM_TRACE_H
+
+# include <stddef.h>
+# include <stdint.h>
+
+/*
+** Binary allocation event trace
+**
+** The JSON logger (mem_logger.c) writes the whole heap after every
+** operation, which is O(heap) per call. The trace instead appends one
+** fixed-size record per event to a buffered, append-only file, and
+** tools/trace2json rebuilds the snapshot JSON for the visualizer offline.
+**
+** Usage:
+**   1. Build with make LOGGING=1
+**   2. export MALLOC_LOG_FORMAT=binary
+**      export MALLOC_LOG=trace.bin      (default: malloc_trace_<pid>.bin)
+**   3. Run the program
+**   4. ./trace2json trace.bin malloc_log.json
+**
+** Every malloc(), free() and realloc() in the process is recorded, from
+** inside the allocator, together with zone creation and removal.
+**
+** MALLOC_LOG_FORMAT=async writes the same file from a background thread:
+** each thread appends its records to its own lock-free ring buffer and
+** never waits for the disk. When a ring is full the event is dropped and
+** counted (FT_TRACE_DROPPED records, mem_trace_dropped()). Records of
+** different threads reach the file out of order; readers sort them by
+** timestamp. The drain thread is not restarted in a fork()ed child.
+**
+** File layout: one ft_trace_hdr_t, then ft_trace_rec_t records in the
+** order the operations took the allocator lock. All fields are native
+** endian.
+*/
+
+# define FT_TRACE_FORMAT_ENV	"MALLOC_LOG_FORMAT"
+# define FT_TRACE_MAGIC			"FTTRACE1"
+# define FT_TRACE_VERSION		2
+# define FT_TRACE_BUF_SIZE		(64 * 1024)
+
+/*
+** Async mode: records per thread ring (power of two) and how long the
+** drain thread sleeps when every ring is empty.
+*/
+
+# define FT_TRACE_RING_SIZE		4096
+# define FT_TRACE_DRAIN_NS		1000000
+
+/*
+** Record types
+**
+** MALLOC    ptr = new block, size = block size, zone = owning zone
+** FREE      old_ptr = freed pointer (ptr, size and zone are 0)
+** REALLOC   ptr = result (0 when freed by realloc(p, 0)), old_ptr = input
+**           (0 for realloc(NULL, n)), size/zone describe the result
+** ZONE_NEW  zone = zone address, size = bytes from it to the end of the
+**           mapping (total_size less the cache color)
+** ZONE_DEL  zone and size as for ZONE_NEW
+** DROPPED   tid = thread whose ring overflowed, size = events lost since
+**           the previous DROPPED record of that thread (async mode only)
+**
+** Operations are recorded once they completed, so the zone records they
+** caused come first: a snapshot taken after any MALLOC/FREE/REALLOC
+** record matches the heap as the program saw it.
+*/
+
+# define FT_TRACE_MALLOC		1
+# define FT_TRACE_FREE			2
+# define FT_TRACE_REALLOC		3
+# define FT_TRACE_ZONE_NEW		4
+# define FT_TRACE_ZONE_DEL		5
+# define FT_TRACE_DROPPED		6
+
+typedef struct s_trace_hdr
+{
+	char		magic[8];		/* FT_TRACE_MAGIC, not NUL terminated */
+	uint32_t	version;		/* FT_TRACE_VERSION */
+	uint32_t	record_size;	/* sizeof(ft_trace_rec_t) */
+	uint64_t	start_ns;		/* CLOCK_MONOTONIC when the trace began */
+	uint64_t	pid;			/* Traced process */
+}	t_trace_hdr;
+
+typedef t_trace_hdr	ft_trace_hdr_t;
+
+typedef struct s_trace_rec
+{
+	uint8_t		op;				/* FT_TRACE_* */
+	uint8_t		zone_type;		/* FT_ZONE_* of 'zone' */
+	uint16_t	reserved;
+	uint32_t	tid;			/* Calling thread */
+	uint64_t	ts_ns;			/* CLOCK_MONOTONIC */
+	uint64_t	ptr;
+	uint64_t	old_ptr;
+	uint64_t	size;
+	uint64_t	zone;
+}	t_trace_rec;
+
+typedef t_trace_rec	ft_trace_rec_t;
+
+/*
+** mem_trace_enabled()
+**
+** Returns 1 when MALLOC_LOG_FORMAT is binary or async. Read once.
+*/
+
+int		mem_trace_enabled(void);
+
+/*
+** mem_trace_op()
+**
+** Records a malloc/free/realloc. Called by the public entry points once
+** the operation is done, while they still hold the allocator lock.
+**
+** @param op: FT_TRACE_MALLOC, FT_TRACE_FREE or FT_TRACE_REALLOC
+** @param ptr: Live user pointer returned by the operation, or NULL
+** @param old_ptr: Pointer passed to free()/realloc(), NULL otherwise
+*/
+
+void	mem_trace_op(uint8_t op, void *ptr, void *old_ptr);
+
+/*
+** mem_trace_zone()
+**
+** Records a zone being created (after it is set up) or removed (before
+** it is unmapped).
+**
+** @param op: FT_TRACE_ZONE_NEW or FT_TRACE_ZONE_DEL
+** @param zone: The ft_zone_t
+*/
+
+void	mem_trace_zone(uint8_t op, const void *zone);
+
+/*
+** mem_trace_flush()
+**
+** Writes buffered records out. Also runs at exit, after which records
+** are written unbuffered. In async mode the buffer belongs to the drain
+** thread, which is the only caller until exit.
+*/
+
+void	mem_trace_flush(void);
+
+/*
+** mem_trace_dropped()
+**
+** Async mode: total number of events dropped because a ring was full.
+*/
+
+size_t	mem_trace_dropped(void);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef NUMA_H
+# define NUMA_H
+
+# include <stddef.h>
+# include <stdint.h>
+
+/*
+** NUMA-aware zone placement
+**
+** With 'numa:1' (FT_MALLOC_CONF key) every zone belongs to the NUMA node
+** of the thread that created it: its pages are bound to that node with
+** mbind(MPOL_PREFERRED) before they are first touched, and all but LARGE
+** allocations are only served from zones of the calling thread's node.
+** Each node thus gets its own set of zones, and with them its own free
+** lists; a block freed from another node goes back to its owner's zone.
+**
+** The node count comes from /sys/devices/system/node/possible. On a
+** single-node machine the option changes nothing. 'numa_nodes:N'
+** simulates N nodes instead, for testing: a thread's node is then its
+** thread id modulo N, and zones are only bound when that node exists.
+**
+** A thread's node is looked up with getcpu() and cached for
+** FT_NUMA_REFRESH calls, so a migrated thread moves to its new node soon.
+*/
+
+# define FT_NUMA_MAX_NODES	64
+# define FT_NUMA_REFRESH	256
+
+/*
+** ft_numa_node()
+**
+** Node of the calling thread, 0 when NUMA placement is off.
+*/
+
+int		ft_numa_node(void);
+
+/*
+** ft_numa_active()
+**
+** Tells whether zones are placed per node (option on, more than one node).
+*/
+
+int		ft_numa_active(void);
+
+/*
+** ft_numa_bind()
+**
+** Binds a newly mapped range to a node. Failures are ignored: the pages
+** then follow the default policy.
+**
+** @param addr: Page-aligned start of the range
+** @param size: Length of the range
+** @param node: Target node
+*/
+
+void	ft_numa_bind(void *addr, size_t size, int node);
+
+#endif
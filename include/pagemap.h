@@ -0,0 +1,83 @@
+#ifndef PAGEMAP_H
+# define PAGEMAP_H
+
+# include <stddef.h>
+# include <stdint.h>
+# include "zone.h"
+
+/*
+** Global page map
+**
+** Two-level radix tree from page number to the zone covering that page,
+** filled by ft_zone_create() and cleared by ft_zone_remove(). It answers
+** "does this pointer belong to us, and to which zone?" with two loads,
+** without touching the memory in front of the pointer.
+**
+** A 48-bit address space holds 2^36 4 KB pages, split into 2^18 root
+** slots of 2^18 leaf entries. The root is a static table (2 MB of bss,
+** only the slots in use ever get touched); each leaf is mmap()ed on first
+** use, covers 1 GB of address space and is never released.
+**
+** Entries are written under the allocator lock. Readers may look up
+** without it: the entries of a zone do not change while it holds a live
+** block, and a pointer the library did not allocate is never covered.
+*/
+
+# define FT_PAGEMAP_SHIFT	12
+# define FT_PAGEMAP_L1_BITS	18
+# define FT_PAGEMAP_L2_BITS	18
+
+typedef ft_zone_t	*t_pagemap_leaf[1 << FT_PAGEMAP_L2_BITS];
+
+/*
+** Root table (defined in pagemap.c)
+*/
+
+extern t_pagemap_leaf	*g_pagemap[1 << FT_PAGEMAP_L1_BITS];
+
+/*
+** ft_pagemap_get()
+**
+** Returns the zone covering 'ptr', or NULL if no zone does.
+*/
+
+static inline ft_zone_t	*ft_pagemap_get(const void *ptr)
+{
+	uintptr_t		page;
+	t_pagemap_leaf	*leaf;
+
+	page = (uintptr_t)ptr >> FT_PAGEMAP_SHIFT;
+	if (page >> (FT_PAGEMAP_L1_BITS + FT_PAGEMAP_L2_BITS))
+		return (NULL);
+	leaf = __atomic_load_n(&g_pagemap[page >> FT_PAGEMAP_L2_BITS],
+		__ATOMIC_ACQUIRE);
+	if (!leaf)
+		return (NULL);
+	return ((*leaf)[page & ((1 << FT_PAGEMAP_L2_BITS) - 1)]);
+}
+
+/*
+** ft_pagemap_set()
+**
+** Points every page of [addr, addr + size) at 'zone' (NULL to clear).
+**
+** @return: 0 on success, -1 if a leaf could not be mapped
+*/
+
+int		ft_pagemap_set(void *addr, size_t size, ft_zone_t *zone);
+
+/*
+** Foreign pointers
+**
+** free() and realloc() of a pointer no zone covers (allocated by libc
+** before the library was preloaded, by a library with its own static
+** buffers, ...) go to the next definition in the lookup order, normally
+** libc's, found with dlsym(RTLD_NEXT). Only pointers that pass a sanity
+** check as one of its chunks are forwarded: free() ignores the rest and
+** realloc() fails on them with EINVAL.
+*/
+
+void	ft_foreign_free(void *ptr);
+void	*ft_foreign_realloc(void *ptr, size_t size);
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef PREFAULT_H
+# define PREFAULT_H
+
+# include <stddef.h>
+# include <stdint.h>
+# include <sys/mman.h>
+
+/*
+** Prefaulting policy
+**
+** A freshly mapped zone costs one page fault on the first touch of each of
+** its pages, and those faults land in the middle of whatever the program
+** was doing when it first wrote to the memory. The prefault policy lets a
+** latency-sensitive program pay that cost up front, when the zone is
+** created, instead.
+**
+** Modes are flags and can be combined:
+**
+** FT_PREFAULT_NONE:     Default, pages are faulted in lazily by the kernel
+** FT_PREFAULT_ZONES:    Populate new non-LARGE zones (MAP_POPULATE)
+** FT_PREFAULT_LARGE:    Populate LARGE zones of at least large_threshold
+**                       bytes
+** FT_PREFAULT_REUSE:    Populate the pages of a free block that trim or
+**                       decay gave back, when the block is handed out again
+*/
+
+# define FT_PREFAULT_NONE      0
+# define FT_PREFAULT_ZONES     (1 << 0)
+# define FT_PREFAULT_LARGE     (1 << 1)
+# define FT_PREFAULT_REUSE     (1 << 2)
+
+/*
+** Compile-time defaults (can be changed at runtime with ft_malloc_prefault)
+*/
+
+#ifndef FT_PREFAULT_MODE
+# define FT_PREFAULT_MODE      FT_PREFAULT_NONE
+#endif
+#ifndef FT_PREFAULT_LARGE_MIN
+# define FT_PREFAULT_LARGE_MIN (256 * 1024)
+#endif
+
+#ifdef MAP_POPULATE
+# define FT_MAP_POPULATE MAP_POPULATE
+#else
+# define FT_MAP_POPULATE 0
+#endif
+
+/*
+** ft_prefault_stats_t - Prefault counters
+**
+** Every populated page is a first-touch fault the program will not take
+** (an upper bound: the program may never touch some of them).
+*/
+
+typedef struct s_prefault_stats
+{
+	size_t	zone_pages;		/* Pages populated in new non-LARGE zones */
+	size_t	large_pages;	/* Pages populated in new LARGE zones */
+	size_t	reuse_pages;	/* Released pages populated on reuse */
+}	t_prefault_stats;
+
+typedef t_prefault_stats	ft_prefault_stats_t;
+
+/*
+** ft_prefault_t - Current policy and counters (defined in prefault.c)
+*/
+
+typedef struct s_prefault
+{
+	uint8_t				mode;				/* FT_PREFAULT_* flags */
+	size_t				large_threshold;	/* Minimum LARGE zone to populate */
+	ft_prefault_stats_t	stats;
+}	t_prefault;
+
+typedef t_prefault	ft_prefault_t;
+
+extern ft_prefault_t	g_prefault;
+
+/*
+** ft_malloc_prefault()
+**
+** Changes the prefault policy at runtime.
+**
+** @param mode: Combination of FT_PREFAULT_* flags
+** @param large_threshold: Minimum LARGE zone size populated with
+**                         FT_PREFAULT_LARGE (0 keeps the current value)
+*/
+
+void	ft_malloc_prefault(int mode, size_t large_threshold);
+
+/*
+** ft_malloc_prefault_stats()
+**
+** Copies the prefault counters into 'out'.
+*/
+
+void	ft_malloc_prefault_stats(ft_prefault_stats_t *out);
+
+/*
+** ft_prefault_wanted()
+**
+** Tells whether a new zone of the given type and size must be populated.
+**
+** @param type: Zone type
+** @param total_size: Size of the zone mapping
+** @return: 1 if the zone should be populated, 0 otherwise
+*/
+
+int		ft_prefault_wanted(uint8_t type, size_t total_size);
+
+/*
+** ft_prefault_zone()
+**
+** Populates a new zone that was mapped without MAP_POPULATE (region
+** backend, or a platform without MAP_POPULATE) and accounts for it.
+**
+** @param addr: Start of the zone mapping
+** @param total_size: Size of the zone mapping
+** @param type: Zone type
+** @param populated: 1 if the kernel already populated it (MAP_POPULATE)
+*/
+
+void	ft_prefault_zone(void *addr, size_t total_size, uint8_t type,
+			int populated);
+
+/*
+** ft_prefault_reuse()
+**
+** Populates the whole pages of a reused free block that are no longer
+** resident, and accounts for them.
+**
+** @param addr: Start of the block (its header)
+** @param size: Size of the block
+*/
+
+void	ft_prefault_reuse(void *addr, size_t size);
+
+#endif
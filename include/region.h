@@ -0,0 +1,132 @@
+#ifndef REGION_H
+# define REGION_H
+
+# include <stddef.h>
+# include <stdint.h>
+
+/*
+** Reserved virtual heap region
+**
+** Instead of one mmap() per zone, the allocator can reserve a single large
+** range of address space up front (PROT_NONE + MAP_NORESERVE, so it costs
+** neither memory nor commit charge) and then commit zones out of it one
+** after the other with mprotect().
+**
+** Benefits:
+** - One mmap() for the whole process, then only mprotect() per zone
+** - Consecutive zones are contiguous, so the kernel merges them into a
+**   handful of VMAs instead of one VMA per zone
+** - "Is this pointer ours?" becomes a single range check
+**
+** Memory layout of the region:
+** [zone][zone][LARGE zone....][hole][zone][                PROT_NONE ...]
+** ^ base                                  ^ brk                        ^ end
+**
+** Released zones become holes: they are decommitted in place and recorded
+** in a small fixed table of free extents, which is searched (first-fit)
+** before bumping brk. When the region is exhausted, callers fall back to
+** a plain mmap().
+**
+** Enabled with: make USE_REGION=1
+*/
+
+/*
+** FT_REGION_SIZE - Address space reserved at startup
+**
+** Only address space: no page is touched or committed until a zone is
+** carved out of it. Set with make REGION_SIZE=<bytes>.
+*/
+
+#ifndef FT_REGION_SIZE
+# define FT_REGION_SIZE ((size_t)1 << 34)
+#endif
+
+/*
+** FT_REGION_MAX_EXTENTS - Capacity of the hole table
+**
+** The table lives inside the global region descriptor because we cannot
+** call malloc() from here. When it is full, a released range is simply
+** left reserved and never reused.
+*/
+
+#ifndef FT_REGION_MAX_EXTENTS
+# define FT_REGION_MAX_EXTENTS 256
+#endif
+
+# define FT_REGION_UNINIT  0
+# define FT_REGION_READY   1
+# define FT_REGION_FAILED  2
+
+typedef struct s_region_extent
+{
+	uint8_t		*addr;		/* Start of the hole (page aligned) */
+	size_t		size;		/* Size of the hole (page multiple) */
+}	t_region_extent;
+
+typedef t_region_extent	ft_region_extent_t;
+
+typedef struct s_region
+{
+	uint8_t				*base;		/* Start of the reservation */
+	uint8_t				*end;		/* One past the end of the reservation */
+	uint8_t				*brk;		/* Everything below was handed out once */
+	uint8_t				state;		/* FT_REGION_UNINIT / READY / FAILED */
+	size_t				n_holes;	/* Used entries in holes[] */
+	ft_region_extent_t	holes[FT_REGION_MAX_EXTENTS];
+}	t_region;
+
+typedef t_region	ft_region_t;
+
+/*
+** Global region descriptor (defined in region.c)
+*/
+
+extern ft_region_t	g_region;
+
+/*
+** ft_region_contains()
+**
+** Checks whether a pointer lies inside the reserved region.
+**
+** @param ptr: Any pointer
+** @return: 1 if ptr is inside [base, end), 0 otherwise
+**
+** Context: A single range check that tells our memory apart from memory
+** that was never handed out by this allocator.
+*/
+
+static inline int	ft_region_contains(const void *ptr)
+{
+	return ((const uint8_t *)ptr >= g_region.base
+		&& (const uint8_t *)ptr < g_region.end);
+}
+
+/*
+** ft_region_map()
+**
+** Commits 'size' bytes (page multiple) from the region, reserving the
+** region on first use.
+**
+** @param size: Number of bytes to commit
+** @return: Read/write, zero-filled memory, or NULL if the region cannot
+**          serve the request (caller should fall back to mmap())
+*/
+
+void		*ft_region_map(size_t size);
+
+/*
+** ft_region_unmap()
+**
+** Decommits a range previously returned by ft_region_map() and records
+** it as a hole for later reuse.
+**
+** @param addr: Start of the range
+** @param size: Size of the range
+** @return: 1 if the range was decommitted into a hole, 0 if it is not
+**          part of the region or could not be decommitted (caller should
+**          then munmap() it itself)
+*/
+
+int			ft_region_unmap(void *addr, size_t size);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef SIZE_CLASS_H
+# define SIZE_CLASS_H
+
+# include <stddef.h>
+# include <stdint.h>
+# include "size_classes.h"
+
+/*
+** Size classes
+**
+** Every request size maps to a class; blocks up to the mmap threshold are
+** carved at the size of their class, zone types and statistics are kept
+** per class. The ladder is chosen at build time and generated into
+** size_classes.h by tools/gen_size_classes.c (Makefile variables, defaults
+** in brackets):
+**
+**   CLASS_STEP          Class spacing up to CLASS_LINEAR_MAX    [16]
+**   CLASS_LINEAR_MAX    End of the evenly spaced classes        [128]
+**   CLASS_PER_DOUBLING  Classes per power of two after that     [4]
+**   CLASS_LADDER_MAX    End of the ladder; above it there is
+**                       one class per power of two              [256K]
+**
+** e.g. 16, 32, ... 128, 160, 192, 224, 256, 320, ... 256K, 512K, 1M ...
+** The ladder spans MEDIUM requests too, whose coarse classes keep their
+** zones reusable.
+** Rounding a request up to its class wastes at most 1/CLASS_PER_DOUBLING
+** of it, and freed blocks fit later requests of the same class exactly.
+**
+** Class 0 is the empty request.
+*/
+
+/*
+** ft_size_class()
+**
+** Maps a request size to its class. Up to FT_CLASS_LOOKUP_MAX this is one
+** load from a direct table; above it, one load from the per-power-of-two
+** table, which gives the first class of the power of two and the shift
+** that spaces the classes inside it.
+*/
+
+static inline uint8_t	ft_size_class(size_t size)
+{
+	t_class_pow2	p;
+	unsigned int	lg;
+
+	if (size <= FT_CLASS_LOOKUP_MAX)
+		return (g_ft_class_lookup[(size + FT_CLASS_STEP - 1)
+			/ FT_CLASS_STEP]);
+	lg = (unsigned int)(sizeof(unsigned long long) * 8)
+		- (unsigned int)__builtin_clzll((unsigned long long)(size - 1));
+	p = g_ft_class_pow2[lg];
+	return ((uint8_t)(p.base + ((size - 1 - ((size_t)1 << (lg - 1)))
+		>> p.shift)));
+}
+
+/*
+** ft_class_size()
+**
+** Largest request size of a class, the block payload it is served with.
+*/
+
+static inline size_t	ft_class_size(uint8_t size_class)
+{
+	return (g_ft_class_size[size_class]);
+}
+
+#endif
@@ -0,0 +1,313 @@
+#ifndef STATS_H
+# define STATS_H
+
+# include <stddef.h>
+# include <stdint.h>
+# include "zone.h"
+# include "size_class.h"
+
+/*
+** Allocator statistics
+**
+** Global counters kept up to date by malloc(), free() and the zone
+** functions as they go, so that reading them (mallinfo2()) never walks
+** the heap.
+**
+** "Zone" counters cover TINY/SMALL/MEDIUM zones only. LARGE allocations are
+** tracked separately, one zone per allocation, like glibc tracks its
+** mmap()ed chunks apart from its arenas.
+**
+** The counters are protected by the allocator lock when it is enabled.
+*/
+
+typedef struct s_stats
+{
+	size_t	zone_bytes;		/* Bytes mapped for non-LARGE zones */
+	size_t	zone_count;		/* Number of non-LARGE zones */
+	size_t	large_bytes;	/* Bytes mapped for LARGE zones */
+	size_t	large_count;	/* Number of LARGE zones */
+	size_t	inuse_bytes;	/* Allocated block bytes in non-LARGE zones */
+	size_t	free_bytes;		/* Free block bytes in non-LARGE zones */
+	size_t	free_blocks;	/* Free blocks in non-LARGE zones */
+	size_t	empty_bytes;	/* Bytes held by empty non-LARGE zones */
+	size_t	requested_bytes;	/* Bytes requested by live allocations (all) */
+}	t_stats;
+
+typedef t_stats	ft_stats_t;
+
+/*
+** Global statistics (defined in stats.c)
+*/
+
+extern ft_stats_t	g_ft_stats;
+
+/*
+** ft_stats_zone_add() / ft_stats_zone_del()
+**
+** Account for a zone being mapped or unmapped. A new non-LARGE zone is
+** one free block spanning the whole zone; it is only unmapped when empty,
+** so it goes away in that same state.
+*/
+
+static inline void	ft_stats_zone_add(const ft_zone_t *zone)
+{
+	if (zone->type == FT_ZONE_LARGE)
+	{
+		g_ft_stats.large_bytes += zone->total_size;
+		g_ft_stats.large_count++;
+		return ;
+	}
+	g_ft_stats.zone_bytes += zone->total_size;
+	g_ft_stats.zone_count++;
+	g_ft_stats.free_bytes += zone->first_block->size;
+	g_ft_stats.free_blocks++;
+	g_ft_stats.empty_bytes += zone->total_size;
+}
+
+static inline void	ft_stats_zone_del(const ft_zone_t *zone)
+{
+	if (zone->type == FT_ZONE_LARGE)
+	{
+		g_ft_stats.large_bytes -= zone->total_size;
+		g_ft_stats.large_count--;
+		return ;
+	}
+	g_ft_stats.zone_bytes -= zone->total_size;
+	g_ft_stats.zone_count--;
+	g_ft_stats.free_bytes -= zone->first_block->size;
+	g_ft_stats.free_blocks--;
+	g_ft_stats.empty_bytes -= zone->total_size;
+}
+
+/*
+** ft_stats_free_list()
+**
+** Accounts for a block entering (+1) or leaving (-1) a free list.
+*/
+
+static inline void	ft_stats_free_list(const ft_zone_t *zone, int delta)
+{
+	if (zone->type != FT_ZONE_LARGE)
+		g_ft_stats.free_blocks += (size_t)delta;
+}
+
+/*
+** ft_stats_alloc() / ft_stats_free()
+**
+** Account for 'size' block bytes moving between free and in-use.
+** Called after zone->block_count was updated.
+*/
+
+static inline void	ft_stats_alloc(const ft_zone_t *zone, size_t size)
+{
+	if (zone->type == FT_ZONE_LARGE)
+		return ;
+	g_ft_stats.inuse_bytes += size;
+	g_ft_stats.free_bytes -= size;
+	if (zone->block_count == 1)
+		g_ft_stats.empty_bytes -= zone->total_size;
+}
+
+static inline void	ft_stats_free(const ft_zone_t *zone, size_t size)
+{
+	if (zone->type == FT_ZONE_LARGE)
+		return ;
+	g_ft_stats.inuse_bytes -= size;
+	g_ft_stats.free_bytes += size;
+	if (zone->block_count == 0)
+		g_ft_stats.empty_bytes += zone->total_size;
+}
+
+/*
+** ft_stats_request()
+**
+** Accounts for a live allocation's requested size going from old_size to
+** new_size bytes (0 for a new or freed allocation). All zone types.
+*/
+
+static inline void	ft_stats_request(size_t old_size, size_t new_size)
+{
+	g_ft_stats.requested_bytes += new_size;
+	g_ft_stats.requested_bytes -= old_size;
+}
+
+/*
+** Per-size-class counters
+**
+** Requests are grouped by size class (see size_class.h). For every class
+** we count allocations, frees, bytes requested, bytes consumed (block
+** size: header and alignment waste included) and whether realloc() could
+** keep the block in place.
+**
+** The counters live in per-thread shards so the hot path is a plain,
+** non-atomic increment in memory no other thread writes to. Shards are
+** taken from a static pool the first time a thread allocates and go back
+** to it when the thread exits. The next thread keeps counting on top of
+** them, so counts of exited threads are kept. While more than
+** FT_CLASS_SHARDS threads are alive, the extra ones share an overflow
+** shard whose counters are updated atomically.
+** Reading merges all shards.
+*/
+
+# define FT_CLASS_SHARDS		64	/* At most 64: one bit each in a mask */
+
+typedef struct s_class_stats
+{
+	size_t	allocs;			/* Successful allocations */
+	size_t	frees;			/* Frees */
+	size_t	requested;		/* Bytes requested by the program */
+	size_t	consumed;		/* Block bytes used to serve them */
+	size_t	realloc_hits;	/* realloc() kept the block in place */
+	size_t	realloc_misses;	/* realloc() had to move the block */
+}	t_class_stats;
+
+typedef t_class_stats	ft_class_stats_t;
+
+typedef struct s_class_shard
+{
+	ft_class_stats_t	classes[FT_CLASS_COUNT];
+}	t_class_shard;
+
+typedef t_class_shard	ft_class_shard_t;
+
+/*
+** Calling thread's shard (defined in stats.c)
+**
+** initial-exec keeps the access a single load off the thread pointer and
+** guarantees that it never calls malloc() to set up TLS.
+*/
+
+extern __thread ft_class_shard_t	*t_ft_shard
+	__attribute__((tls_model("initial-exec")));
+
+/*
+** Shard shared by the threads that found the pool empty (stats.c)
+*/
+
+extern ft_class_shard_t	g_ft_class_overflow;
+
+/*
+** ft_class_shard_attach()
+**
+** Gives the calling thread its shard. Slow path, once per thread (again
+** if the thread allocates after its shard was released at exit).
+*/
+
+ft_class_shard_t	*ft_class_shard_attach(void);
+
+/*
+** ft_class_stats()
+**
+** Returns the calling thread's counters for a class.
+*/
+
+static inline ft_class_stats_t	*ft_class_stats(uint8_t size_class)
+{
+	ft_class_shard_t	*shard;
+
+	shard = t_ft_shard;
+	if (!shard)
+		shard = ft_class_shard_attach();
+	return (&shard->classes[size_class]);
+}
+
+/*
+** ft_class_add()
+**
+** Adds 'n' to a counter of the calling thread's shard: a plain add in a
+** private shard, an atomic one in the overflow shard.
+*/
+
+static inline void	ft_class_add(size_t *counter, size_t n)
+{
+	if (t_ft_shard == &g_ft_class_overflow)
+		__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+	else
+		*counter += n;
+}
+
+/*
+** ft_malloc_class_stats()
+**
+** Merges every shard into 'out'.
+**
+** @param out: Array of FT_CLASS_COUNT entries, indexed by class
+*/
+
+void	ft_malloc_class_stats(ft_class_stats_t *out);
+
+/*
+** ft_size_class_max()
+**
+** Largest request size belonging to a class, for labelling output.
+*/
+
+size_t	ft_size_class_max(uint8_t size_class);
+
+/*
+** ft_stats_grow()
+**
+** Accounts for an allocated block growing in place from old_size to
+** new_size bytes by absorbing free space that follows it.
+*/
+
+static inline void	ft_stats_grow(const ft_zone_t *zone, size_t old_size,
+	size_t new_size)
+{
+	if (zone->type == FT_ZONE_LARGE)
+		return ;
+	g_ft_stats.inuse_bytes += new_size - old_size;
+	g_ft_stats.free_bytes -= new_size - old_size;
+}
+
+/*
+** ft_frag_stats_t - Fragmentation and RSS efficiency
+**
+** Tells allocator overhead apart from application data:
+** - requested / allocated: internal fragmentation (headers, alignment,
+**   split remainders too small to reuse, LARGE page rounding)
+** - free / largest_free: external fragmentation (free memory cut into
+**   holes too small for bigger requests)
+** - mapped / resident: what the zones cost in address space and in RAM
+**
+** LARGE allocations count as allocated for their whole mapping.
+*/
+
+typedef struct s_frag_stats
+{
+	size_t	requested;			/* Bytes requested by live allocations */
+	size_t	allocated;			/* Bytes in allocated blocks */
+	size_t	free;				/* Bytes in free non-LARGE blocks */
+	size_t	largest_free[FT_ZONE_TYPES];	/* Largest free block, by type */
+	size_t	mapped;				/* Bytes mapped for zones */
+	size_t	resident;			/* Mapped bytes resident in RAM (mincore) */
+	double	internal;			/* 1 - requested / allocated */
+	double	external;			/* 1 - largest free / free, non-LARGE */
+	double	overhead;			/* 1 - requested / resident (< 0 when the
+								** program left requested pages untouched) */
+}	t_frag_stats;
+
+typedef t_frag_stats	ft_frag_stats_t;
+
+/*
+** ft_malloc_frag_stats()
+**
+** Fills 'out'. The byte counts come from the counters; the largest free
+** blocks and the resident size walk the zones under the lock, O(zones +
+** free blocks), so this is meant for periodic monitoring, not hot paths.
+** A ratio is 0 when its denominator is.
+**
+** @return: 0, or -1 if the lock could not be taken
+*/
+
+int		ft_malloc_frag_stats(ft_frag_stats_t *out);
+
+/*
+** ft_resident_bytes()
+**
+** Bytes of the page-aligned range [addr, addr + size) resident in RAM.
+*/
+
+size_t	ft_resident_bytes(const void *addr, size_t size);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef TRIM_H
+# define TRIM_H
+
+# include <stddef.h>
+# include <stdint.h>
+# include "zone.h"
+
+/*
+** Purging of free memory
+**
+** malloc_trim() (malloc.h) returns free pages to the OS on demand. With
+** 'decay_ms:N' (FT_MALLOC_CONF key) a background thread does it on its
+** own, gradually: memory freed and left unused is purged on an
+** exponential curve, half of it within N milliseconds.
+**
+** Each zone counts the bytes freed into it since it was last purged
+** ('dirty') and the decay epoch of its last free(). Every N/FT_DECAY_STEPS
+** ms the thread purges the share of all dirty bytes that the curve lets
+** go - at least one page - taking the zones idle for longest first and
+** skipping those freed into during the last step:
+**   - whole pages inside free blocks get madvise(MADV_DONTNEED), as with
+**     malloc_trim(), so RSS follows the live heap
+**   - TINY/SMALL/MEDIUM zones without any allocation are unmapped
+**
+** The thread only runs with USE_MALLOC_LOCK=1: it walks the zone lists
+** under the allocator lock, which is a no-op otherwise. It is started at
+** library load, or by ft_conf_set("decay_ms", N), and is not re-created
+** in a fork()ed child.
+*/
+
+/*
+** FT_DECAY_STEPS - Purge passes per half-life
+** FT_DECAY_KEEP - Dirty bytes kept by one pass, out of 1024:
+**                 1024 * 2^(-1 / FT_DECAY_STEPS)
+** FT_DECAY_IDLE_MS - Sleep of the thread while decay_ms is 0
+** FT_DECAY_BATCH - Oldest zones picked by one walk of the zone lists
+*/
+
+# define FT_DECAY_STEPS		8
+# define FT_DECAY_KEEP		939
+# define FT_DECAY_IDLE_MS	1000
+# define FT_DECAY_BATCH		64
+
+/*
+** Current decay epoch, advanced by each purge pass under the lock
+*/
+
+extern uint32_t	g_decay_epoch;
+
+/*
+** ft_trim_zone()
+**
+** Releases the whole pages inside the free blocks of one zone and clears
+** its dirty count. 'pad' is the free resident memory still to keep; it is
+** used up first.
+**
+** @return: Resident bytes released
+**
+** Context: Called under the allocator lock.
+*/
+
+size_t	ft_trim_zone(ft_zone_t *zone, size_t *pad);
+
+/*
+** ft_decay_tick()
+**
+** One purge pass, as run by the decay thread. Takes the lock.
+**
+** @return: Resident bytes released
+*/
+
+size_t	ft_decay_tick(void);
+
+/*
+** ft_decay_start()
+**
+** Starts the decay thread if decay_ms is set and it is not running yet.
+** Must not be called under the allocator lock: pthread_create() allocates.
+*/
+
+void	ft_decay_start(void);
+
+#endif
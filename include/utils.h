@@ -24,10 +24,10 @@ size_t	ft_pagesize(void);
 ** ft_calculate_zone_size()
 **
 ** Calculates the total size needed for a zone based on type.
-** For TINY/SMALL: returns multiple of page size.
+** For TINY/SMALL/MEDIUM: returns multiple of page size.
 ** For LARGE: returns size rounded up to page size.
 **
-** @param type: Zone type (FT_ZONE_TINY, FT_ZONE_SMALL, FT_ZONE_LARGE)
+** @param type: Zone type (FT_ZONE_TINY ... FT_ZONE_LARGE)
 ** @param request_size: For LARGE, the requested allocation size (ignored for TINY & SMALL)
 ** @return: Total zone size in bytes
 **
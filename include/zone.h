@@ -15,9 +15,10 @@
 /*
 ** Zone types - categorizes allocations by size
 **
-** TINY:  1 - 128 bytes    (stored in multi-page zones)
-** SMALL: 129 - 1024 bytes (stored in multi-page zones)
-** LARGE: 1025+ bytes      (each allocation gets its own mmap)
+** TINY:   1 - 128 bytes       (stored in multi-page zones)
+** SMALL:  129 - 1024 bytes    (stored in multi-page zones)
+** MEDIUM: 1025 - 256 KiB      (stored in multi-megabyte zones)
+** LARGE:  256 KiB + 1 and up  (each allocation gets its own mmap)
 **
 ** These are defines rather than an enum to allow use in preprocessor
 ** conditionals and to match the subject's terminology.
@@ -25,10 +26,15 @@
 
 # define FT_ZONE_TINY  0
 # define FT_ZONE_SMALL 1
-# define FT_ZONE_LARGE 2
+# define FT_ZONE_MEDIUM 2
+# define FT_ZONE_LARGE 3
+# define FT_ZONE_TYPES 4
 
 /*
 ** Size thresholds for zone classification
+**
+** These are the defaults; FT_MALLOC_CONF can override them at load time
+** (see conf.h).
 */
 
 #ifndef FT_TINY_MAX
@@ -38,6 +44,19 @@
 # define FT_SMALL_MAX  1024
 #endif
 
+/*
+** FT_MMAP_THRESHOLD - Largest MEDIUM request
+**
+** Anything above gets a dedicated mapping. Buffers of a few KiB up to this
+** size are common (I/O, serialization) and a mapping each costs two
+** syscalls, a VMA and at least a whole page; MEDIUM zones serve them from
+** a few big mappings instead.
+*/
+
+#ifndef FT_MMAP_THRESHOLD
+# define FT_MMAP_THRESHOLD (256 * 1024)
+#endif
+
 /*
 ** Zone capacities - number of pages per zone type
 **
@@ -61,26 +80,44 @@
 # define FT_SMALL_ZONE_PAGES 28
 #endif
 
+/*
+** MEDIUM zones are 4 MiB with 4 KiB pages: 15 blocks of FT_MMAP_THRESHOLD
+** bytes, a thousand and more of a few KiB. Their blocks are carved at the
+** coarse size classes of size_class.h, so freed blocks get reused.
+*/
+
+#ifndef FT_MEDIUM_ZONE_PAGES
+# define FT_MEDIUM_ZONE_PAGES 1024
+#endif
+
 /*
 ** ft_zone_t - Memory Zone
 **
 ** A zone is a pre-allocated region of memory that holds multiple blocks.
-** TINY and SMALL allocations are grouped into zones to reduce mmap() calls.
-** LARGE allocations each get their own zone (single allocation per zone).
+** TINY, SMALL and MEDIUM allocations are grouped into zones to reduce mmap()
+** calls. LARGE allocations each get their own zone (single allocation per
+** zone).
 **
-** Zones are organized into three linked lists (one per type) in the global
+** Zones are organized into four linked lists (one per type) in the global
 ** zone manager. This allows show_alloc_mem() to easily iterate by type.
 **
 ** Memory layout of a zone:
-** [ft_zone_t header][ft_block_t][alloc_hdr][data...][ft_block_t][...]
+** [color][ft_zone_t header][ft_block_t][alloc_hdr][data...][ft_block_t][...]
+**
+** The header does not start at the mapping: see cache coloring below.
 */
 
 typedef struct s_zone
 {
-	uint8_t			type;					/* FT_ZONE_TINY, FT_ZONE_SMALL, or FT_ZONE_LARGE */
+	uint8_t			type;			/* FT_ZONE_TINY ... FT_ZONE_LARGE */
+	uint8_t			node;			/* NUMA node the pages are bound to */
+	uint16_t		color;			/* Offset of the header in its mapping */
+	uint32_t		decay_epoch;	/* Decay epoch of the last free() (trim.h) */
+	uint8_t			nursery;		/* Holds short-lived objects (lifetime.h) */
 	size_t			total_size;		/* Total size of this zone (from mmap) */
-	size_t			used_size;		/* Bytes currently allocated to users */
+	size_t			used_size;		/* Bytes requested by live allocations */
 	size_t			block_count;	/* Number of allocations in this zone */
+	size_t			dirty;			/* Bytes freed since the last purge */
 
 	/* Block tracking */
 	ft_block_t		*first_block;	/* First block in address order */
@@ -90,6 +127,16 @@ typedef struct s_zone
 	struct s_zone	*prev;			/* Previous zone of same type */
 	struct s_zone	*next;			/* Next zone of same type */
 
+#ifdef FT_OOB_META
+	/* Out-of-band block metadata (see block.h), NULL for LARGE zones */
+	uint32_t		*meta_index;	/* Descriptor number + 1 per granule */
+	ft_block_t		*meta;			/* Descriptor table */
+	ft_block_t		*meta_free;		/* Released descriptors */
+	size_t			meta_used;		/* Descriptors handed out so far */
+	size_t			meta_size;		/* Bytes mapped for the side table */
+	uint8_t			*data;			/* First granule of the zone */
+#endif
+
 }	t_zone;
 
 typedef t_zone	ft_zone_t;
@@ -100,14 +147,57 @@ typedef t_zone	ft_zone_t;
 
 # define FT_ZONE_HDR_SIZE (sizeof(ft_zone_t))
 
+/*
+** Cache coloring
+**
+** Mappings start on a page boundary, so uncolored zone headers and first
+** blocks would all land in the same few cache sets, and walking the zone
+** lists would thrash them. Successive TINY/SMALL/MEDIUM zones put their
+** header FT_CACHE_LINE bytes further into the first page, cycling through
+** FT_ZONE_COLORS offsets; the skipped bytes are lost to the zone. LARGE
+** zones are not colored, their size is exact. FT_ZONE_COLORS=1 turns
+** coloring off.
+*/
+
+# define FT_CACHE_LINE		64
+#ifndef FT_ZONE_COLORS
+# define FT_ZONE_COLORS		16
+#endif
+# define FT_ZONE_COLOR_MAX	((FT_ZONE_COLORS - 1) * FT_CACHE_LINE)
+
+/*
+** FT_LARGE_META_SIZE - Room for the descriptor of a LARGE block
+**
+** Out-of-band descriptors of LARGE blocks sit after the zone header, with
+** the data aligned behind them. Inline headers are part of the block.
+*/
+
+#ifdef FT_OOB_META
+# define FT_LARGE_META_SIZE \
+	(FT_ALIGN_UP(sizeof(ft_block_t), FT_ALIGN_SIZE) + 2 * FT_ALIGN_SIZE)
+#else
+# define FT_LARGE_META_SIZE 0
+#endif
+
+/*
+** ft_zone_base()
+**
+** Start of the mapping holding a zone, for munmap() and mincore().
+*/
+
+static inline void	*ft_zone_base(const ft_zone_t *zone)
+{
+	return ((uint8_t *)zone - zone->color);
+}
+
 /*
 ** ft_zone_mgr_t - Global Zone Manager
 **
-** Maintains three separate linked lists for each zone type.
+** Maintains one linked list for each zone type.
 ** This singleton structure is the root of our memory allocation system.
 **
 ** Design decision: Separate lists by type allow:
-** - Easy iteration for show_alloc_mem() (print TINY, then SMALL, then LARGE)
+** - Easy iteration for show_alloc_mem() (print TINY, SMALL, MEDIUM, LARGE)
 ** - Type-specific optimizations
 ** - Clear visualization of memory organization
 */
@@ -116,6 +206,7 @@ typedef struct s_zone_mgr
 {
 	ft_zone_t	*tiny_zones;	/* Linked list of TINY zones */
 	ft_zone_t	*small_zones;	/* Linked list of SMALL zones */
+	ft_zone_t	*medium_zones;	/* Linked list of MEDIUM zones */
 	ft_zone_t	*large_zones;	/* Linked list of LARGE zones */
 }	t_zone_mgr;
 
@@ -140,7 +231,7 @@ extern ft_zone_mgr_t	g_zone_mgr;
 ** Determines which zone type should be used for a given allocation size.
 **
 ** @param size: User-requested allocation size
-** @return: FT_ZONE_TINY, FT_ZONE_SMALL, or FT_ZONE_LARGE
+** @return: FT_ZONE_TINY, FT_ZONE_SMALL, FT_ZONE_MEDIUM, or FT_ZONE_LARGE
 **
 ** Context: Called at the beginning of malloc to route the allocation
 ** to the appropriate zone type.
@@ -153,16 +244,18 @@ uint8_t		ft_zone_get_type(size_t size);
 **
 ** Creates a new zone using mmap() and automatically registers it in the
 ** global zone manager.
-** For TINY/SMALL, allocates multiple pages.
+** For TINY/SMALL/MEDIUM, allocates multiple pages.
 ** For LARGE, allocates exact size needed.
 **
-** @param type: Zone type (FT_ZONE_TINY, FT_ZONE_SMALL, FT_ZONE_LARGE)
-** @param size: For LARGE zones, the specific size; ignored for TINY/SMALL
+** @param type: Zone type (FT_ZONE_TINY ... FT_ZONE_LARGE)
+** @param size: For LARGE zones, the specific size; ignored otherwise
 ** @return: Pointer to new zone (already added to manager), or NULL on failure
 **
 ** Context: Called when no existing zone has space for an allocation.
 ** This is where mmap() is invoked. The zone is automatically added to the
 ** appropriate list in g_zone_mgr before returning.
+** With USE_REGION, the memory is committed from the reserved region
+** instead (see region.h).
 */
 
 ft_zone_t	*ft_zone_create(uint8_t type, size_t size);
@@ -191,11 +284,24 @@ ft_block_t	*ft_zone_find_free_block(ft_zone_t *zone, size_t size);
 ** @param zone: Zone to remove
 **
 ** Context: Called when a zone becomes empty and can be returned to the OS.
-** Currently only happens for LARGE zones immediately after free().
+** LARGE zones go immediately after free(), others per the trim policy.
 */
 
 void		ft_zone_remove(ft_zone_t *zone);
 
+/*
+** ft_zone_has_spare()
+**
+** Tells whether another zone of the same type and nursery kind as 'zone'
+** is empty.
+**
+** Context: free() keeps a single empty MEDIUM zone mapped as a spare, so
+** alternating bursts of MEDIUM requests do not map and unmap megabytes.
+** Nursery zones (lifetime.h) get the same treatment.
+*/
+
+int			ft_zone_has_spare(const ft_zone_t *zone);
+
 /*
 ** ft_zone_get_list()
 **
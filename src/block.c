@@ -1,8 +1,90 @@
 #include "block.h"
 #include "zone.h"
+#include "pagemap.h"
 #include <stddef.h>
 #include <stdint.h>
 
+#ifdef FT_OOB_META
+
+/*
+** ft_block_granule()
+**
+** Index entry of a block starting at 'data'.
+*/
+
+static inline uint32_t	*ft_block_granule(ft_zone_t *zone, uint8_t *data)
+{
+	return (&zone->meta_index[(size_t)(data - zone->data) / FT_ALIGN_SIZE]);
+}
+
+ft_block_t	*ft_block_desc_new(void *zone_ptr, uint8_t *data)
+{
+	ft_zone_t	*zone;
+	ft_block_t	*block;
+
+	zone = zone_ptr;
+	block = zone->meta_free;
+	if (block)
+		zone->meta_free = block->next_free;
+	else
+		block = &zone->meta[zone->meta_used++];
+	block->data = data;
+	block->zone = zone;
+	block->magic = 0;
+	*ft_block_granule(zone, data) = (uint32_t)(block - zone->meta) + 1;
+	return (block);
+}
+
+/*
+** ft_block_desc_release()
+**
+** Gives the descriptor of a block absorbed by a merge back to its zone.
+** Released descriptors are reused first, which keeps the table dense.
+*/
+
+static void	ft_block_desc_release(ft_block_t *block)
+{
+	ft_zone_t	*zone;
+
+	zone = block->zone;
+	*ft_block_granule(zone, block->data) = 0;
+	block->magic = 0;
+	block->next_free = zone->meta_free;
+	zone->meta_free = block;
+}
+
+/*
+** ft_block_lookup()
+**
+** The page map gives the zone, its index the descriptor. A LARGE zone has
+** a single block.
+*/
+
+ft_block_t	*ft_block_lookup(void *ptr)
+{
+	ft_zone_t	*zone;
+	uint32_t	slot;
+
+	zone = ft_pagemap_get(ptr);
+	if (!zone)
+		return (NULL);
+	if (!zone->meta_index)
+	{
+		if (zone->first_block && zone->first_block->data == ptr)
+			return (zone->first_block);
+		return (NULL);
+	}
+	if ((uint8_t *)ptr < zone->data
+		|| ((uintptr_t)ptr & (FT_ALIGN_SIZE - 1)) != 0)
+		return (NULL);
+	slot = *ft_block_granule(zone, ptr);
+	if (slot == 0)
+		return (NULL);
+	return (&zone->meta[slot - 1]);
+}
+
+#endif
+
 /*
 ** ft_block_init()
 **
@@ -21,6 +103,8 @@ ft_block_t	*ft_block_init(void *addr, size_t size)
 	block = (ft_block_t *)addr;
 	block->size = size;
 	block->is_free = 1;
+	block->size_class = 0;
+	block->flags = 0;
 	block->prev = NULL;
 	block->next = NULL;
 	block->prev_free = NULL;
@@ -54,7 +138,13 @@ ft_block_t	*ft_block_split(ft_block_t *block, size_t size)
 	if (block->size < size + FT_MIN_BLOCK_SIZE)
 		return (NULL);
 	remainder_size = block->size - size;
-	remainder_addr = (uint8_t *)block + size;
+	remainder_addr = ft_block_start(block) + size;
+#ifdef FT_OOB_META
+	if (!((ft_zone_t *)block->zone)->meta_index)
+		return (NULL);
+	remainder_addr = (uint8_t *)ft_block_desc_new(block->zone,
+		remainder_addr);
+#endif
 
 #if SHOW_MORE
 	remainder = ft_block_init(remainder_addr, remainder_size, user_size);
@@ -86,8 +176,8 @@ int	ft_block_can_merge(ft_block_t *a, ft_block_t *b)
 		return (0);
 	if (!a->is_free || !b->is_free)
 		return (0);
-	end_of_a = (uint8_t *)a + a->size;
-	return (end_of_a == (uint8_t *)b);
+	end_of_a = ft_block_start(a) + a->size;
+	return (end_of_a == ft_block_start(b));
 }
 
 /*
@@ -104,5 +194,8 @@ void	ft_block_merge(ft_block_t *a, ft_block_t *b)
 	a->next = b->next;
 	if (b->next)
 		b->next->prev = a;
+#ifdef FT_OOB_META
+	ft_block_desc_release(b);
+#endif
 }
 
@@ -0,0 +1,385 @@
+#include "conf.h"
+#include "zone.h"
+#include "utils.h"
+#include "prefault.h"
+#include "heap_prof.h"
+#include "guard.h"
+#include "numa.h"
+#include "trim.h"
+#include "lifetime.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+** Global configuration - compile-time defaults until ft_conf_load() runs
+*/
+
+ft_conf_t	g_ft_conf = {0, FT_TINY_MAX, FT_SMALL_MAX, FT_MMAP_THRESHOLD,
+	FT_TINY_ZONE_PAGES, FT_SMALL_ZONE_PAGES, FT_MEDIUM_ZONE_PAGES,
+	FT_TRIM_THRESHOLD,
+	FT_PROF_SAMPLE, FT_GUARD_SAMPLE, 0, 0, 0, FT_DECAY_MS,
+	FT_LIFE_SAMPLE, {0}};
+
+/*
+** Setters - one per key, called with an already parsed value
+*/
+
+static void	ft_conf_set_tiny_max(size_t v)
+{
+	g_ft_conf.tiny_max = v;
+}
+
+static void	ft_conf_set_small_max(size_t v)
+{
+	g_ft_conf.small_max = v;
+}
+
+static void	ft_conf_set_mmap_threshold(size_t v)
+{
+	g_ft_conf.mmap_threshold = v;
+}
+
+static void	ft_conf_set_tiny_pages(size_t v)
+{
+	g_ft_conf.tiny_zone_pages = v;
+}
+
+static void	ft_conf_set_small_pages(size_t v)
+{
+	g_ft_conf.small_zone_pages = v;
+}
+
+static void	ft_conf_set_medium_pages(size_t v)
+{
+	g_ft_conf.medium_zone_pages = v;
+}
+
+static void	ft_conf_set_trim_threshold(size_t v)
+{
+	g_ft_conf.trim_threshold = v;
+}
+
+static void	ft_conf_set_prof_sample(size_t v)
+{
+	g_ft_conf.prof_sample = v;
+}
+
+static void	ft_conf_set_guard_sample(size_t v)
+{
+	g_ft_conf.guard_sample = v;
+}
+
+static void	ft_conf_set_guard_left(size_t v)
+{
+	g_ft_conf.guard_left = (v != 0);
+}
+
+static void	ft_conf_set_numa(size_t v)
+{
+	g_ft_conf.numa = (v != 0);
+}
+
+static void	ft_conf_set_numa_nodes(size_t v)
+{
+	g_ft_conf.numa_nodes = v < FT_NUMA_MAX_NODES ? v : FT_NUMA_MAX_NODES;
+}
+
+static void	ft_conf_set_decay_ms(size_t v)
+{
+	g_ft_conf.decay_ms = v;
+	ft_decay_start();
+}
+
+static void	ft_conf_set_life_sample(size_t v)
+{
+	g_ft_conf.life_sample = v;
+}
+
+static void	ft_conf_set_prefault(size_t v)
+{
+	ft_malloc_prefault((int)v, 0);
+}
+
+static void	ft_conf_set_prefault_large(size_t v)
+{
+	ft_malloc_prefault(g_prefault.mode, v);
+}
+
+typedef struct s_conf_key
+{
+	const char	*name;
+	void		(*set)(size_t);
+}	t_conf_key;
+
+static const t_conf_key	g_conf_keys[] = {
+	{"tiny_max", ft_conf_set_tiny_max},
+	{"small_max", ft_conf_set_small_max},
+	{"mmap_threshold", ft_conf_set_mmap_threshold},
+	{"tiny_zone_pages", ft_conf_set_tiny_pages},
+	{"small_zone_pages", ft_conf_set_small_pages},
+	{"medium_zone_pages", ft_conf_set_medium_pages},
+	{"prefault", ft_conf_set_prefault},
+	{"prefault_large", ft_conf_set_prefault_large},
+	{"trim_threshold", ft_conf_set_trim_threshold},
+	{"prof_sample", ft_conf_set_prof_sample},
+	{"guard_sample", ft_conf_set_guard_sample},
+	{"guard_left", ft_conf_set_guard_left},
+	{"numa", ft_conf_set_numa},
+	{"numa_nodes", ft_conf_set_numa_nodes},
+	{"decay_ms", ft_conf_set_decay_ms},
+	{"life_sample", ft_conf_set_life_sample},
+	{NULL, NULL}
+};
+
+/*
+** ft_conf_warn()
+**
+** Reports a rejected pair on stderr. stdio is off limits here since it
+** may allocate.
+*/
+
+static void	ft_conf_warn(const char *msg, const char *s, size_t len)
+{
+	ssize_t	ret;
+	size_t	mlen;
+
+	mlen = 0;
+	while (msg[mlen])
+		mlen++;
+	ret = write(2, "ft_malloc: " FT_CONF_ENV ": ",
+		sizeof("ft_malloc: " FT_CONF_ENV ": ") - 1);
+	ret = write(2, msg, mlen);
+	ret = write(2, s, len);
+	ret = write(2, "\n", 1);
+	(void)ret;
+}
+
+/*
+** ft_conf_parse_value()
+**
+** Parses a decimal value with an optional k/m/g suffix.
+** Returns 0 on success, -1 if the value is empty, malformed or does not
+** fit in a size_t.
+*/
+
+static int	ft_conf_parse_value(const char *s, size_t len, size_t *out)
+{
+	size_t	i;
+	size_t	v;
+	int		shift;
+
+	if (len == 0)
+		return (-1);
+	i = 0;
+	v = 0;
+	while (i < len && s[i] >= '0' && s[i] <= '9')
+	{
+		if (v > (SIZE_MAX - (size_t)(s[i] - '0')) / 10)
+			return (-1);
+		v = v * 10 + (size_t)(s[i++] - '0');
+	}
+	if (i == 0)
+		return (-1);
+	shift = 0;
+	if (i + 1 == len && (s[i] == 'k' || s[i] == 'K'))
+		shift = 10;
+	else if (i + 1 == len && (s[i] == 'm' || s[i] == 'M'))
+		shift = 20;
+	else if (i + 1 == len && (s[i] == 'g' || s[i] == 'G'))
+		shift = 30;
+	else if (i != len)
+		return (-1);
+	if (v > (SIZE_MAX >> shift))
+		return (-1);
+	*out = v << shift;
+	return (0);
+}
+
+/*
+** ft_conf_key_eq()
+**
+** Compares a NUL-terminated key name with a key of known length.
+*/
+
+static int	ft_conf_key_eq(const char *name, const char *s, size_t len)
+{
+	size_t	i;
+
+	i = 0;
+	while (i < len && name[i] && name[i] == s[i])
+		i++;
+	return (i == len && name[i] == '\0');
+}
+
+/*
+** ft_conf_apply_pair()
+**
+** Looks up one "key:value" pair in the key table and applies it.
+*/
+
+static void	ft_conf_apply_pair(const char *s, size_t len)
+{
+	size_t		klen;
+	size_t		i;
+	size_t		v;
+
+	klen = 0;
+	while (klen < len && s[klen] != ':')
+		klen++;
+	if (klen == len
+		|| ft_conf_parse_value(s + klen + 1, len - klen - 1, &v) != 0)
+	{
+		ft_conf_warn("malformed pair: ", s, len);
+		return ;
+	}
+	i = 0;
+	while (g_conf_keys[i].name)
+	{
+		if (ft_conf_key_eq(g_conf_keys[i].name, s, klen))
+		{
+			g_conf_keys[i].set(v);
+			return ;
+		}
+		i++;
+	}
+	ft_conf_warn("unknown key: ", s, klen);
+}
+
+/*
+** ft_conf_min_zone_pages()
+**
+** Smallest zone (in pages) holding 'allocs' allocations of max_size bytes.
+*/
+
+static size_t	ft_conf_min_zone_pages(size_t max_size, size_t allocs)
+{
+	const size_t	ps = ft_pagesize();
+	size_t			needed;
+
+	needed = FT_ZONE_COLOR_MAX + FT_ZONE_HDR_SIZE
+		+ allocs * ft_calculate_alloc_size(max_size);
+	return ((needed + ps - 1) / ps);
+}
+
+/*
+** ft_conf_fixup()
+**
+** Keeps an overridden configuration consistent:
+** - TINY and SMALL requests end at FT_CONF_SMALL_LIMIT at most, MEDIUM
+**   ones at FT_CONF_MMAP_LIMIT
+** - TINY is at least one byte wide, SMALL at least as wide as TINY, and
+**   the mmap threshold no lower than the SMALL limit
+** - All limits end on a size class, whose zone type is tabulated
+** - Zones are large enough for FT_ZONE_MIN_ALLOCS allocations, MEDIUM
+**   zones for FT_MEDIUM_MIN_ALLOCS
+*/
+
+static void	ft_conf_fixup(void)
+{
+	size_t	min_pages;
+	size_t	size;
+	int		c;
+
+	if (g_ft_conf.tiny_max > FT_CONF_SMALL_LIMIT)
+		g_ft_conf.tiny_max = FT_CONF_SMALL_LIMIT;
+	if (g_ft_conf.small_max > FT_CONF_SMALL_LIMIT)
+		g_ft_conf.small_max = FT_CONF_SMALL_LIMIT;
+	if (g_ft_conf.mmap_threshold > FT_CONF_MMAP_LIMIT)
+		g_ft_conf.mmap_threshold = FT_CONF_MMAP_LIMIT;
+	if (g_ft_conf.tiny_max == 0)
+		g_ft_conf.tiny_max = 1;
+	if (g_ft_conf.small_max < g_ft_conf.tiny_max)
+		g_ft_conf.small_max = g_ft_conf.tiny_max;
+	if (g_ft_conf.mmap_threshold < g_ft_conf.small_max)
+		g_ft_conf.mmap_threshold = g_ft_conf.small_max;
+	g_ft_conf.tiny_max = ft_class_size(ft_size_class(g_ft_conf.tiny_max));
+	g_ft_conf.small_max = ft_class_size(ft_size_class(g_ft_conf.small_max));
+	g_ft_conf.mmap_threshold = ft_class_size(
+		ft_size_class(g_ft_conf.mmap_threshold));
+	c = 0;
+	while (c < FT_CLASS_COUNT)
+	{
+		size = ft_class_size((uint8_t)c);
+		g_ft_conf.class_zone[c] = FT_ZONE_LARGE;
+		if (size <= g_ft_conf.mmap_threshold)
+			g_ft_conf.class_zone[c] = FT_ZONE_MEDIUM;
+		if (size <= g_ft_conf.small_max)
+			g_ft_conf.class_zone[c] = FT_ZONE_SMALL;
+		if (size <= g_ft_conf.tiny_max)
+			g_ft_conf.class_zone[c] = FT_ZONE_TINY;
+		c++;
+	}
+	min_pages = ft_conf_min_zone_pages(g_ft_conf.tiny_max,
+		FT_ZONE_MIN_ALLOCS);
+	if (g_ft_conf.tiny_zone_pages < min_pages)
+		g_ft_conf.tiny_zone_pages = min_pages;
+	min_pages = ft_conf_min_zone_pages(g_ft_conf.small_max,
+		FT_ZONE_MIN_ALLOCS);
+	if (g_ft_conf.small_zone_pages < min_pages)
+		g_ft_conf.small_zone_pages = min_pages;
+	min_pages = ft_conf_min_zone_pages(g_ft_conf.mmap_threshold,
+		FT_MEDIUM_MIN_ALLOCS);
+	if (g_ft_conf.medium_zone_pages < min_pages)
+		g_ft_conf.medium_zone_pages = min_pages;
+}
+
+/*
+** ft_conf_set()
+**
+** Runtime counterpart of a single FT_MALLOC_CONF pair.
+*/
+
+int	ft_conf_set(const char *key, size_t value)
+{
+	size_t	i;
+	size_t	len;
+
+	if (!g_ft_conf.loaded)
+		ft_conf_load();
+	len = 0;
+	while (key[len])
+		len++;
+	i = 0;
+	while (g_conf_keys[i].name)
+	{
+		if (ft_conf_key_eq(g_conf_keys[i].name, key, len))
+		{
+			g_conf_keys[i].set(value);
+			ft_conf_fixup();
+			return (0);
+		}
+		i++;
+	}
+	return (-1);
+}
+
+/*
+** ft_conf_load()
+**
+** Runs once. The loaded flag is set first so that nothing called from
+** here can recurse into the parser.
+*/
+
+__attribute__((constructor))
+void	ft_conf_load(void)
+{
+	const char	*env;
+	size_t		len;
+
+	if (g_ft_conf.loaded)
+		return ;
+	g_ft_conf.loaded = 1;
+	env = getenv(FT_CONF_ENV);
+	while (env && *env)
+	{
+		len = 0;
+		while (env[len] && env[len] != ',')
+			len++;
+		if (len)
+			ft_conf_apply_pair(env, len);
+		env += len;
+		if (*env == ',')
+			env++;
+	}
+	ft_conf_fixup();
+}
@@ -0,0 +1,247 @@
+#include "trim.h"
+#include "conf.h"
+#include "lock.h"
+#include "stats.h"
+#include "utils.h"
+#include <pthread.h>
+#include <time.h>
+
+uint32_t	g_decay_epoch = 0;
+
+/*
+** Zones picked by the last scan, oldest first (used under the lock)
+*/
+
+static ft_zone_t	*g_decay_batch[FT_DECAY_BATCH];
+
+static int	ft_decay_older(const ft_zone_t *a, const ft_zone_t *b)
+{
+	return ((int32_t)(a->decay_epoch - b->decay_epoch) < 0);
+}
+
+/*
+** ft_decay_sift_down()
+**
+** Restores the heap below 'i': no zone is older than its children, so the
+** root is the youngest zone kept.
+*/
+
+static void	ft_decay_sift_down(ft_zone_t **heap, size_t n, size_t i)
+{
+	ft_zone_t	*tmp;
+	size_t		child;
+
+	while ((child = 2 * i + 1) < n)
+	{
+		if (child + 1 < n && ft_decay_older(heap[child], heap[child + 1]))
+			child++;
+		if (!ft_decay_older(heap[i], heap[child]))
+			return ;
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+		i = child;
+	}
+}
+
+static void	ft_decay_keep(ft_zone_t **heap, size_t *n, ft_zone_t *zone)
+{
+	ft_zone_t	*tmp;
+	size_t		i;
+
+	if (*n == FT_DECAY_BATCH)
+	{
+		if (ft_decay_older(zone, heap[0]))
+		{
+			heap[0] = zone;
+			ft_decay_sift_down(heap, *n, 0);
+		}
+		return ;
+	}
+	i = (*n)++;
+	heap[i] = zone;
+	while (i > 0 && ft_decay_older(heap[(i - 1) / 2], heap[i]))
+	{
+		tmp = heap[i];
+		heap[i] = heap[(i - 1) / 2];
+		heap[(i - 1) / 2] = tmp;
+		i = (i - 1) / 2;
+	}
+}
+
+/*
+** ft_decay_collect()
+**
+** One walk over the TINY/SMALL/MEDIUM zones: sums their dirty bytes and
+** fills g_decay_batch with the FT_DECAY_BATCH dirty zones idle for
+** longest, sorted oldest first. Zones freed into during the current step
+** are left out. LARGE zones never hold free memory: they are unmapped by
+** free().
+**
+** @return: Number of zones in the batch
+*/
+
+static size_t	ft_decay_collect(size_t *dirty)
+{
+	ft_zone_t	*zone;
+	ft_zone_t	*tmp;
+	size_t		n;
+	size_t		end;
+	uint8_t		type;
+
+	*dirty = 0;
+	n = 0;
+	type = FT_ZONE_TINY;
+	while (type <= FT_ZONE_MEDIUM)
+	{
+		zone = *ft_zone_get_list(type);
+		while (zone)
+		{
+			*dirty += zone->dirty;
+			if (zone->dirty && zone->decay_epoch != g_decay_epoch)
+				ft_decay_keep(g_decay_batch, &n, zone);
+			zone = zone->next;
+		}
+		type++;
+	}
+	end = n;
+	while (end > 1)
+	{
+		tmp = g_decay_batch[0];
+		g_decay_batch[0] = g_decay_batch[--end];
+		g_decay_batch[end] = tmp;
+		ft_decay_sift_down(g_decay_batch, end, 0);
+	}
+	return (n);
+}
+
+static size_t	ft_decay_purge(ft_zone_t *zone)
+{
+	size_t	released;
+	size_t	pad;
+
+	pad = 0;
+	if (zone->block_count != 0)
+		return (ft_trim_zone(zone, &pad));
+	released = ft_resident_bytes(ft_zone_base(zone), zone->total_size);
+	ft_zone_remove(zone);
+	return (released);
+}
+
+/*
+** ft_decay_tick()
+**
+** Purges the batch in order while the budget lasts. Only a full batch can
+** have left older candidates out: the lists are walked again then, and
+** the zones already purged are no longer dirty.
+*/
+
+size_t	ft_decay_tick(void)
+{
+	ft_zone_t	*zone;
+	size_t		budget;
+	size_t		released;
+	size_t		dirty;
+	size_t		n;
+	size_t		i;
+
+	if (MALLOC_PREACTION != 0)
+		return (0);
+	n = ft_decay_collect(&dirty);
+	budget = dirty;
+	budget -= budget * FT_DECAY_KEEP >> 10;
+	if (budget < ft_pagesize())
+		budget = ft_pagesize();
+	released = 0;
+	i = 0;
+	while (i < n && budget)
+	{
+		zone = g_decay_batch[i++];
+		budget -= zone->dirty < budget ? zone->dirty : budget;
+		released += ft_decay_purge(zone);
+		if (i == FT_DECAY_BATCH)
+		{
+			n = ft_decay_collect(&dirty);
+			i = 0;
+		}
+	}
+	g_decay_epoch++;
+	(void)MALLOC_POSTACTION;
+	return (released);
+}
+
+#ifdef USE_MALLOC_LOCK
+
+static int	g_decay_started = 0;
+
+/*
+** ft_decay_main()
+**
+** Body of the decay thread. decay_ms is read again at every step, so it
+** can be changed (or set to 0) at runtime.
+*/
+
+static void	*ft_decay_main(void *arg)
+{
+	struct timespec	pause;
+	size_t			ms;
+
+	(void)arg;
+	while (1)
+	{
+		ms = ft_conf_get()->decay_ms / FT_DECAY_STEPS;
+		if (ft_conf_get()->decay_ms == 0)
+			ms = FT_DECAY_IDLE_MS;
+		else if (ms == 0)
+			ms = 1;
+		pause.tv_sec = (time_t)(ms / 1000);
+		pause.tv_nsec = (long)(ms % 1000) * 1000000L;
+		nanosleep(&pause, NULL);
+		if (ft_conf_get()->decay_ms)
+			ft_decay_tick();
+	}
+	return (NULL);
+}
+
+void	ft_decay_start(void)
+{
+	pthread_attr_t	attr;
+	pthread_t		tid;
+
+	if (ft_conf_get()->decay_ms == 0
+		|| __atomic_exchange_n(&g_decay_started, 1, __ATOMIC_ACQ_REL))
+		return ;
+	if (pthread_attr_init(&attr) != 0)
+	{
+		__atomic_store_n(&g_decay_started, 0, __ATOMIC_RELEASE);
+		return ;
+	}
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&tid, &attr, ft_decay_main, NULL) != 0)
+		__atomic_store_n(&g_decay_started, 0, __ATOMIC_RELEASE);
+	pthread_attr_destroy(&attr);
+}
+
+#else
+
+/*
+** Without the allocator lock the zone lists cannot be shared: no thread
+*/
+
+void	ft_decay_start(void)
+{
+}
+
+#endif
+
+/*
+** ft_decay_init()
+**
+** Starts the thread at library load when FT_MALLOC_CONF sets decay_ms.
+*/
+
+__attribute__((constructor))
+static void	ft_decay_init(void)
+{
+	ft_decay_start();
+}
@@ -1,6 +1,7 @@
 #include "fit.h"
 #include "zone.h"
 #include "block.h"
+#include "numa.h"
 #include <stddef.h>
 
 /*
@@ -12,16 +13,27 @@
 **
 ** Returns the first suitable block found, setting out_zone to point
 ** to the zone containing that block.
+** With NUMA placement only the zones of the calling thread's node are
+** searched: a miss creates a local zone rather than using a remote one.
+** Zones of the other nursery kind are skipped the same way.
 */
 
-ft_block_t	*ft_first_fit(uint8_t type, size_t size, ft_zone_t **out_zone)
+ft_block_t	*ft_first_fit(uint8_t type, size_t size, int nursery,
+	ft_zone_t **out_zone)
 {
 	ft_zone_t	*zone;
 	ft_block_t	*block;
+	int			node;
 
+	node = ft_numa_active() ? ft_numa_node() : -1;
 	zone = *ft_zone_get_list(type);
 	while (zone)
 	{
+		if ((node >= 0 && zone->node != node) || zone->nursery != nursery)
+		{
+			zone = zone->next;
+			continue ;
+		}
 		block = zone->free_head;
 		while (block)
 		{
@@ -0,0 +1,474 @@
+#define _GNU_SOURCE
+#include "guard.h"
+#include "conf.h"
+#include "lock.h"
+#include "utils.h"
+#include <execinfo.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+** One pool slot and the last object it held
+*/
+
+#define FT_GUARD_EMPTY	0		/* Never used */
+#define FT_GUARD_LIVE	1
+#define FT_GUARD_FREED	2
+
+typedef struct s_guard_slot
+{
+	void		*ptr;
+	size_t		size;
+	uint8_t		state;
+	uint8_t		alloc_depth;
+	uint8_t		free_depth;
+	int32_t		alloc_tid;
+	int32_t		free_tid;
+	void		*alloc_pcs[FT_GUARD_DEPTH];
+	void		*free_pcs[FT_GUARD_DEPTH];
+}	t_guard_slot;
+
+/*
+** Pool layout: guard page, then FT_GUARD_SLOTS times (slot, guard page).
+** 'queue' is a FIFO of the slots that are not live, oldest free first.
+*/
+
+typedef struct s_guard
+{
+	uint8_t				state;		/* 0: not yet, 1: ready, 2: failed */
+	size_t				page;
+	size_t				slot_bytes;
+	size_t				stride;
+	t_guard_slot		*slots;
+	uint32_t			*queue;
+	size_t				head;
+	size_t				count;
+	struct sigaction	old_segv;
+}	t_guard;
+
+static t_guard	g_guard;
+
+uintptr_t	g_guard_base = 0;
+size_t		g_guard_size = 0;
+
+__thread int64_t	t_guard_left
+	__attribute__((tls_model("initial-exec"))) = 0;
+static __thread uint64_t	t_guard_rng
+	__attribute__((tls_model("initial-exec"))) = 0;
+static __thread int			t_guard_busy
+	__attribute__((tls_model("initial-exec"))) = 0;
+
+/* ----------------------------------------------- */
+/* Report                                          */
+/* ----------------------------------------------- */
+
+/*
+** Small buffered writer to stderr: reports are written from the fault
+** handler and under the allocator lock, so no stdio.
+*/
+
+typedef struct s_guard_out
+{
+	size_t	len;
+	char	buf[512];
+}	t_guard_out;
+
+static void	ft_guard_flush(t_guard_out *out)
+{
+	ssize_t	ret;
+
+	if (out->len)
+		ret = write(2, out->buf, out->len);
+	(void)ret;
+	out->len = 0;
+}
+
+static void	ft_guard_puts(t_guard_out *out, const char *s)
+{
+	while (*s)
+	{
+		if (out->len == sizeof(out->buf))
+			ft_guard_flush(out);
+		out->buf[out->len++] = *s++;
+	}
+}
+
+static void	ft_guard_putnum(t_guard_out *out, uint64_t n, unsigned int base)
+{
+	char	tmp[24];
+	int		i;
+
+	i = 23;
+	tmp[i] = '\0';
+	do
+	{
+		tmp[--i] = "0123456789abcdef"[n % base];
+		n /= base;
+	} while (n);
+	if (base == 16)
+		ft_guard_puts(out, "0x");
+	ft_guard_puts(out, &tmp[i]);
+}
+
+static void	ft_guard_put_stack(t_guard_out *out, const char *what,
+	int32_t tid, void **pcs, uint8_t depth)
+{
+	ft_guard_puts(out, what);
+	ft_guard_puts(out, " by thread ");
+	ft_guard_putnum(out, (uint64_t)tid, 10);
+	ft_guard_puts(out, ":\n");
+	ft_guard_flush(out);
+	backtrace_symbols_fd(pcs, depth, 2);
+}
+
+/*
+** ft_guard_report()
+**
+** "<kind> on address A: <relation> the N-byte block at P", then the
+** stacks that allocated and freed that block.
+*/
+
+static void	ft_guard_report(const char *kind, uintptr_t addr,
+	const char *relation, size_t distance, const t_guard_slot *slot)
+{
+	t_guard_out	out;
+
+	out.len = 0;
+	ft_guard_puts(&out, "==ft_malloc== ");
+	ft_guard_puts(&out, kind);
+	ft_guard_puts(&out, " on address ");
+	ft_guard_putnum(&out, addr, 16);
+	if (slot && slot->ptr)
+	{
+		ft_guard_puts(&out, ": ");
+		if (relation[0] != 'i')
+		{
+			ft_guard_putnum(&out, distance, 10);
+			ft_guard_puts(&out, " bytes ");
+		}
+		ft_guard_puts(&out, relation);
+		ft_guard_puts(&out, " the ");
+		ft_guard_putnum(&out, slot->size, 10);
+		ft_guard_puts(&out, "-byte block at ");
+		ft_guard_putnum(&out, (uintptr_t)slot->ptr, 16);
+		ft_guard_puts(&out, "\n");
+		ft_guard_put_stack(&out, "allocated", slot->alloc_tid,
+			(void **)slot->alloc_pcs, slot->alloc_depth);
+		if (slot->state == FT_GUARD_FREED)
+			ft_guard_put_stack(&out, "freed", slot->free_tid,
+				(void **)slot->free_pcs, slot->free_depth);
+	}
+	else
+		ft_guard_puts(&out, "\n");
+	ft_guard_flush(&out);
+}
+
+/*
+** ft_guard_classify()
+**
+** Finds the block a faulting address belongs to: inside a slot it is a
+** use of a freed block; in a guard page it is an overflow of the slot
+** before or an underflow of the slot after, whichever object is closer.
+*/
+
+static void	ft_guard_classify(uintptr_t addr)
+{
+	const t_guard_slot	*before;
+	const t_guard_slot	*after;
+	size_t				off;
+	size_t				idx;
+	uintptr_t			end;
+
+	off = addr - g_guard_base;
+	idx = off < g_guard.page ? 0 : (off - g_guard.page) / g_guard.stride;
+	if (off >= g_guard.page
+		&& (off - g_guard.page) % g_guard.stride < g_guard.slot_bytes)
+	{
+		before = &g_guard.slots[idx];
+		ft_guard_report(before->ptr ? "heap-use-after-free" : "wild access",
+			addr, "inside", 0, before);
+		return ;
+	}
+	before = off < g_guard.page ? NULL : &g_guard.slots[idx];
+	after = off < g_guard.page ? &g_guard.slots[0] : idx + 1 < FT_GUARD_SLOTS
+		? &g_guard.slots[idx + 1] : NULL;
+	if (before && !before->ptr)
+		before = NULL;
+	if (after && !after->ptr)
+		after = NULL;
+	end = before ? (uintptr_t)before->ptr + before->size : 0;
+	if (before && (!after || addr - end <= (uintptr_t)after->ptr - addr))
+		ft_guard_report("heap-buffer-overflow", addr, "after", addr - end,
+			before);
+	else if (after)
+		ft_guard_report("heap-buffer-underflow", addr, "before",
+			(uintptr_t)after->ptr - addr, after);
+	else
+		ft_guard_report("wild access", addr, "", 0, NULL);
+}
+
+/*
+** ft_guard_on_fault()
+**
+** SIGSEGV handler. A fault in the pool is reported, then the default
+** action is restored so that returning faults again and kills the
+** process (with a core dump). Other faults go to the previous handler.
+*/
+
+static void	ft_guard_on_fault(int sig, siginfo_t *info, void *uctx)
+{
+	struct sigaction	*old;
+
+	if (!ft_guard_owns(info->si_addr))
+	{
+		old = &g_guard.old_segv;
+		if ((old->sa_flags & SA_SIGINFO) && old->sa_sigaction)
+			old->sa_sigaction(sig, info, uctx);
+		else if (old->sa_handler != SIG_DFL && old->sa_handler != SIG_IGN)
+			old->sa_handler(sig);
+		else
+			signal(sig, SIG_DFL);
+		return ;
+	}
+	ft_guard_classify((uintptr_t)info->si_addr);
+	signal(sig, SIG_DFL);
+}
+
+/* ----------------------------------------------- */
+/* Pool                                            */
+/* ----------------------------------------------- */
+
+/*
+** ft_guard_init()
+**
+** Reserves the pool and its metadata on the first sample and installs the
+** fault handler. Runs under the allocator lock.
+*/
+
+static int	ft_guard_init(void)
+{
+	struct sigaction	sa;
+	void				*pool;
+	void				*meta;
+	size_t				size;
+	size_t				i;
+
+	if (g_guard.state != 0)
+		return (g_guard.state == 1);
+	g_guard.state = 2;
+	g_guard.page = ft_pagesize();
+	g_guard.slot_bytes = FT_GUARD_SLOT_PAGES * g_guard.page;
+	g_guard.stride = g_guard.slot_bytes + g_guard.page;
+	size = g_guard.page + FT_GUARD_SLOTS * g_guard.stride;
+	pool = mmap(NULL, size, PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (pool == MAP_FAILED)
+		return (0);
+	meta = mmap(NULL, FT_GUARD_SLOTS * (sizeof(t_guard_slot)
+		+ sizeof(uint32_t)), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (meta == MAP_FAILED)
+	{
+		munmap(pool, size);
+		return (0);
+	}
+	g_guard.slots = (t_guard_slot *)meta;
+	g_guard.queue = (uint32_t *)(g_guard.slots + FT_GUARD_SLOTS);
+	i = 0;
+	while (i < FT_GUARD_SLOTS)
+	{
+		g_guard.queue[i] = (uint32_t)i;
+		i++;
+	}
+	g_guard.count = FT_GUARD_SLOTS;
+	sa.sa_sigaction = ft_guard_on_fault;
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGSEGV, &sa, &g_guard.old_segv);
+	g_guard_base = (uintptr_t)pool;
+	g_guard_size = size;
+	g_guard.state = 1;
+	return (1);
+}
+
+static void	*ft_guard_slot_data(size_t idx)
+{
+	return ((void *)(g_guard_base + g_guard.page + idx * g_guard.stride));
+}
+
+/*
+** ft_guard_next_interval()
+**
+** Allocations until the next sample: uniform in [1, 2 * rate - 1], so
+** the mean is 'rate' and the pattern cannot be predicted.
+*/
+
+static int64_t	ft_guard_next_interval(size_t rate)
+{
+	uint64_t	x;
+
+	x = t_guard_rng;
+	if (x == 0)
+		x = (uint64_t)(uintptr_t)&t_guard_rng ^ 0x9E3779B97F4A7C15ULL;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	t_guard_rng = x;
+	return ((int64_t)(x % (2 * rate - 1)) + 1);
+}
+
+/*
+** ft_guard_take()
+**
+** Moves the oldest free slot out of quarantine and places the object in
+** it. Runs under the allocator lock.
+*/
+
+static void	*ft_guard_take(size_t size, void **pcs, int depth)
+{
+	t_guard_slot	*slot;
+	uint32_t		idx;
+	char			*data;
+	int				i;
+
+	if (!ft_guard_init() || g_guard.count == 0)
+		return (NULL);
+	idx = g_guard.queue[g_guard.head];
+	data = ft_guard_slot_data(idx);
+	if (mprotect(data, g_guard.slot_bytes, PROT_READ | PROT_WRITE) != 0)
+		return (NULL);
+	g_guard.head = (g_guard.head + 1) % FT_GUARD_SLOTS;
+	g_guard.count--;
+	slot = &g_guard.slots[idx];
+	slot->ptr = ft_conf_get()->guard_left ? data
+		: data + g_guard.slot_bytes - ((size + 15) & ~(size_t)15);
+	slot->size = size;
+	slot->state = FT_GUARD_LIVE;
+	slot->alloc_tid = (int32_t)syscall(SYS_gettid);
+	slot->alloc_depth = (uint8_t)depth;
+	i = 0;
+	while (i < depth)
+	{
+		slot->alloc_pcs[i] = pcs[i];
+		i++;
+	}
+	return (slot->ptr);
+}
+
+void	*ft_guard_sample(size_t size)
+{
+	void	*pcs[FT_GUARD_DEPTH + FT_GUARD_SKIP];
+	void	*ptr;
+	size_t	rate;
+	int		depth;
+
+	rate = ft_conf_get()->guard_sample;
+	if (rate == 0)
+	{
+		t_guard_left = 65536;
+		return (NULL);
+	}
+	if (t_guard_rng == 0)
+	{
+		t_guard_left = ft_guard_next_interval(rate);
+		if (--t_guard_left > 0)
+			return (NULL);
+	}
+	t_guard_left = ft_guard_next_interval(rate);
+	if (t_guard_busy || size == 0
+		|| size > FT_GUARD_SLOT_PAGES * ft_pagesize())
+		return (NULL);
+	t_guard_busy = 1;
+	depth = backtrace(pcs, FT_GUARD_DEPTH + FT_GUARD_SKIP) - FT_GUARD_SKIP;
+	ptr = NULL;
+	if (MALLOC_PREACTION == 0)
+	{
+		ptr = ft_guard_take(size, pcs + FT_GUARD_SKIP, depth < 0 ? 0 : depth);
+		(void)MALLOC_POSTACTION;
+	}
+	t_guard_busy = 0;
+	return (ptr);
+}
+
+/*
+** ft_guard_lookup()
+**
+** Returns the live slot holding 'ptr'. Reports and aborts when 'ptr' is
+** not the start of a live pooled object. Runs under the allocator lock.
+*/
+
+static t_guard_slot	*ft_guard_lookup(void *ptr, const char *op)
+{
+	t_guard_slot	*slot;
+	size_t			off;
+
+	off = (uintptr_t)ptr - g_guard_base;
+	slot = NULL;
+	if (off >= g_guard.page)
+		slot = &g_guard.slots[(off - g_guard.page) / g_guard.stride];
+	if (slot && slot->state == FT_GUARD_LIVE && slot->ptr == ptr)
+		return (slot);
+	if (slot && slot->state == FT_GUARD_FREED && slot->ptr == ptr)
+		ft_guard_report("double-free", (uintptr_t)ptr, "inside", 0, slot);
+	else
+		ft_guard_report(op, (uintptr_t)ptr, "inside", 0,
+			slot && slot->ptr ? slot : NULL);
+	abort();
+}
+
+void	ft_guard_free(void *ptr)
+{
+	void			*pcs[FT_GUARD_DEPTH + FT_GUARD_SKIP];
+	t_guard_slot	*slot;
+	size_t			idx;
+	int				depth;
+	int				i;
+
+	depth = backtrace(pcs, FT_GUARD_DEPTH + FT_GUARD_SKIP) - FT_GUARD_SKIP;
+	if (depth < 0)
+		depth = 0;
+	if (MALLOC_PREACTION != 0)
+		return ;
+	slot = ft_guard_lookup(ptr, "invalid-free");
+	idx = (size_t)(slot - g_guard.slots);
+	slot->state = FT_GUARD_FREED;
+	slot->free_tid = (int32_t)syscall(SYS_gettid);
+	slot->free_depth = (uint8_t)depth;
+	i = 0;
+	while (i < depth)
+	{
+		slot->free_pcs[i] = pcs[i + FT_GUARD_SKIP];
+		i++;
+	}
+	madvise(ft_guard_slot_data(idx), g_guard.slot_bytes, MADV_DONTNEED);
+	mprotect(ft_guard_slot_data(idx), g_guard.slot_bytes, PROT_NONE);
+	g_guard.queue[(g_guard.head + g_guard.count) % FT_GUARD_SLOTS]
+		= (uint32_t)idx;
+	g_guard.count++;
+	(void)MALLOC_POSTACTION;
+}
+
+void	*ft_guard_realloc(void *ptr, size_t size)
+{
+	void	*new_ptr;
+	size_t	old_size;
+
+	if (size == 0)
+	{
+		ft_guard_free(ptr);
+		return (NULL);
+	}
+	if (MALLOC_PREACTION != 0)
+		return (NULL);
+	old_size = ft_guard_lookup(ptr, "invalid-realloc")->size;
+	(void)MALLOC_POSTACTION;
+	new_ptr = malloc(size);
+	if (!new_ptr)
+		return (NULL);
+	ft_memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+	ft_guard_free(ptr);
+	return (new_ptr);
+}
@@ -0,0 +1,549 @@
+#include "heap_prof.h"
+#include "block.h"
+#include "conf.h"
+#include "lock.h"
+#include <execinfo.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+** One distinct call stack and what was sampled from it
+*/
+
+typedef struct s_prof_stack
+{
+	uint64_t	hash;
+	uint32_t	depth;
+	void		*pcs[FT_PROF_DEPTH];
+	size_t		inuse_objs;
+	size_t		inuse_bytes;
+	size_t		alloc_objs;
+	size_t		alloc_bytes;
+}	t_prof_stack;
+
+/*
+** One sampled block that is still alive
+*/
+
+typedef struct s_prof_live
+{
+	void		*ptr;		/* NULL for an empty slot */
+	size_t		size;
+	uint32_t	stack;
+}	t_prof_live;
+
+typedef struct s_prof
+{
+	uint8_t			state;		/* 0: not yet, 1: ready, 2: failed */
+	t_prof_stack	*stacks;
+	size_t			n_stacks;
+	t_prof_live		*live;
+	size_t			dropped;
+}	t_prof;
+
+static t_prof	g_prof = {0, NULL, 0, NULL, 0};
+
+/*
+** Per-thread sampler state
+**
+** t_prof_busy is the reentrancy guard: backtrace() may allocate (it loads
+** the unwinder the first time), and those allocations must not be
+** sampled in turn.
+*/
+
+static __thread int64_t		t_prof_left
+	__attribute__((tls_model("initial-exec"))) = 0;
+static __thread uint64_t	t_prof_rng
+	__attribute__((tls_model("initial-exec"))) = 0;
+static __thread int			t_prof_busy
+	__attribute__((tls_model("initial-exec"))) = 0;
+
+/* ----------------------------------------------- */
+/* Sampling interval                               */
+/* ----------------------------------------------- */
+
+/*
+** ft_prof_log()
+**
+** Natural logarithm of x in (0, 1], without libm: split x into
+** mantissa * 2^exp and use the atanh series for the mantissa.
+*/
+
+static double	ft_prof_log(double x)
+{
+	union { double d; uint64_t u; }	v;
+	int64_t							exp;
+	double							t;
+	double							t2;
+
+	v.d = x;
+	exp = (int64_t)((v.u >> 52) & 0x7FF) - 1023;
+	v.u = (v.u & 0xFFFFFFFFFFFFFULL) | 0x3FF0000000000000ULL;
+	t = (v.d - 1.0) / (v.d + 1.0);
+	t2 = t * t;
+	return ((double)exp * 0.6931471805599453
+		+ 2.0 * t * (1.0 + t2 * (1.0 / 3 + t2 * (1.0 / 5
+		+ t2 * (1.0 / 7 + t2 * (1.0 / 9 + t2 / 11))))));
+}
+
+/*
+** ft_prof_next_interval()
+**
+** Draws the number of bytes until the next sample from an exponential
+** distribution of mean 'rate' (xorshift64 for the uniform draw).
+*/
+
+static int64_t	ft_prof_next_interval(size_t rate)
+{
+	uint64_t	x;
+	double		u;
+
+	x = t_prof_rng;
+	if (x == 0)
+		x = (uint64_t)(uintptr_t)&t_prof_rng ^ 0x9E3779B97F4A7C15ULL;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	t_prof_rng = x;
+	u = (double)((x >> 11) + 1) / 9007199254740992.0;
+	return ((int64_t)(-ft_prof_log(u) * (double)rate) + 1);
+}
+
+/* ----------------------------------------------- */
+/* Tables                                          */
+/* ----------------------------------------------- */
+
+/*
+** ft_prof_init()
+**
+** Maps the tables on the first sample. Runs under the allocator lock.
+*/
+
+static int	ft_prof_init(void)
+{
+	void	*mem;
+
+	if (g_prof.state != 0)
+		return (g_prof.state == 1);
+	g_prof.state = 2;
+	mem = mmap(NULL, FT_PROF_MAX_STACKS * sizeof(t_prof_stack)
+		+ FT_PROF_MAX_LIVE * sizeof(t_prof_live), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		return (0);
+	g_prof.stacks = (t_prof_stack *)mem;
+	g_prof.live = (t_prof_live *)(g_prof.stacks + FT_PROF_MAX_STACKS);
+	g_prof.state = 1;
+	return (1);
+}
+
+static size_t	ft_prof_ptr_slot(const void *ptr)
+{
+	uint64_t	h;
+
+	h = (uint64_t)(uintptr_t)ptr >> 4;
+	h *= 0x9E3779B97F4A7C15ULL;
+	return ((size_t)(h >> 32) & (FT_PROF_MAX_LIVE - 1));
+}
+
+/*
+** ft_prof_find_stack()
+**
+** Finds or creates the entry for a call stack (linear probing on the
+** FNV-1a hash of its addresses). Two stacks only share an entry if
+** their addresses all match. Returns -1 when the table is full.
+*/
+
+static int	ft_prof_same_stack(const t_prof_stack *s, void *const *pcs,
+	uint32_t depth, uint64_t hash)
+{
+	uint32_t	i;
+
+	if (s->hash != hash || s->depth != depth)
+		return (0);
+	i = 0;
+	while (i < depth && s->pcs[i] == pcs[i])
+		i++;
+	return (i == depth);
+}
+
+
+static int64_t	ft_prof_find_stack(void *const *pcs, uint32_t depth)
+{
+	uint64_t	hash;
+	uint32_t	i;
+	size_t		slot;
+	size_t		probes;
+
+	hash = 0xCBF29CE484222325ULL;
+	i = 0;
+	while (i < depth)
+		hash = (hash ^ (uint64_t)(uintptr_t)pcs[i++]) * 0x100000001B3ULL;
+	slot = (size_t)hash % FT_PROF_MAX_STACKS;
+	probes = 0;
+	while (probes++ < FT_PROF_MAX_STACKS)
+	{
+		if (g_prof.stacks[slot].depth == 0)
+		{
+			g_prof.stacks[slot].hash = hash;
+			g_prof.stacks[slot].depth = depth;
+			i = 0;
+			while (i < depth)
+			{
+				g_prof.stacks[slot].pcs[i] = pcs[i];
+				i++;
+			}
+			g_prof.n_stacks++;
+			return ((int64_t)slot);
+		}
+		if (ft_prof_same_stack(&g_prof.stacks[slot], pcs, depth, hash))
+			return ((int64_t)slot);
+		slot = (slot + 1) % FT_PROF_MAX_STACKS;
+	}
+	return (-1);
+}
+
+/*
+** ft_prof_insert()
+**
+** Records a sample: updates its stack and remembers the live block.
+** Runs under the allocator lock.
+*/
+
+static void	ft_prof_insert(void *ptr, size_t size, void *const *pcs,
+	uint32_t depth)
+{
+	int64_t		stack;
+	size_t		slot;
+	size_t		probes;
+
+	stack = ft_prof_find_stack(pcs, depth);
+	if (stack < 0)
+	{
+		g_prof.dropped++;
+		return ;
+	}
+	slot = ft_prof_ptr_slot(ptr);
+	probes = 0;
+	while (g_prof.live[slot].ptr)
+	{
+		if (++probes == FT_PROF_MAX_LIVE / 2)
+		{
+			g_prof.dropped++;
+			return ;
+		}
+		slot = (slot + 1) & (FT_PROF_MAX_LIVE - 1);
+	}
+	g_prof.live[slot].ptr = ptr;
+	g_prof.live[slot].size = size;
+	g_prof.live[slot].stack = (uint32_t)stack;
+	g_prof.stacks[stack].inuse_objs++;
+	g_prof.stacks[stack].inuse_bytes += size;
+	g_prof.stacks[stack].alloc_objs++;
+	g_prof.stacks[stack].alloc_bytes += size;
+	ft_block_from_data_ptr(ptr)->flags |= FT_BLOCK_SAMPLED;
+}
+
+/* ----------------------------------------------- */
+/* Hooks                                           */
+/* ----------------------------------------------- */
+
+/*
+** ft_prof_capture()
+**
+** Only looks at the countdown, which belongs to the thread: the stack is
+** taken without the lock, and the guard keeps the allocations backtrace()
+** may make from being sampled in turn.
+*/
+
+void	ft_prof_capture(size_t size, ft_prof_trace_t *trace)
+{
+	size_t		rate;
+
+	trace->depth = 0;
+	rate = ft_conf_get()->prof_sample;
+	if (rate == 0 || t_prof_busy)
+		return ;
+	if (t_prof_rng == 0)
+		t_prof_left = ft_prof_next_interval(rate);
+	if (t_prof_left > (int64_t)size)
+		return ;
+	t_prof_busy = 1;
+	trace->depth = backtrace(trace->pcs, FT_PROF_DEPTH + FT_PROF_SKIP);
+	t_prof_busy = 0;
+}
+
+/*
+** ft_prof_record()
+**
+** The countdown only moves here, for blocks that were really handed out,
+** so a realloc() that stays in place is not counted.
+*/
+
+void	ft_prof_record(void *ptr, size_t size, const ft_prof_trace_t *trace)
+{
+	size_t		rate;
+
+	rate = ft_conf_get()->prof_sample;
+	if (rate == 0 || t_prof_busy)
+		return ;
+	t_prof_left -= (int64_t)size;
+	if (t_prof_left > 0)
+		return ;
+	t_prof_left = ft_prof_next_interval(rate);
+	if (trace->depth > FT_PROF_SKIP && ft_prof_init())
+		ft_prof_insert(ptr, size, trace->pcs + FT_PROF_SKIP,
+			(uint32_t)(trace->depth - FT_PROF_SKIP));
+}
+
+/*
+** ft_prof_on_free()
+**
+** Removes the block from the live table with backward-shift deletion,
+** so lookups never need tombstones.
+*/
+
+void	ft_prof_on_free(void *ptr)
+{
+	size_t		slot;
+	size_t		next;
+	size_t		home;
+	t_prof_stack	*stack;
+
+	if (g_prof.state != 1)
+		return ;
+	slot = ft_prof_ptr_slot(ptr);
+	while (g_prof.live[slot].ptr && g_prof.live[slot].ptr != ptr)
+		slot = (slot + 1) & (FT_PROF_MAX_LIVE - 1);
+	if (!g_prof.live[slot].ptr)
+		return ;
+	stack = &g_prof.stacks[g_prof.live[slot].stack];
+	stack->inuse_objs--;
+	stack->inuse_bytes -= g_prof.live[slot].size;
+	next = (slot + 1) & (FT_PROF_MAX_LIVE - 1);
+	while (g_prof.live[next].ptr)
+	{
+		home = ft_prof_ptr_slot(g_prof.live[next].ptr);
+		if (((next - home) & (FT_PROF_MAX_LIVE - 1))
+			>= ((next - slot) & (FT_PROF_MAX_LIVE - 1)))
+		{
+			g_prof.live[slot] = g_prof.live[next];
+			slot = next;
+		}
+		next = (next + 1) & (FT_PROF_MAX_LIVE - 1);
+	}
+	g_prof.live[slot].ptr = NULL;
+}
+
+/* ----------------------------------------------- */
+/* Output                                          */
+/* ----------------------------------------------- */
+
+/*
+** Small buffered writer: the dump must not allocate, so no stdio.
+*/
+
+typedef struct s_prof_out
+{
+	int		fd;
+	size_t	len;
+	char	buf[4096];
+}	t_prof_out;
+
+static void	ft_prof_flush(t_prof_out *out)
+{
+	ssize_t	ret;
+
+	if (out->len)
+	{
+		ret = write(out->fd, out->buf, out->len);
+		(void)ret;
+	}
+	out->len = 0;
+}
+
+static void	ft_prof_puts(t_prof_out *out, const char *s)
+{
+	while (*s)
+	{
+		if (out->len == sizeof(out->buf))
+			ft_prof_flush(out);
+		out->buf[out->len++] = *s++;
+	}
+}
+
+static void	ft_prof_putnum(t_prof_out *out, uint64_t n, unsigned int base)
+{
+	char	tmp[24];
+	int		i;
+
+	i = 23;
+	tmp[i] = '\0';
+	do
+	{
+		tmp[--i] = "0123456789abcdef"[n % base];
+		n /= base;
+	} while (n);
+	if (base == 16)
+		ft_prof_puts(out, "0x");
+	ft_prof_puts(out, &tmp[i]);
+}
+
+static void	ft_prof_put_counts(t_prof_out *out, size_t inuse_objs,
+	size_t inuse_bytes, size_t alloc_objs, size_t alloc_bytes)
+{
+	ft_prof_putnum(out, inuse_objs, 10);
+	ft_prof_puts(out, ": ");
+	ft_prof_putnum(out, inuse_bytes, 10);
+	ft_prof_puts(out, " [");
+	ft_prof_putnum(out, alloc_objs, 10);
+	ft_prof_puts(out, ": ");
+	ft_prof_putnum(out, alloc_bytes, 10);
+	ft_prof_puts(out, "] @");
+}
+
+static void	ft_prof_write_stacks(t_prof_out *out)
+{
+	size_t			i;
+	uint32_t		d;
+	t_prof_stack	*s;
+	t_prof_stack	total;
+
+	total = (t_prof_stack){0, 0, {NULL}, 0, 0, 0, 0};
+	i = 0;
+	while (g_prof.state == 1 && i < FT_PROF_MAX_STACKS)
+	{
+		s = &g_prof.stacks[i++];
+		total.inuse_objs += s->inuse_objs;
+		total.inuse_bytes += s->inuse_bytes;
+		total.alloc_objs += s->alloc_objs;
+		total.alloc_bytes += s->alloc_bytes;
+	}
+	ft_prof_puts(out, "heap profile: ");
+	ft_prof_put_counts(out, total.inuse_objs, total.inuse_bytes,
+		total.alloc_objs, total.alloc_bytes);
+	ft_prof_puts(out, " heap_v2/");
+	ft_prof_putnum(out, ft_conf_get()->prof_sample, 10);
+	ft_prof_puts(out, "\n");
+	i = 0;
+	while (g_prof.state == 1 && i < FT_PROF_MAX_STACKS)
+	{
+		s = &g_prof.stacks[i++];
+		if (s->depth == 0)
+			continue ;
+		ft_prof_puts(out, " ");
+		ft_prof_put_counts(out, s->inuse_objs, s->inuse_bytes,
+			s->alloc_objs, s->alloc_bytes);
+		d = 0;
+		while (d < s->depth)
+		{
+			ft_prof_puts(out, " ");
+			ft_prof_putnum(out, (uintptr_t)s->pcs[d++], 16);
+		}
+		ft_prof_puts(out, "\n");
+	}
+}
+
+/*
+** ft_prof_write_maps()
+**
+** pprof needs the mappings to symbolize the addresses.
+*/
+
+static void	ft_prof_write_maps(t_prof_out *out)
+{
+	int		fd;
+	ssize_t	n;
+
+	ft_prof_puts(out, "\nMAPPED_LIBRARIES:\n");
+	ft_prof_flush(out);
+	fd = open("/proc/self/maps", O_RDONLY);
+	if (fd < 0)
+		return ;
+	while ((n = read(fd, out->buf, sizeof(out->buf))) > 0)
+	{
+		out->len = (size_t)n;
+		ft_prof_flush(out);
+	}
+	close(fd);
+}
+
+/*
+** ft_prof_default_path()
+**
+** $FT_MALLOC_PROF, or ft_malloc_<pid>.heap in the current directory.
+*/
+
+static const char	*ft_prof_default_path(char *buf, size_t size)
+{
+	const char	*env;
+	char		tmp[24];
+	size_t		len;
+	int			i;
+	pid_t		pid;
+
+	env = getenv(FT_PROF_ENV);
+	if (env && *env)
+		return (env);
+	pid = getpid();
+	i = 23;
+	tmp[i] = '\0';
+	do
+	{
+		tmp[--i] = (char)('0' + pid % 10);
+		pid /= 10;
+	} while (pid);
+	len = 0;
+	while (len < size - 16 && "ft_malloc_"[len])
+	{
+		buf[len] = "ft_malloc_"[len];
+		len++;
+	}
+	while (tmp[i] && len < size - 6)
+		buf[len++] = tmp[i++];
+	buf[len++] = '.';
+	buf[len++] = 'h';
+	buf[len++] = 'e';
+	buf[len++] = 'a';
+	buf[len++] = 'p';
+	buf[len] = '\0';
+	return (buf);
+}
+
+int	ft_malloc_prof_dump(const char *path)
+{
+	t_prof_out	out;
+	char		name[64];
+
+	if (!path)
+		path = ft_prof_default_path(name, sizeof(name));
+	out.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out.fd < 0)
+		return (-1);
+	out.len = 0;
+	if (MALLOC_PREACTION != 0)
+	{
+		close(out.fd);
+		return (-1);
+	}
+	ft_prof_write_stacks(&out);
+	(void)MALLOC_POSTACTION;
+	ft_prof_write_maps(&out);
+	close(out.fd);
+	return (0);
+}
+
+/*
+** ft_prof_at_exit()
+**
+** Writes the profile when the program ends, if anything was sampled.
+*/
+
+__attribute__((destructor))
+static void	ft_prof_at_exit(void)
+{
+	if (g_prof.state == 1)
+		(void)ft_malloc_prof_dump(NULL);
+}
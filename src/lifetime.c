@@ -0,0 +1,220 @@
+#include "lifetime.h"
+#include "block.h"
+#include "conf.h"
+
+/*
+** One call site and what its samples taught
+*/
+
+typedef struct s_life_site
+{
+	uintptr_t	pc;			/* Return address owning the slot, 0 = none */
+	int32_t		score;		/* See lifetime.h */
+}	t_life_site;
+
+/*
+** One sampled block that is still alive
+*/
+
+typedef struct s_life_live
+{
+	void		*ptr;		/* NULL for an empty slot */
+	uintptr_t	pc;			/* Site that allocated it */
+	uint64_t	birth;		/* Clock when it was allocated */
+}	t_life_live;
+
+typedef struct s_life
+{
+	uint64_t	clock;		/* Bytes allocated so far */
+	int64_t		left;		/* Allocations until the next sample */
+	uint64_t	rng;
+	t_life_site	sites[FT_LIFE_SITES];
+	t_life_live	live[FT_LIFE_MAX_LIVE];
+}	t_life;
+
+static t_life	g_life;
+
+static size_t	ft_life_site_slot(uintptr_t pc)
+{
+	uint64_t	h;
+
+	h = (uint64_t)pc * 0x9E3779B97F4A7C15ULL;
+	return ((size_t)(h >> 32) % FT_LIFE_SITES);
+}
+
+static size_t	ft_life_ptr_slot(const void *ptr)
+{
+	uint64_t	h;
+
+	h = (uint64_t)(uintptr_t)ptr >> 4;
+	h *= 0x9E3779B97F4A7C15ULL;
+	return ((size_t)(h >> 32) & (FT_LIFE_MAX_LIVE - 1));
+}
+
+/*
+** ft_life_next_interval()
+**
+** Allocations until the next sample, uniform in [1, 2 * rate - 1]: a
+** fixed interval could stay in step with a loop and only ever sample
+** one of its sites (xorshift64 for the draw).
+*/
+
+static int64_t	ft_life_next_interval(size_t rate)
+{
+	uint64_t	x;
+
+	x = g_life.rng;
+	if (x == 0)
+		x = (uint64_t)(uintptr_t)&g_life ^ 0x9E3779B97F4A7C15ULL;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	g_life.rng = x;
+	return ((int64_t)(1 + x % (2 * rate - 1)));
+}
+
+int	ft_life_nursery(const void *site)
+{
+	const t_life_site	*s;
+
+	s = &g_life.sites[ft_life_site_slot((uintptr_t)site)];
+	return (s->pc == (uintptr_t)site && s->score >= FT_LIFE_NURSERY);
+}
+
+/*
+** ft_life_insert()
+**
+** Enters a sample in the live table and flags its block. A sample that
+** finds no free slot within half the table is dropped.
+*/
+
+static void	ft_life_insert(const t_life_live *sample)
+{
+	size_t	slot;
+	size_t	probes;
+
+	slot = ft_life_ptr_slot(sample->ptr);
+	probes = 0;
+	while (g_life.live[slot].ptr)
+	{
+		if (++probes == FT_LIFE_MAX_LIVE / 2)
+			return ;
+		slot = (slot + 1) & (FT_LIFE_MAX_LIVE - 1);
+	}
+	g_life.live[slot] = *sample;
+	ft_block_from_data_ptr(sample->ptr)->flags |= FT_BLOCK_LIFE;
+}
+
+/*
+** ft_life_remove()
+**
+** Takes the sample of 'ptr' out of the live table with backward-shift
+** deletion, as the heap profiler does. Returns 0 if 'ptr' had none.
+*/
+
+static int	ft_life_remove(void *ptr, t_life_live *out)
+{
+	size_t	slot;
+	size_t	next;
+	size_t	home;
+
+	slot = ft_life_ptr_slot(ptr);
+	while (g_life.live[slot].ptr && g_life.live[slot].ptr != ptr)
+		slot = (slot + 1) & (FT_LIFE_MAX_LIVE - 1);
+	if (!g_life.live[slot].ptr)
+		return (0);
+	*out = g_life.live[slot];
+	next = (slot + 1) & (FT_LIFE_MAX_LIVE - 1);
+	while (g_life.live[next].ptr)
+	{
+		home = ft_life_ptr_slot(g_life.live[next].ptr);
+		if (((next - home) & (FT_LIFE_MAX_LIVE - 1))
+			>= ((next - slot) & (FT_LIFE_MAX_LIVE - 1)))
+		{
+			g_life.live[slot] = g_life.live[next];
+			slot = next;
+		}
+		next = (next + 1) & (FT_LIFE_MAX_LIVE - 1);
+	}
+	g_life.live[slot].ptr = NULL;
+	return (1);
+}
+
+/*
+** ft_life_on_malloc()
+**
+** A sample from a site that does not own its slot takes the slot over.
+*/
+
+void	ft_life_on_malloc(void *ptr, const void *site, size_t size)
+{
+	t_life_site	*s;
+	t_life_live	sample;
+	size_t		rate;
+
+	g_life.clock += size;
+	rate = ft_conf_get()->life_sample;
+	if (rate == 0 || --g_life.left > 0)
+		return ;
+	g_life.left = ft_life_next_interval(rate);
+	s = &g_life.sites[ft_life_site_slot((uintptr_t)site)];
+	if (s->pc != (uintptr_t)site)
+	{
+		s->pc = (uintptr_t)site;
+		s->score = 0;
+	}
+	sample.ptr = ptr;
+	sample.pc = (uintptr_t)site;
+	sample.birth = g_life.clock;
+	ft_life_insert(&sample);
+}
+
+/*
+** ft_life_score()
+**
+** Credits or debits the site of a sample, if it still owns its slot.
+*/
+
+static void	ft_life_score(uintptr_t pc, uint64_t lifetime)
+{
+	t_life_site	*s;
+
+	s = &g_life.sites[ft_life_site_slot(pc)];
+	if (s->pc != pc)
+		return ;
+	if (lifetime < FT_LIFE_SHORT)
+		s->score += (s->score < FT_LIFE_SCORE_MAX);
+	else
+	{
+		s->score -= FT_LIFE_PENALTY;
+		if (s->score < -FT_LIFE_SCORE_MAX)
+			s->score = -FT_LIFE_SCORE_MAX;
+	}
+}
+
+void	ft_life_on_free(void *ptr)
+{
+	t_life_live	sample;
+
+	if (ft_life_remove(ptr, &sample))
+		ft_life_score(sample.pc, g_life.clock - sample.birth);
+}
+
+/*
+** ft_life_on_move()
+**
+** The sample keeps its site and birth under the new address. A sample
+** _malloc() may just have taken of 'new_ptr' is dropped unscored.
+*/
+
+void	ft_life_on_move(void *old_ptr, void *new_ptr)
+{
+	t_life_live	sample;
+	t_life_live	dropped;
+
+	if (!ft_life_remove(old_ptr, &sample))
+		return ;
+	ft_life_remove(new_ptr, &dropped);
+	sample.ptr = new_ptr;
+	ft_life_insert(&sample);
+}
@@ -17,21 +17,30 @@
 #include "utils.h"
 #include "fit.h"
 #include "align.h"
+#include "prefault.h"
+#include "lock.h"
+#include "stats.h"
+#include "conf.h"
+#include "pagemap.h"
+#include "trim.h"
+#ifdef FT_HEAP_PROFILING
+# include "heap_prof.h"
+#endif
+#ifdef FT_GUARD
+# include "guard.h"
+#endif
+#ifdef FT_LIFETIME
+# include "lifetime.h"
+#endif
+#ifdef MALLOC_LOGGING
+# include "mem_trace.h"
+#endif
 #include <stddef.h>
 
 
 #ifdef USE_MALLOC_LOCK
 
-#include <pthread.h>
-static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-#define MALLOC_PREACTION   pthread_mutex_lock(&g_mutex)
-#define MALLOC_POSTACTION  pthread_mutex_unlock(&g_mutex)
-
-#else
-
-#define MALLOC_PREACTION   (0)
-#define MALLOC_POSTACTION  (0)
+pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 #endif /* USE_MALLOC_LOCK */
 
@@ -52,6 +61,7 @@ static void	ft_free_list_remove(ft_zone_t *zone, ft_block_t *block)
 		block->next_free->prev_free = block->prev_free;
 	block->prev_free = NULL;
 	block->next_free = NULL;
+	ft_stats_free_list(zone, -1);
 }
 
 /*
@@ -68,6 +78,7 @@ static void	ft_free_list_add(ft_zone_t *zone, ft_block_t *block)
 	if (zone->free_head)
 		zone->free_head->prev_free = block;
 	zone->free_head = block;
+	ft_stats_free_list(zone, 1);
 }
 
 /*
@@ -83,6 +94,7 @@ static void	*ft_allocate_from_block(ft_zone_t *zone, ft_block_t *block,
 {
 	ft_block_t		*remainder;
 	void			*user_ptr;
+	ft_class_stats_t	*cs;
 
 	ft_free_list_remove(zone, block);
 #if SHOW_MORE
@@ -93,11 +105,21 @@ static void	*ft_allocate_from_block(ft_zone_t *zone, ft_block_t *block,
 	if (remainder)
 		ft_free_list_add(zone, remainder);
 	block->is_free = 0;
+	block->flags = 0;
 	block->magic = FT_ALLOC_MAGIC;
 	block->zone = zone;
 	user_ptr = ft_block_data_ptr(block);
+	ft_block_set_request(block, user_size);
 	zone->used_size += user_size;
 	zone->block_count++;
+	zone->dirty -= zone->dirty < block->size ? zone->dirty : block->size;
+	ft_stats_alloc(zone, block->size);
+	ft_stats_request(0, user_size);
+	block->size_class = ft_size_class(user_size);
+	cs = ft_class_stats(block->size_class);
+	ft_class_add(&cs->allocs, 1);
+	ft_class_add(&cs->requested, user_size);
+	ft_class_add(&cs->consumed, block->size);
 	return (user_ptr);
 }
 
@@ -108,54 +130,111 @@ static void	*ft_allocate_from_block(ft_zone_t *zone, ft_block_t *block,
 ** Algorithm:
 ** 1. Determine zone type based on size
 ** 2. Calculate total size needed (including all headers and alignment)
-** 3. For TINY/SMALL: try to find existing free block, else create new zone
+** 3. For TINY/SMALL/MEDIUM: try to find existing free block, else create
+**    new zone (in nursery zones when 'site' is predicted short-lived)
 ** 4. For LARGE: always create dedicated zone
 ** 5. Allocate from block and return user pointer
+**
+** 'site' is the return address of the malloc()/realloc() call.
 */
 
-static void	*_malloc(size_t size)
+static void	*_malloc(size_t size, const void *site)
 {
 	uint8_t		type;
 	size_t		alloc_size;
 	ft_zone_t	*zone;
 	ft_block_t	*block;
+	void		*user_ptr;
+	int			nursery;
 
 	if (size == 0)
 		return (NULL);
 	type = ft_zone_get_type(size);
 	alloc_size = ft_calculate_alloc_size(size); // block header + alloc header + size
-	if (type == FT_ZONE_LARGE)
+	nursery = 0;
+	block = NULL;
+	if (type != FT_ZONE_LARGE)
 	{
-		zone = ft_zone_create(type, alloc_size);
-		if (!zone)
-			return (NULL);
-		block = zone->first_block;
-		return (ft_allocate_from_block(zone, block, alloc_size, size));
+#ifdef FT_LIFETIME
+		nursery = ft_life_nursery(site);
+#endif
+		block = ft_first_fit(type, alloc_size, nursery, &zone);
 	}
-	block = ft_first_fit(type, alloc_size, &zone);
-	if (!block)
+	if (block)
+		ft_prefault_reuse(ft_block_start(block), alloc_size);
+	else
 	{
-		zone = ft_zone_create(type, 0);
+		zone = ft_zone_create(type,
+				type == FT_ZONE_LARGE ? alloc_size : 0);
 		if (!zone)
 			return (NULL);
+		zone->nursery = (uint8_t)nursery;
 		block = zone->first_block;
 	}
-	return (ft_allocate_from_block(zone, block, alloc_size, size));
+	user_ptr = ft_allocate_from_block(zone, block, alloc_size, size);
+#ifdef FT_LIFETIME
+	ft_life_on_malloc(user_ptr, site, size);
+#else
+	(void)site;
+#endif
+	return (user_ptr);
 }
 
 void	*malloc(size_t size)
 {
 	void *user_ptr;
+#ifdef FT_HEAP_PROFILING
+	ft_prof_trace_t	trace;
+#endif
 
+#ifdef FT_GUARD
+	user_ptr = ft_guard_malloc(size);
+	if (user_ptr)
+		return (user_ptr);
+#endif
+#ifdef FT_HEAP_PROFILING
+	ft_prof_capture(size, &trace);
+#endif
 	if (MALLOC_PREACTION != 0) {
     return 0;
   }
-  user_ptr = _malloc(size);
+  user_ptr = _malloc(size, __builtin_return_address(0));
+#ifdef FT_HEAP_PROFILING
+	if (user_ptr)
+		ft_prof_record(user_ptr, size, &trace);
+#endif
+#ifdef MALLOC_LOGGING
+	if (user_ptr)
+		mem_trace_op(FT_TRACE_MALLOC, user_ptr, NULL);
+#endif
   if (MALLOC_POSTACTION != 0) {
   }
 	return user_ptr;
 }
 
+/*
+** ft_owned_block()
+**
+** Returns the live block of a user pointer, or NULL when it is not the
+** start of a live allocation. The page map vouches for the zone first, so
+** the header in front of 'ptr' is only read when it lies inside the zone.
+*/
+
+static ft_block_t	*ft_owned_block(void *ptr)
+{
+	ft_zone_t	*zone;
+	ft_block_t	*block;
+
+	zone = ft_pagemap_get(ptr);
+	if (!zone || (uintptr_t)ptr < (uintptr_t)zone + FT_ZONE_HDR_SIZE
+		+ FT_BLOCK_HDR_SIZE)
+		return (NULL);
+	block = ft_block_from_data_ptr(ptr);
+	if (!ft_block_is_valid(block) || block->zone != zone)
+		return (NULL);
+	return (block);
+}
+
 /*
 ** ft_coalesce_blocks()
 **
@@ -185,39 +264,78 @@ static void	ft_coalesce_blocks(ft_zone_t *zone, ft_block_t *block)
 **
 ** Frees previously allocated memory.
 ** Algorithm:
-** 1. Validate pointer using allocation header magic number
+** 1. Validate pointer: its zone comes from the page map, then the
+**    allocation header magic number catches double frees
 ** 2. Mark block as free and add to free list
 ** 3. Coalesce with adjacent free blocks
-** 4. If zone becomes empty, unmap it (all zone types)
+** 4. If zone becomes empty, unmap it (LARGE zones always, MEDIUM and
+**    nursery zones when another one is already empty, any zone once empty
+**    zones hold more than the trim threshold)
+** _free() returns 1 once a block was freed, 0 for NULL or a pointer that
+** fails validation.
 */
 
-static void	_free(void *ptr)
+static int	_free(void *ptr)
 {
 	ft_block_t		*block;
 	ft_zone_t		*zone;
 
 	if (!ptr)
-		return ;
-	block = ft_block_from_data_ptr(ptr);
-	if (!ft_block_is_valid(block))
-		return ;
+		return (0);
+	block = ft_owned_block(ptr);
+	if (!block)
+		return (0);
 	block->magic = 0;
 	zone = (ft_zone_t *)block->zone;
 	block->is_free = 1;
 	ft_free_list_add(zone, block);
-	zone->used_size -= block->size;
+	zone->used_size -= ft_block_requested(block);
 	zone->block_count--;
+	zone->dirty += block->size;
+	zone->decay_epoch = g_decay_epoch;
+	ft_stats_free(zone, block->size);
+	ft_stats_request(ft_block_requested(block), 0);
+	ft_class_add(&ft_class_stats(block->size_class)->frees, 1);
+#ifdef FT_HEAP_PROFILING
+	if (block->flags & FT_BLOCK_SAMPLED)
+		ft_prof_on_free(ptr);
+#endif
+#ifdef FT_LIFETIME
+	if (block->flags & FT_BLOCK_LIFE)
+		ft_life_on_free(ptr);
+#endif
 	ft_coalesce_blocks(zone, block);
-	if (zone->block_count == 0 && zone->type == FT_ZONE_LARGE)
+	if (zone->block_count == 0 && (zone->type == FT_ZONE_LARGE
+		|| g_ft_stats.empty_bytes > ft_conf_get()->trim_threshold
+		|| ((zone->type == FT_ZONE_MEDIUM || zone->nursery)
+			&& ft_zone_has_spare(zone))))
 		ft_zone_remove(zone);
+	return (1);
 }
 
 void	free(void *ptr)
 {
+#ifdef FT_GUARD
+	if (ft_guard_owns(ptr))
+	{
+		ft_guard_free(ptr);
+		return ;
+	}
+#endif
+	if (ptr && !ft_pagemap_get(ptr))
+	{
+		ft_foreign_free(ptr);
+		return ;
+	}
 	if (MALLOC_PREACTION != 0) {
     return;
   }
+#ifdef MALLOC_LOGGING
+	if (_free(ptr))
+		mem_trace_op(FT_TRACE_FREE, NULL, ptr);
+#else
 	_free(ptr);
+#endif
   if (MALLOC_POSTACTION != 0) {
   }
 }
@@ -247,10 +365,12 @@ static int	ft_try_extend_in_place(ft_block_t *block, ft_zone_t *zone,
 	ft_block_t	*next;
 	size_t		available;
 	ft_block_t	*remainder;
+	size_t		old_size;
 
 	next = block->next;
 	if (!next || !next->is_free)
 		return (0);
+	old_size = block->size;
 	available = block->size + next->size;
 	if (available < needed_size)
 		return (0);
@@ -263,9 +383,29 @@ static int	ft_try_extend_in_place(ft_block_t *block, ft_zone_t *zone,
 #endif
 	if (remainder)
 		ft_free_list_add(zone, remainder);
+	ft_stats_grow(zone, old_size, block->size);
 	return (1);
 }
 
+/*
+** ft_realloc_in_place()
+**
+** Records the new requested size of a block realloc() kept in place.
+*/
+
+static void	ft_realloc_in_place(ft_block_t *block, size_t old_request,
+	size_t size)
+{
+	ft_zone_t	*zone;
+
+	zone = (ft_zone_t *)block->zone;
+	ft_block_set_request(block, size);
+	zone->used_size += size;
+	zone->used_size -= old_request;
+	ft_stats_request(old_request, size);
+	ft_class_add(&ft_class_stats(block->size_class)->realloc_hits, 1);
+}
+
 /*
 ** realloc()
 **
@@ -278,25 +418,28 @@ static int	ft_try_extend_in_place(ft_block_t *block, ft_zone_t *zone,
 ** 5. If that fails: allocate new block, copy data, free old block
 */
 
-static void *_realloc(void *ptr, size_t size) {
+static void *_realloc(void *ptr, size_t size, const void *site) {
 	ft_block_t 		*block;
 	void			*new_ptr;
 	size_t			copy_size;
 	size_t			needed_alloc_size;
+	size_t			old_request;
 
 	if (!ptr)
-		return (_malloc(size));
+		return (_malloc(size, site));
 	if (size == 0)
 	{
 		_free(ptr);
 		return (NULL);
 	}
-	block = ft_block_from_data_ptr(ptr);
-	if (!ft_block_is_valid(block))
+	block = ft_owned_block(ptr);
+	if (!block)
 		return (NULL);
 	needed_alloc_size = ft_calculate_alloc_size(size);
+	old_request = ft_block_requested(block);
 	if (block->size >= needed_alloc_size)
 	{
+		ft_realloc_in_place(block, old_request, size);
 		return (ptr);
 	}
 #if SHOW_MORE
@@ -307,26 +450,64 @@ static void *_realloc(void *ptr, size_t size) {
 		(ft_zone_t *)block->zone, needed_alloc_size))
 #endif
 	{
-		((ft_zone_t *)block->zone)->used_size += (size - block->size);
+		ft_realloc_in_place(block, old_request, size);
 		return (ptr);
 	}
-	new_ptr = _malloc(size);
+	ft_class_add(&ft_class_stats(block->size_class)->realloc_misses, 1);
+	new_ptr = _malloc(size, site);
 	if (!new_ptr)
 		return (NULL);
-	copy_size = block->size < size ? block->size : size;
+	copy_size = block->size - FT_BLOCK_HDR_SIZE;
+	if (copy_size > size)
+		copy_size = size;
 	ft_memcpy(new_ptr, ptr, copy_size);
+#ifdef FT_LIFETIME
+	if (block->flags & FT_BLOCK_LIFE)
+	{
+		ft_life_on_move(ptr, new_ptr);
+		block->flags &= ~FT_BLOCK_LIFE;
+	}
+#endif
 	_free(ptr);
 	return (new_ptr);
 }
 
 void	*realloc(void *ptr, size_t size)
 {
+	void	*new_ptr;
+#ifdef FT_HEAP_PROFILING
+	ft_prof_trace_t	trace;
+#endif
+#ifdef MALLOC_LOGGING
+	int		freed;
+#endif
+
+#ifdef FT_GUARD
+	if (ft_guard_owns(ptr))
+		return (ft_guard_realloc(ptr, size));
+#endif
+	if (ptr && !ft_pagemap_get(ptr))
+		return (ft_foreign_realloc(ptr, size));
+#ifdef FT_HEAP_PROFILING
+	ft_prof_capture(size, &trace);
+#endif
 	if (MALLOC_PREACTION != 0) {
     return 0;
   }
-  ptr = _realloc(ptr, size);
+#ifdef MALLOC_LOGGING
+	freed = (ptr && size == 0 && ft_owned_block(ptr));
+#endif
+  new_ptr = _realloc(ptr, size, __builtin_return_address(0));
+#ifdef FT_HEAP_PROFILING
+	if (new_ptr && new_ptr != ptr)
+		ft_prof_record(new_ptr, size, &trace);
+#endif
+#ifdef MALLOC_LOGGING
+	if (new_ptr || freed)
+		mem_trace_op(FT_TRACE_REALLOC, new_ptr, ptr);
+#endif
   if (MALLOC_POSTACTION != 0) {
   }
-  return ptr;
+  return new_ptr;
 }
 
@@ -2,13 +2,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 #include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
 
 #include "zone.h"
 #include "block.h"
 #include "alloc_hdr.h"
 #include "mem_logger.h"
+#include "mem_trace.h"
 
 /*
 ** Make absolutely sure that inside this file,
@@ -26,7 +30,9 @@
 
 static uint64_t g_snapshot_count = 0;
 static uint64_t g_start_time_us = 0;
-static int      g_logging_active = 0;
+/* Per thread: set while a wrapper dumps, so nested calls do not log */
+static __thread int g_logging_active
+	__attribute__((tls_model("initial-exec")));
 
 /* ----------------------------------------------- */
 /* timestamp                                        */
@@ -34,11 +40,11 @@ static int      g_logging_active = 0;
 
 static uint64_t get_timestamp_us(void)
 {
-	struct timeval tv;
+	struct timespec ts;
 	uint64_t now;
 
-	gettimeofday(&tv, NULL);
-	now = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
 
 	if (g_start_time_us == 0)
 		g_start_time_us = now;
@@ -85,10 +91,16 @@ static const char *zone_type_str(uint8_t type)
 {
 	if (type == FT_ZONE_TINY)  return "TINY";
 	if (type == FT_ZONE_SMALL) return "SMALL";
+	if (type == FT_ZONE_MEDIUM) return "MEDIUM";
 	if (type == FT_ZONE_LARGE) return "LARGE";
 	return "UNKNOWN";
 }
 
+/*
+** Zones are reported from their header, which sits 'color' bytes into the
+** mapping: their size stops at the end of the mapping.
+*/
+
 static void dump_zone(FILE *f, ft_zone_t *zone, int *first_zone)
 {
 	ft_block_t *block;
@@ -101,7 +113,8 @@ static void dump_zone(FILE *f, ft_zone_t *zone, int *first_zone)
 	fprintf(f, "    {\n");
 	fprintf(f, "      \"type\": \"%s\",\n", zone_type_str(zone->type));
 	fprintf(f, "      \"address\": \"%p\",\n", (void *)zone);
-	fprintf(f, "      \"total_size\": %zu,\n", zone->total_size);
+	fprintf(f, "      \"total_size\": %zu,\n",
+		zone->total_size - zone->color);
 	fprintf(f, "      \"used_size\": %zu,\n", zone->used_size);
 	fprintf(f, "      \"block_count\": %zu,\n", zone->block_count);
 	fprintf(f, "      \"allocations\": [\n");
@@ -139,12 +152,400 @@ static void dump_zones(FILE *f)
 	zone = g_zone_mgr.small_zones;
 	while (zone) { dump_zone(f, zone, &first); zone = zone->next; }
 
+	zone = g_zone_mgr.medium_zones;
+	while (zone) { dump_zone(f, zone, &first); zone = zone->next; }
+
 	zone = g_zone_mgr.large_zones;
 	while (zone) { dump_zone(f, zone, &first); zone = zone->next; }
 
 	fprintf(f, "\n  ]\n");
 }
 
+/* ----------------------------------------------- */
+/* Delta format (MALLOC_LOG_FORMAT=delta)           */
+/* ----------------------------------------------- */
+
+/*
+** Instead of the whole heap, each snapshot only lists what changed since
+** the previous one:
+**
+**   "delta": true,
+**   "zones_set":      zones created or whose counters changed
+**                     (every field but "allocations")
+**   "zones_removed":  ["0x..."]
+**   "allocs_set":     [{"zone", "address", "size"[, "from"]}] - new or
+**                     resized blocks; "from" is the previous zone when a
+**                     block address now belongs to another zone
+**   "allocs_removed": [{"zone", "address"}]
+**
+** Every MALLOC_LOG_KEYFRAME snapshots (default 64) a full snapshot is
+** written instead, so a reader can start from any keyframe.
+**
+** The state of the previous snapshot is kept in two hash tables mapped
+** with mmap(), never with malloc(). Each entry remembers the last
+** snapshot that saw it; entries not seen by the current walk are the
+** removals.
+*/
+
+#define LOG_DELTA_KEYFRAME 64
+#define LOG_EMPTY ((uintptr_t)0)
+#define LOG_TOMB  ((uintptr_t)1)
+
+typedef struct s_log_entry
+{
+	uintptr_t key;    /* zone or user address, LOG_EMPTY or LOG_TOMB */
+	uint64_t  epoch;  /* last snapshot that saw the entry, 0 = new */
+	size_t    a;      /* zone: total_size  - alloc: block size */
+	size_t    b;      /* zone: used_size   - alloc: zone address */
+	size_t    c;      /* zone: block_count - alloc: unused */
+	uint8_t   type;   /* zone: FT_ZONE_* */
+} t_log_entry;
+
+typedef struct s_log_table
+{
+	t_log_entry *slots;
+	size_t      cap;   /* power of two */
+	size_t      used;  /* live entries and tombstones */
+} t_log_table;
+
+static int         g_log_format = -1; /* 0: json, 1: delta */
+static uint64_t    g_keyframe_every = LOG_DELTA_KEYFRAME;
+static t_log_table g_prev_zones = {NULL, 0, 0};
+static t_log_table g_prev_allocs = {NULL, 0, 0};
+
+static int get_log_format(void)
+{
+	const char *fmt;
+	const char *k;
+
+	if (g_log_format >= 0)
+		return g_log_format;
+	fmt = getenv(FT_TRACE_FORMAT_ENV);
+	g_log_format = (fmt && strcmp(fmt, "delta") == 0);
+	k = getenv("MALLOC_LOG_KEYFRAME");
+	if (k && strtoull(k, NULL, 10) > 0)
+		g_keyframe_every = strtoull(k, NULL, 10);
+	return g_log_format;
+}
+
+static size_t log_hash(uintptr_t key, size_t cap)
+{
+	uint64_t h = (uint64_t)key;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return (size_t)h & (cap - 1);
+}
+
+/*
+** Rehashes into a table twice as large (or the same size when most used
+** slots are tombstones). Returns -1 if mmap() fails.
+*/
+
+static int log_table_grow(t_log_table *t)
+{
+	t_log_table old = *t;
+	size_t      live = 0;
+	size_t      i;
+	size_t      j;
+
+	i = 0;
+	while (i < old.cap)
+	{
+		if (old.slots[i].key > LOG_TOMB)
+			live++;
+		i++;
+	}
+	t->cap = old.cap ? old.cap : 1024;
+	while ((live + 1) * 2 > t->cap)
+		t->cap *= 2;
+	t->slots = mmap(NULL, t->cap * sizeof(t_log_entry),
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (t->slots == MAP_FAILED)
+	{
+		*t = old;
+		return -1;
+	}
+	t->used = live;
+	i = 0;
+	while (i < old.cap)
+	{
+		if (old.slots[i].key > LOG_TOMB)
+		{
+			j = log_hash(old.slots[i].key, t->cap);
+			while (t->slots[j].key != LOG_EMPTY)
+				j = (j + 1) & (t->cap - 1);
+			t->slots[j] = old.slots[i];
+		}
+		i++;
+	}
+	if (old.slots)
+		munmap(old.slots, old.cap * sizeof(t_log_entry));
+	return 0;
+}
+
+/*
+** Returns the entry for key, inserting a new one (epoch 0) if needed.
+*/
+
+static t_log_entry *log_table_get(t_log_table *t, uintptr_t key)
+{
+	t_log_entry *tomb = NULL;
+	size_t      i;
+
+	if ((t->used + 1) * 4 > t->cap * 3 && log_table_grow(t) != 0)
+		return NULL;
+	i = log_hash(key, t->cap);
+	while (t->slots[i].key != LOG_EMPTY)
+	{
+		if (t->slots[i].key == key)
+			return &t->slots[i];
+		if (t->slots[i].key == LOG_TOMB && !tomb)
+			tomb = &t->slots[i];
+		i = (i + 1) & (t->cap - 1);
+	}
+	if (!tomb)
+	{
+		tomb = &t->slots[i];
+		t->used++;
+	}
+	memset(tomb, 0, sizeof(*tomb));
+	tomb->key = key;
+	return tomb;
+}
+
+/*
+** One pass per output list. f == NULL only updates the tables (used
+** after a keyframe).
+*/
+
+static void delta_list_open(FILE *f, const char *name, int *first)
+{
+	if (f)
+		fprintf(f, ",\n  \"%s\": [", name);
+	*first = 1;
+}
+
+static void delta_list_sep(FILE *f, int *first)
+{
+	fprintf(f, "%s\n    ", *first ? "" : ",");
+	*first = 0;
+}
+
+static void delta_list_close(FILE *f, int first)
+{
+	if (f)
+		fprintf(f, "%s]", first ? "" : "\n  ");
+}
+
+static void delta_zones_set(FILE *f, ft_zone_t *zone, uint64_t epoch,
+		int *first)
+{
+	t_log_entry *e;
+
+	while (zone)
+	{
+		e = log_table_get(&g_prev_zones, (uintptr_t)zone);
+		if (e && f && (e->epoch == 0 || e->type != zone->type
+				|| e->a != zone->total_size || e->b != zone->used_size
+				|| e->c != zone->block_count))
+		{
+			delta_list_sep(f, first);
+			fprintf(f, "{\"type\": \"%s\", \"address\": \"%p\", "
+					"\"total_size\": %zu, \"used_size\": %zu, "
+					"\"block_count\": %zu}", zone_type_str(zone->type),
+					(void *)zone, zone->total_size - zone->color, zone->used_size,
+					zone->block_count);
+		}
+		if (e)
+		{
+			e->epoch = epoch;
+			e->type = zone->type;
+			e->a = zone->total_size;
+			e->b = zone->used_size;
+			e->c = zone->block_count;
+		}
+		zone = zone->next;
+	}
+}
+
+static void delta_alloc_set(FILE *f, ft_zone_t *zone, ft_block_t *block,
+		uint64_t epoch, int *first)
+{
+	t_log_entry *e;
+	void        *ptr;
+
+	ptr = ft_block_data_ptr(block);
+	e = log_table_get(&g_prev_allocs, (uintptr_t)ptr);
+	if (!e)
+		return;
+	if (f && (e->epoch == 0 || e->a != block->size
+			|| e->b != (size_t)(uintptr_t)zone))
+	{
+		delta_list_sep(f, first);
+		fprintf(f, "{\"zone\": \"%p\", \"address\": \"%p\", \"size\": %zu",
+				(void *)zone, ptr, block->size);
+		if (e->epoch != 0 && e->b != (size_t)(uintptr_t)zone)
+			fprintf(f, ", \"from\": \"%p\"", (void *)e->b);
+		fprintf(f, "}");
+	}
+	e->epoch = epoch;
+	e->a = block->size;
+	e->b = (size_t)(uintptr_t)zone;
+}
+
+static void delta_allocs_set(FILE *f, ft_zone_t *zone, uint64_t epoch,
+		int *first)
+{
+	ft_block_t *block;
+
+	while (zone)
+	{
+		block = zone->first_block;
+		while (block)
+		{
+			if (!block->is_free)
+				delta_alloc_set(f, zone, block, epoch, first);
+			block = block->next;
+		}
+		zone = zone->next;
+	}
+}
+
+/*
+** Entries the walk did not see are gone: report and drop them.
+*/
+
+static void delta_removed(FILE *f, t_log_table *t, uint64_t epoch,
+		int allocs, int *first)
+{
+	size_t i;
+
+	i = 0;
+	while (i < t->cap)
+	{
+		if (t->slots[i].key <= LOG_TOMB || t->slots[i].epoch == epoch)
+		{
+			i++;
+			continue;
+		}
+		if (f)
+		{
+			delta_list_sep(f, first);
+			if (allocs)
+				fprintf(f, "{\"zone\": \"%p\", \"address\": \"%p\"}",
+						(void *)t->slots[i].b, (void *)t->slots[i].key);
+			else
+				fprintf(f, "\"%p\"", (void *)t->slots[i].key);
+		}
+		t->slots[i++].key = LOG_TOMB;
+	}
+}
+
+static void dump_delta(FILE *f, uint64_t epoch)
+{
+	ft_zone_t *lists[FT_ZONE_TYPES];
+	int       first;
+	int       i;
+
+	lists[0] = g_zone_mgr.tiny_zones;
+	lists[1] = g_zone_mgr.small_zones;
+	lists[2] = g_zone_mgr.medium_zones;
+	lists[3] = g_zone_mgr.large_zones;
+	if (f)
+		fprintf(f, "  \"delta\": true");
+	delta_list_open(f, "zones_set", &first);
+	i = 0;
+	while (i < FT_ZONE_TYPES)
+		delta_zones_set(f, lists[i++], epoch, &first);
+	delta_list_close(f, first);
+	delta_list_open(f, "zones_removed", &first);
+	delta_removed(f, &g_prev_zones, epoch, 0, &first);
+	delta_list_close(f, first);
+	delta_list_open(f, "allocs_set", &first);
+	i = 0;
+	while (i < FT_ZONE_TYPES)
+		delta_allocs_set(f, lists[i++], epoch, &first);
+	delta_list_close(f, first);
+	delta_list_open(f, "allocs_removed", &first);
+	delta_removed(f, &g_prev_allocs, epoch, 1, &first);
+	delta_list_close(f, first);
+	if (f)
+		fprintf(f, "\n");
+}
+
+/* ----------------------------------------------- */
+/* Snapshot index (MALLOC_LOG_INDEX=1)              */
+/* ----------------------------------------------- */
+
+/*
+** Offsets are collected in an mmap()ed array, doubled when full, and
+** written after the last snapshot when the process exits.
+*/
+
+static int       g_log_index = -1;
+static uint64_t  *g_index = NULL;
+static size_t    g_index_cap = 0;
+
+static int log_index_enabled(void)
+{
+	const char *v;
+
+	if (g_log_index < 0)
+	{
+		v = getenv(FT_LOG_INDEX_ENV);
+		g_log_index = (v && *v && strcmp(v, "0") != 0);
+	}
+	return g_log_index;
+}
+
+static void log_index_add(uint64_t id, uint64_t entry)
+{
+	uint64_t *grown;
+	size_t   cap;
+
+	if (id >= g_index_cap)
+	{
+		cap = g_index_cap ? g_index_cap * 2 : 4096;
+		grown = mmap(NULL, cap * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (grown == MAP_FAILED)
+		{
+			g_log_index = 0;
+			return;
+		}
+		if (g_index)
+		{
+			memcpy(grown, g_index, g_index_cap * sizeof(uint64_t));
+			munmap(g_index, g_index_cap * sizeof(uint64_t));
+		}
+		g_index = grown;
+		g_index_cap = cap;
+	}
+	g_index[id] = entry;
+}
+
+__attribute__((destructor))
+static void log_index_write(void)
+{
+	ft_log_index_trailer_t trailer;
+	FILE                   *f;
+
+	if (g_log_index != 1 || g_snapshot_count == 0)
+		return;
+	f = fopen(get_log_filename(), "a");
+	if (!f)
+		return;
+	fseek(f, 0, SEEK_END);
+	memcpy(trailer.magic, FT_LOG_INDEX_MAGIC, sizeof(trailer.magic));
+	trailer.count = g_snapshot_count;
+	trailer.index_offset = (uint64_t)ftell(f);
+	fwrite(g_index, sizeof(uint64_t), g_snapshot_count, f);
+	fwrite(&trailer, sizeof(trailer), 1, f);
+	fclose(f);
+}
+
 /* ----------------------------------------------- */
 /* Public function                                 */
 /* ----------------------------------------------- */
@@ -152,19 +553,41 @@ static void dump_zones(FILE *f)
 void mem_logger_dump(void)
 {
 	FILE *f;
-	const char *filename = get_log_filename();
+	const char *filename;
+	uint64_t id;
+	int keyframe;
 
-	f = fopen(filename, "a");
+	/* The binary trace records every operation from inside the allocator */
+	if (mem_trace_enabled())
+		return;
+	filename = get_log_filename();
+	/* An index only describes this run: start from an empty file */
+	f = fopen(filename, (log_index_enabled() && g_snapshot_count == 0)
+			? "w" : "a");
 	if (!f)
 			return;
 
+	id = g_snapshot_count++;
+	keyframe = !(get_log_format() == 1 && id % g_keyframe_every != 0);
+	if (log_index_enabled())
+	{
+		fseek(f, 0, SEEK_END);
+		log_index_add(id, (uint64_t)ftell(f)
+				| (keyframe ? FT_LOG_INDEX_KEYFRAME : 0));
+	}
 	fprintf(f, "{\n");
-	fprintf(f, "  \"snapshot_id\": %llu,\n",
-					(unsigned long long)g_snapshot_count++);
+	fprintf(f, "  \"snapshot_id\": %llu,\n", (unsigned long long)id);
 	fprintf(f, "  \"timestamp_us\": %llu,\n",
 					(unsigned long long)get_timestamp_us());
 
-	dump_zones(f);
+	if (!keyframe)
+		dump_delta(f, id + 1);
+	else
+	{
+		dump_zones(f);
+		if (get_log_format() == 1)
+			dump_delta(NULL, id + 1);
+	}
 
 	fprintf(f, "}\n");
 	fclose(f);
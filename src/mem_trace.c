@@ -0,0 +1,497 @@
+#define _GNU_SOURCE
+#include "mem_trace.h"
+#include "zone.h"
+#include "block.h"
+#include "lock.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+** Trace state
+**
+** Synchronous mode: everything below is only touched under the allocator
+** lock, so a single buffer is shared by all threads.
+** Async mode: threads only write their own ring; the buffer belongs to
+** the drain thread.
+** Nothing in this file may call malloc().
+*/
+
+typedef struct s_trace
+{
+	int			state;		/* 0: not initialised, 1: tracing, 2: off */
+	int			async;		/* MALLOC_LOG_FORMAT=async */
+	int			closing;	/* Exit started: records are written at once */
+	int			fd;
+	size_t		used;		/* Bytes buffered */
+	uint64_t	start_ns;
+	uint8_t		buf[FT_TRACE_BUF_SIZE];
+}	t_trace;
+
+static t_trace	g_trace = {0, 0, 0, -1, 0, 0, {0}};
+
+static __thread uint32_t	t_trace_tid
+	__attribute__((tls_model("initial-exec")));
+
+/*
+** t_trace_ring - Single-producer single-consumer ring of one thread
+**
+** The owner thread only writes 'head' (release) and 'dropped'; the drain
+** thread only writes 'tail' (release). They live on separate cache lines.
+** A ring is handed to a new thread once its owner exited and it is empty.
+*/
+
+typedef struct s_trace_ring
+{
+	uint64_t				head;
+	uint8_t					pad0[56];
+	uint64_t				tail;
+	uint8_t					pad1[56];
+	uint64_t				dropped;	/* Events lost, owner side */
+	uint64_t				reported;	/* Already written as DROPPED */
+	uint32_t				tid;
+	int						owned;		/* 1 while a thread uses it */
+	struct s_trace_ring		*next;		/* All rings, never unlinked */
+	ft_trace_rec_t			recs[FT_TRACE_RING_SIZE];
+}	t_trace_ring;
+
+static t_trace_ring		*g_trace_rings = NULL;
+static pthread_t		g_trace_drain;
+static int				g_trace_drain_started = 0;
+static int				g_trace_stop = 0;
+static pthread_key_t	g_trace_key;
+static int				g_trace_key_ok = 0;
+
+static __thread t_trace_ring	*t_trace_own
+	__attribute__((tls_model("initial-exec")));
+static __thread int				t_trace_exited
+	__attribute__((tls_model("initial-exec")));
+
+static uint64_t	mem_trace_now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+}
+
+/*
+** mem_trace_write_all()
+**
+** write() until everything is out or an error occurs. On error tracing
+** stops: there is no one to report it to from inside malloc().
+*/
+
+static void	mem_trace_write_all(const uint8_t *p, size_t len)
+{
+	ssize_t	ret;
+
+	while (len)
+	{
+		ret = write(g_trace.fd, p, len);
+		if (ret <= 0)
+		{
+			close(g_trace.fd);
+			g_trace.fd = -1;
+			g_trace.state = 2;
+			return ;
+		}
+		p += ret;
+		len -= (size_t)ret;
+	}
+}
+
+/*
+** mem_trace_default_name()
+**
+** Builds "malloc_trace_<pid>.bin" without stdio.
+*/
+
+static void	mem_trace_default_name(char *out, size_t cap)
+{
+	static const char	prefix[] = "malloc_trace_";
+	static const char	suffix[] = ".bin";
+	char				digits[24];
+	size_t				n;
+	size_t				i;
+	unsigned long		pid;
+
+	pid = (unsigned long)getpid();
+	n = 0;
+	while (pid || n == 0)
+	{
+		digits[n++] = (char)('0' + pid % 10);
+		pid /= 10;
+	}
+	i = 0;
+	while (prefix[i] && i < cap - 1)
+	{
+		out[i] = prefix[i];
+		i++;
+	}
+	while (n && i < cap - 1)
+		out[i++] = digits[--n];
+	n = 0;
+	while (suffix[n] && i < cap - 1)
+		out[i++] = suffix[n++];
+	out[i] = '\0';
+}
+
+/*
+** mem_trace_init()
+**
+** Reads MALLOC_LOG_FORMAT and, for "binary" or "async", creates the trace
+** file (MALLOC_LOG, shared with the JSON logger) and writes its header.
+*/
+
+static void	mem_trace_init(void)
+{
+	const char		*fmt;
+	const char		*name;
+	char			def[64];
+	ft_trace_hdr_t	hdr;
+	size_t			i;
+
+	g_trace.state = 2;
+	fmt = getenv(FT_TRACE_FORMAT_ENV);
+	if (!fmt)
+		return ;
+	if (fmt[0] == 'a' && fmt[1] == 's' && fmt[2] == 'y')
+		g_trace.async = 1;
+	else if (fmt[0] != 'b' || fmt[1] != 'i' || fmt[2] != 'n')
+		return ;
+	name = getenv("MALLOC_LOG");
+	if (!name || !*name)
+	{
+		mem_trace_default_name(def, sizeof(def));
+		name = def;
+	}
+	g_trace.fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND
+		| O_CLOEXEC, 0644);
+	if (g_trace.fd < 0)
+		return ;
+	g_trace.state = 1;
+	g_trace.start_ns = mem_trace_now();
+	i = 0;
+	while (i < sizeof(hdr.magic))
+	{
+		hdr.magic[i] = FT_TRACE_MAGIC[i];
+		i++;
+	}
+	hdr.version = FT_TRACE_VERSION;
+	hdr.record_size = sizeof(ft_trace_rec_t);
+	hdr.start_ns = g_trace.start_ns;
+	hdr.pid = (uint64_t)getpid();
+	mem_trace_write_all((const uint8_t *)&hdr, sizeof(hdr));
+}
+
+int	mem_trace_enabled(void)
+{
+	if (g_trace.state == 0)
+		mem_trace_init();
+	return (g_trace.state == 1);
+}
+
+/*
+** mem_trace_ring_claim()
+**
+** Gives the calling thread a ring: an empty one left by an exited thread,
+** or a new one pushed on the list. NULL if mmap() fails.
+*/
+
+static t_trace_ring	*mem_trace_ring_claim(void)
+{
+	t_trace_ring	*ring;
+	int				expected;
+
+	ring = __atomic_load_n(&g_trace_rings, __ATOMIC_ACQUIRE);
+	while (ring)
+	{
+		expected = 0;
+		if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ring->head
+			&& __atomic_compare_exchange_n(&ring->owned, &expected, 1, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			break ;
+		ring = ring->next;
+	}
+	if (!ring)
+	{
+		ring = mmap(NULL, sizeof(t_trace_ring), PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ring == MAP_FAILED)
+			return (NULL);
+		ring->owned = 1;
+		ring->next = __atomic_load_n(&g_trace_rings, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&g_trace_rings, &ring->next, ring,
+				1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+	}
+	ring->tid = t_trace_tid;
+	if (g_trace_key_ok)
+		pthread_setspecific(g_trace_key, ring);
+	t_trace_own = ring;
+	return (ring);
+}
+
+/*
+** mem_trace_ring_release()
+**
+** Thread exit: the ring is left for the drain thread to empty, then for
+** another thread to reuse. What the thread frees after this point is not
+** recorded, since the ring may already have a new owner.
+*/
+
+static void	mem_trace_ring_release(void *arg)
+{
+	t_trace_ring	*ring;
+
+	ring = (t_trace_ring *)arg;
+	t_trace_own = NULL;
+	t_trace_exited = 1;
+	__atomic_store_n(&ring->owned, 0, __ATOMIC_RELEASE);
+}
+
+/*
+** mem_trace_ring_push()
+**
+** Lock-free fast path of async mode. Never blocks: a full ring drops the
+** event.
+*/
+
+static void	mem_trace_ring_push(const ft_trace_rec_t *rec)
+{
+	t_trace_ring	*ring;
+	uint64_t		head;
+
+	ring = t_trace_own;
+	if (!ring && !t_trace_exited)
+		ring = mem_trace_ring_claim();
+	if (!ring)
+		return ;
+	head = ring->head;
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)
+		>= FT_TRACE_RING_SIZE)
+	{
+		__atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+		return ;
+	}
+	ring->recs[head & (FT_TRACE_RING_SIZE - 1)] = *rec;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+** mem_trace_append()
+**
+** Fills the common fields and buffers the record.
+*/
+
+static void	mem_trace_append(ft_trace_rec_t *rec)
+{
+	if (t_trace_tid == 0)
+		t_trace_tid = (uint32_t)syscall(SYS_gettid);
+	rec->reserved = 0;
+	rec->tid = t_trace_tid;
+	rec->ts_ns = mem_trace_now();
+	if (g_trace.async)
+	{
+		mem_trace_ring_push(rec);
+		return ;
+	}
+	if (g_trace.used + sizeof(*rec) > sizeof(g_trace.buf))
+		mem_trace_flush();
+	if (g_trace.state != 1)
+		return ;
+	*(ft_trace_rec_t *)(g_trace.buf + g_trace.used) = *rec;
+	g_trace.used += sizeof(*rec);
+	if (g_trace.closing)
+		mem_trace_flush();
+}
+
+void	mem_trace_op(uint8_t op, void *ptr, void *old_ptr)
+{
+	ft_trace_rec_t	rec;
+	ft_block_t		*block;
+	ft_zone_t		*zone;
+
+	if (!mem_trace_enabled())
+		return ;
+	rec.op = op;
+	rec.ptr = (uint64_t)(uintptr_t)ptr;
+	rec.old_ptr = (uint64_t)(uintptr_t)old_ptr;
+	rec.size = 0;
+	rec.zone = 0;
+	rec.zone_type = 0;
+	if (ptr)
+	{
+		block = ft_block_from_data_ptr(ptr);
+		zone = (ft_zone_t *)block->zone;
+		rec.size = block->size;
+		rec.zone = (uint64_t)(uintptr_t)zone;
+		rec.zone_type = zone->type;
+	}
+	mem_trace_append(&rec);
+}
+
+void	mem_trace_zone(uint8_t op, const void *zone)
+{
+	ft_trace_rec_t	rec;
+
+	if (!mem_trace_enabled())
+		return ;
+	rec.op = op;
+	rec.zone_type = ((const ft_zone_t *)zone)->type;
+	rec.ptr = 0;
+	rec.old_ptr = 0;
+	rec.size = ((const ft_zone_t *)zone)->total_size
+		- ((const ft_zone_t *)zone)->color;
+	rec.zone = (uint64_t)(uintptr_t)zone;
+	mem_trace_append(&rec);
+}
+
+void	mem_trace_flush(void)
+{
+	if (g_trace.state == 1 && g_trace.used)
+		mem_trace_write_all(g_trace.buf, g_trace.used);
+	g_trace.used = 0;
+}
+
+size_t	mem_trace_dropped(void)
+{
+	t_trace_ring	*ring;
+	size_t			total;
+
+	total = 0;
+	ring = __atomic_load_n(&g_trace_rings, __ATOMIC_ACQUIRE);
+	while (ring)
+	{
+		total += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+		ring = ring->next;
+	}
+	return (total);
+}
+
+/*
+** mem_trace_drain_buffer()
+**
+** Drain thread side of mem_trace_append().
+*/
+
+static void	mem_trace_drain_buffer(const ft_trace_rec_t *rec)
+{
+	if (g_trace.used + sizeof(*rec) > sizeof(g_trace.buf))
+		mem_trace_flush();
+	*(ft_trace_rec_t *)(g_trace.buf + g_trace.used) = *rec;
+	g_trace.used += sizeof(*rec);
+}
+
+/*
+** mem_trace_drain_once()
+**
+** Moves everything currently in the rings to the file, plus one DROPPED
+** record per ring that lost events. Returns the number of records moved.
+*/
+
+static size_t	mem_trace_drain_once(void)
+{
+	t_trace_ring	*ring;
+	ft_trace_rec_t	rec;
+	uint64_t		head;
+	uint64_t		tail;
+	uint64_t		dropped;
+	size_t			moved;
+
+	moved = 0;
+	ring = __atomic_load_n(&g_trace_rings, __ATOMIC_ACQUIRE);
+	while (ring && g_trace.state == 1)
+	{
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		tail = ring->tail;
+		while (tail != head)
+			mem_trace_drain_buffer(&ring->recs[tail++
+				& (FT_TRACE_RING_SIZE - 1)]);
+		moved += tail - ring->tail;
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+		dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+		if (dropped != ring->reported)
+		{
+			rec = (ft_trace_rec_t){FT_TRACE_DROPPED, 0, 0, ring->tid,
+				mem_trace_now(), 0, 0, dropped - ring->reported, 0};
+			mem_trace_drain_buffer(&rec);
+			ring->reported = dropped;
+		}
+		ring = ring->next;
+	}
+	mem_trace_flush();
+	return (moved);
+}
+
+static void	*mem_trace_drain_main(void *arg)
+{
+	const struct timespec	pause = {0, FT_TRACE_DRAIN_NS};
+
+	(void)arg;
+	while (!__atomic_load_n(&g_trace_stop, __ATOMIC_ACQUIRE))
+	{
+		if (mem_trace_drain_once() == 0)
+			nanosleep(&pause, NULL);
+	}
+	mem_trace_drain_once();
+	return (NULL);
+}
+
+/*
+** mem_trace_start()
+**
+** Starts the drain thread at library load. It cannot be started lazily:
+** the first record is written from inside malloc(), possibly under the
+** allocator lock, and pthread_create() allocates.
+*/
+
+__attribute__((constructor))
+static void	mem_trace_start(void)
+{
+	if (!mem_trace_enabled() || !g_trace.async || g_trace_drain_started)
+		return ;
+	if (pthread_key_create(&g_trace_key, mem_trace_ring_release) == 0)
+		g_trace_key_ok = 1;
+	if (pthread_create(&g_trace_drain, NULL, mem_trace_drain_main,
+			NULL) != 0)
+	{
+		g_trace.async = 0;
+		return ;
+	}
+	g_trace_drain_started = 1;
+}
+
+/*
+** mem_trace_fini()
+**
+** Flushes the tail of the trace at exit. Later destructors and atexit()
+** handlers may still allocate: from here on every record is written as
+** soon as it is made. In async mode the drain thread is joined first and
+** its rings emptied under the lock, which every recording thread holds,
+** before switching to synchronous writes.
+*/
+
+__attribute__((destructor))
+static void	mem_trace_fini(void)
+{
+	if (g_trace.async && g_trace_drain_started)
+	{
+		__atomic_store_n(&g_trace_stop, 1, __ATOMIC_RELEASE);
+		pthread_join(g_trace_drain, NULL);
+		g_trace_drain_started = 0;
+	}
+	if (MALLOC_PREACTION != 0)
+		return ;
+	if (g_trace.async)
+		mem_trace_drain_once();
+	g_trace.async = 0;
+	g_trace.closing = 1;
+	mem_trace_flush();
+	(void)MALLOC_POSTACTION;
+}
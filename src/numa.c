@@ -0,0 +1,134 @@
+#define _GNU_SOURCE
+#include "numa.h"
+#include "conf.h"
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define FT_MPOL_PREFERRED	1
+
+/*
+** Detected node count: 0 until read, then at least 1
+*/
+
+static int	g_numa_nodes = 0;
+
+static __thread int			t_numa_node
+	__attribute__((tls_model("initial-exec"))) = -1;
+static __thread uint32_t	t_numa_calls
+	__attribute__((tls_model("initial-exec"))) = 0;
+
+/*
+** ft_numa_detect()
+**
+** Reads the highest node number from /sys/devices/system/node/possible
+** ("0", "0-1", "0-3,8-11", ...) with raw syscalls: no malloc() here.
+*/
+
+static int	ft_numa_detect(void)
+{
+	char	buf[128];
+	ssize_t	len;
+	ssize_t	i;
+	int		fd;
+	int		last;
+
+	fd = open("/sys/devices/system/node/possible", O_RDONLY);
+	if (fd < 0)
+		return (1);
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return (1);
+	i = len;
+	while (i > 0 && (buf[i - 1] < '0' || buf[i - 1] > '9'))
+		i--;
+	while (i > 0 && buf[i - 1] >= '0' && buf[i - 1] <= '9')
+		i--;
+	last = 0;
+	while (i < len && buf[i] >= '0' && buf[i] <= '9')
+		last = last * 10 + (buf[i++] - '0');
+	if (last >= FT_NUMA_MAX_NODES)
+		last = FT_NUMA_MAX_NODES - 1;
+	return (last + 1);
+}
+
+static int	ft_numa_real_nodes(void)
+{
+	if (g_numa_nodes == 0)
+		g_numa_nodes = ft_numa_detect();
+	return (g_numa_nodes);
+}
+
+/*
+** ft_numa_nodes()
+**
+** Node count in effect: simulated if numa_nodes is set, detected
+** otherwise.
+*/
+
+static int	ft_numa_nodes(void)
+{
+	const ft_conf_t	*conf = ft_conf_get();
+
+	if (conf->numa_nodes)
+		return ((int)conf->numa_nodes);
+	return (ft_numa_real_nodes());
+}
+
+int	ft_numa_active(void)
+{
+	return (ft_conf_get()->numa && ft_numa_nodes() > 1);
+}
+
+/*
+** ft_numa_lookup()
+**
+** The calling thread's node, from getcpu() or the simulated topology.
+*/
+
+static int	ft_numa_lookup(void)
+{
+	unsigned int	cpu;
+	unsigned int	node;
+	int				nodes;
+
+	nodes = ft_numa_nodes();
+	node = 0;
+#ifdef LINUX
+	if (ft_conf_get()->numa_nodes)
+		return ((int)((unsigned long)syscall(SYS_gettid) % (unsigned)nodes));
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 || (int)node >= nodes)
+		return (0);
+#else
+	(void)cpu;
+	(void)nodes;
+#endif
+	return ((int)node);
+}
+
+int	ft_numa_node(void)
+{
+	if (!ft_numa_active())
+		return (0);
+	if (t_numa_node < 0 || (++t_numa_calls & (FT_NUMA_REFRESH - 1)) == 0)
+		t_numa_node = ft_numa_lookup();
+	return (t_numa_node);
+}
+
+void	ft_numa_bind(void *addr, size_t size, int node)
+{
+	unsigned long	mask;
+
+	if (node >= ft_numa_real_nodes() || ft_numa_real_nodes() < 2)
+		return ;
+	mask = 1UL << node;
+#ifdef LINUX
+	(void)syscall(SYS_mbind, addr, size, FT_MPOL_PREFERRED, &mask,
+		sizeof(mask) * 8, 0);
+#else
+	(void)addr;
+	(void)size;
+	(void)mask;
+#endif
+}
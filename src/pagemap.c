@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+#include "pagemap.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+/*
+** Root table - leaves are mapped on demand
+*/
+
+t_pagemap_leaf	*g_pagemap[1 << FT_PAGEMAP_L1_BITS];
+
+/*
+** ft_pagemap_leaf()
+**
+** Returns the leaf for root slot 'i', mapping it the first time.
+** Runs under the allocator lock.
+*/
+
+static t_pagemap_leaf	*ft_pagemap_leaf(uintptr_t i)
+{
+	t_pagemap_leaf	*leaf;
+
+	leaf = g_pagemap[i];
+	if (leaf)
+		return (leaf);
+	leaf = mmap(NULL, sizeof(t_pagemap_leaf), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (leaf == MAP_FAILED)
+		return (NULL);
+	__atomic_store_n(&g_pagemap[i], leaf, __ATOMIC_RELEASE);
+	return (leaf);
+}
+
+int	ft_pagemap_set(void *addr, size_t size, ft_zone_t *zone)
+{
+	uintptr_t		page;
+	uintptr_t		end;
+	t_pagemap_leaf	*leaf;
+
+	page = (uintptr_t)addr >> FT_PAGEMAP_SHIFT;
+	end = ((uintptr_t)addr + size - 1) >> FT_PAGEMAP_SHIFT;
+	if (end >> (FT_PAGEMAP_L1_BITS + FT_PAGEMAP_L2_BITS))
+		return (-1);
+	while (page <= end)
+	{
+		leaf = ft_pagemap_leaf(page >> FT_PAGEMAP_L2_BITS);
+		if (!leaf)
+			return (-1);
+		(*leaf)[page & ((1 << FT_PAGEMAP_L2_BITS) - 1)] = zone;
+		page++;
+	}
+	return (0);
+}
+
+/*
+** Next free()/realloc() in the lookup order, resolved on first use
+*/
+
+static void	(*g_next_free)(void *);
+static void	*(*g_next_realloc)(void *, size_t);
+
+/*
+** ft_page_mapped()
+**
+** 1 if the page holding 'addr' is mapped, so reading it cannot fault.
+*/
+
+static int	ft_page_mapped(uintptr_t addr)
+{
+	unsigned char	vec;
+
+	return (mincore((void *)(addr & ~(uintptr_t)4095), 1, &vec) == 0);
+}
+
+/*
+** ft_foreign_owned()
+**
+** Sanity check that 'ptr' is the start of an in-use glibc chunk before
+** handing it to the next allocator, which aborts on anything else. The
+** chunk header is the two words in front of 'ptr': the size, with its
+** three flag bits, is a multiple of 16 of at least 32. An mmap()ed chunk
+** (IS_MMAPPED) starts and ends on page boundaries once its leading
+** padding is added back; any other must be marked in use (PREV_INUSE)
+** by the chunk that follows it.
+*/
+
+#define FT_CHUNK_PREV_INUSE	0x1
+#define FT_CHUNK_IS_MMAPPED	0x2
+#define FT_CHUNK_FLAGS		0x7
+
+static int	ft_foreign_owned(void *ptr)
+{
+	uintptr_t	chunk;
+	size_t		head;
+	size_t		size;
+	size_t		pad;
+
+	chunk = (uintptr_t)ptr - 2 * sizeof(size_t);
+	if (((uintptr_t)ptr & 15) || (uintptr_t)ptr < 4096
+		|| (((uintptr_t)ptr & 4095) < 2 * sizeof(size_t)
+			&& !ft_page_mapped(chunk)))
+		return (0);
+	head = ((size_t *)chunk)[1];
+	size = head & ~(size_t)FT_CHUNK_FLAGS;
+	if (size < 32 || (size & 15) || chunk + size < chunk)
+		return (0);
+	if (head & FT_CHUNK_IS_MMAPPED)
+	{
+		pad = ((size_t *)chunk)[0];
+		return (((chunk - pad) & 4095) == 0 && ((pad + size) & 4095) == 0);
+	}
+	if (!ft_page_mapped(chunk + size + sizeof(size_t)))
+		return (0);
+	return ((((size_t *)(chunk + size))[1] & FT_CHUNK_PREV_INUSE) != 0);
+}
+
+/*
+** ft_foreign_free()
+**
+** Anything the next allocator does not own, or all of it if there is no
+** next allocator, is ignored like any other invalid pointer.
+*/
+
+void	ft_foreign_free(void *ptr)
+{
+	if (!g_next_free)
+		*(void **)&g_next_free = dlsym(RTLD_NEXT, "free");
+	if (g_next_free && ft_foreign_owned(ptr))
+		g_next_free(ptr);
+}
+
+/*
+** ft_foreign_realloc()
+**
+** Same rule; an invalid pointer gives NULL with errno set to EINVAL.
+*/
+
+void	*ft_foreign_realloc(void *ptr, size_t size)
+{
+	if (!g_next_realloc)
+		*(void **)&g_next_realloc = dlsym(RTLD_NEXT, "realloc");
+	if (!g_next_realloc || !ft_foreign_owned(ptr))
+	{
+		errno = EINVAL;
+		return (NULL);
+	}
+	return (g_next_realloc(ptr, size));
+}
@@ -0,0 +1,159 @@
+#include "prefault.h"
+#include "zone.h"
+#include "block.h"
+#include "utils.h"
+#include "align.h"
+#include <sys/mman.h>
+#include <stddef.h>
+
+/*
+** Global prefault policy and counters
+*/
+
+ft_prefault_t	g_prefault = {FT_PREFAULT_MODE, FT_PREFAULT_LARGE_MIN,
+	{0, 0, 0}};
+
+/*
+** ft_malloc_prefault()
+**
+** Public setter for the policy.
+*/
+
+void	ft_malloc_prefault(int mode, size_t large_threshold)
+{
+	g_prefault.mode = (uint8_t)(mode & (FT_PREFAULT_ZONES | FT_PREFAULT_LARGE
+		| FT_PREFAULT_REUSE));
+	if (large_threshold)
+		g_prefault.large_threshold = large_threshold;
+}
+
+/*
+** ft_malloc_prefault_stats()
+**
+** Public getter for the counters.
+*/
+
+void	ft_malloc_prefault_stats(ft_prefault_stats_t *out)
+{
+	if (out)
+		*out = g_prefault.stats;
+}
+
+/*
+** ft_prefault_wanted()
+**
+** TINY/SMALL/MEDIUM zones follow FT_PREFAULT_ZONES, LARGE zones follow
+** FT_PREFAULT_LARGE and the size threshold.
+*/
+
+int	ft_prefault_wanted(uint8_t type, size_t total_size)
+{
+	if (type == FT_ZONE_LARGE)
+		return ((g_prefault.mode & FT_PREFAULT_LARGE)
+			&& total_size >= g_prefault.large_threshold);
+	return ((g_prefault.mode & FT_PREFAULT_ZONES) != 0);
+}
+
+/*
+** ft_prefault_zone()
+**
+** When the kernel could not populate the mapping for us, write one byte
+** per page: the zone is brand new and zero-filled, so writing zero keeps
+** its contents while forcing the fault now.
+*/
+
+void	ft_prefault_zone(void *addr, size_t total_size, uint8_t type,
+	int populated)
+{
+	const size_t	ps = ft_pagesize();
+	size_t			off;
+
+	if (!populated)
+	{
+		off = 0;
+		while (off < total_size)
+		{
+			((volatile uint8_t *)addr)[off] = 0;
+			off += ps;
+		}
+	}
+	if (type == FT_ZONE_LARGE)
+		g_prefault.stats.large_pages += total_size / ps;
+	else
+		g_prefault.stats.zone_pages += total_size / ps;
+}
+
+/*
+** ft_prefault_populate()
+**
+** Faults in the pages of 'chunk' whose bit in 'vec' says they are not
+** resident: MADV_POPULATE_WRITE (Linux 5.14) over the chunk, or else a
+** zero written to each of them. A page that is not resident was given
+** back or never touched and reads as zero, so the write keeps it intact.
+*/
+
+#define FT_PREFAULT_CHUNK	256
+
+static void	ft_prefault_populate(uint8_t *chunk, size_t pages,
+	const unsigned char *vec)
+{
+	static int		no_populate;
+	const size_t	ps = ft_pagesize();
+	size_t			i;
+
+#ifdef MADV_POPULATE_WRITE
+	if (!no_populate
+		&& madvise(chunk, pages * ps, MADV_POPULATE_WRITE) == 0)
+		return ;
+#endif
+	no_populate = 1;
+	i = 0;
+	while (i < pages)
+	{
+		if (!(vec[i] & 1))
+			((volatile uint8_t *)chunk)[i * ps] = 0;
+		i++;
+	}
+}
+
+/*
+** ft_prefault_reuse()
+**
+** Only whole pages past the block header are looked at; the header page
+** is in use anyway. Pages still resident cost nothing and are not
+** counted, so reuse_pages is the faults the program does not take.
+*/
+
+void	ft_prefault_reuse(void *addr, size_t size)
+{
+	unsigned char	vec[FT_PREFAULT_CHUNK];
+	const size_t	ps = ft_pagesize();
+	uintptr_t		start;
+	uintptr_t		end;
+	size_t			pages;
+	size_t			missing;
+	size_t			i;
+
+	if (!(g_prefault.mode & FT_PREFAULT_REUSE) || size < ps)
+		return ;
+	start = FT_ALIGN_UP((uintptr_t)addr + FT_BLOCK_HDR_SIZE, ps);
+	end = ((uintptr_t)addr + size) & ~(uintptr_t)(ps - 1);
+	while (start < end)
+	{
+		pages = (end - start) / ps;
+		if (pages > FT_PREFAULT_CHUNK)
+			pages = FT_PREFAULT_CHUNK;
+		if (mincore((void *)start, pages * ps, vec) != 0)
+			return ;
+		missing = 0;
+		i = 0;
+		while (i < pages)
+			missing += !(vec[i++] & 1);
+		if (missing)
+		{
+			ft_prefault_populate((uint8_t *)start, pages, vec);
+			g_prefault.stats.reuse_pages += missing;
+		}
+		start += pages * ps;
+	}
+}
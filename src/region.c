@@ -0,0 +1,196 @@
+#include "region.h"
+#include "zone.h"
+#include "utils.h"
+#include <sys/mman.h>
+#include <stddef.h>
+
+#ifndef MAP_NORESERVE
+# define MAP_NORESERVE 0
+#endif
+
+/*
+** Global region descriptor - reserved lazily on the first zone creation
+*/
+
+ft_region_t	g_region = {NULL, NULL, NULL, FT_REGION_UNINIT, 0, {{NULL, 0}}};
+
+/*
+** ft_region_reserve()
+**
+** Reserves FT_REGION_SIZE bytes of address space with no access rights.
+** On failure the region is marked as FAILED and never retried, so every
+** zone transparently falls back to its own mmap().
+*/
+
+static int	ft_region_reserve(void)
+{
+	void	*addr;
+
+	if (g_region.state != FT_REGION_UNINIT)
+		return (g_region.state == FT_REGION_READY);
+	addr = mmap(NULL, FT_REGION_SIZE, PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (addr == MAP_FAILED)
+	{
+		g_region.state = FT_REGION_FAILED;
+		return (0);
+	}
+	g_region.base = (uint8_t *)addr;
+	g_region.end = g_region.base + FT_REGION_SIZE;
+	g_region.brk = g_region.base;
+	g_region.state = FT_REGION_READY;
+	return (1);
+}
+
+/*
+** ft_region_take_hole()
+**
+** First-fit search in the (address ordered) hole table.
+** The hole is shrunk from the front, or removed when used up entirely.
+*/
+
+static uint8_t	*ft_region_take_hole(size_t size)
+{
+	size_t		i;
+	uint8_t		*addr;
+
+	i = 0;
+	while (i < g_region.n_holes)
+	{
+		if (g_region.holes[i].size >= size)
+		{
+			addr = g_region.holes[i].addr;
+			g_region.holes[i].addr += size;
+			g_region.holes[i].size -= size;
+			if (g_region.holes[i].size == 0)
+			{
+				g_region.n_holes--;
+				while (i < g_region.n_holes)
+				{
+					g_region.holes[i] = g_region.holes[i + 1];
+					i++;
+				}
+			}
+			return (addr);
+		}
+		i++;
+	}
+	return (NULL);
+}
+
+/*
+** ft_region_add_hole()
+**
+** Inserts a released range into the hole table, keeping it sorted by
+** address and merging it with adjacent holes. A hole that ends at brk
+** is given back to the untouched tail instead.
+*/
+
+static void	ft_region_add_hole(uint8_t *addr, size_t size)
+{
+	size_t	i;
+	size_t	j;
+
+	i = 0;
+	while (i < g_region.n_holes && g_region.holes[i].addr < addr)
+		i++;
+	if (i > 0 && g_region.holes[i - 1].addr + g_region.holes[i - 1].size == addr)
+	{
+		i--;
+		addr = g_region.holes[i].addr;
+		size += g_region.holes[i].size;
+		g_region.n_holes--;
+		j = i;
+		while (j < g_region.n_holes)
+		{
+			g_region.holes[j] = g_region.holes[j + 1];
+			j++;
+		}
+	}
+	if (i < g_region.n_holes && addr + size == g_region.holes[i].addr)
+	{
+		g_region.holes[i].addr = addr;
+		g_region.holes[i].size += size;
+		addr = g_region.holes[i].addr;
+		size = g_region.holes[i].size;
+		if (addr + size == g_region.brk)
+		{
+			g_region.brk = addr;
+			g_region.n_holes--;
+			while (i < g_region.n_holes)
+			{
+				g_region.holes[i] = g_region.holes[i + 1];
+				i++;
+			}
+		}
+		return ;
+	}
+	if (addr + size == g_region.brk)
+	{
+		g_region.brk = addr;
+		return ;
+	}
+	if (g_region.n_holes == FT_REGION_MAX_EXTENTS)
+		return ;
+	j = g_region.n_holes;
+	while (j > i)
+	{
+		g_region.holes[j] = g_region.holes[j - 1];
+		j--;
+	}
+	g_region.holes[i].addr = addr;
+	g_region.holes[i].size = size;
+	g_region.n_holes++;
+}
+
+/*
+** ft_region_map()
+**
+** Commits a range from a hole if one fits, otherwise from brk.
+** Memory coming back from a hole was replaced by a fresh PROT_NONE mapping
+** when it was released, so it is zero-filled just like new memory.
+*/
+
+void	*ft_region_map(size_t size)
+{
+	uint8_t	*addr;
+
+	if (!ft_region_reserve())
+		return (NULL);
+	addr = ft_region_take_hole(size);
+	if (!addr)
+	{
+		if ((size_t)(g_region.end - g_region.brk) < size)
+			return (NULL);
+		addr = g_region.brk;
+		g_region.brk += size;
+	}
+	if (mprotect(addr, size, PROT_READ | PROT_WRITE) != 0)
+	{
+		ft_region_add_hole(addr, size);
+		return (NULL);
+	}
+	return (addr);
+}
+
+/*
+** ft_region_unmap()
+**
+** Mapping a new PROT_NONE range over the old one drops its pages and
+** commit charge in a single syscall, while keeping the address space
+** reserved for the next zone. If that mapping fails the range is still
+** committed: it is left to the caller's munmap(), and the region never
+** hands it out again.
+*/
+
+int	ft_region_unmap(void *addr, size_t size)
+{
+	if (g_region.state != FT_REGION_READY || !ft_region_contains(addr))
+		return (0);
+	if (mmap(addr, size, PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0)
+		== MAP_FAILED)
+		return (0);
+	ft_region_add_hole((uint8_t *)addr, size);
+	return (1);
+}
@@ -1,89 +1,307 @@
 #include "malloc.h"
 #include "zone.h"
 #include "block.h"
+#include "lock.h"
 #include <unistd.h>
 #include <stdint.h>
 
 /*
-** ft_putstr()
+** Output buffer
 **
-** Writes a string to stdout.
-** Simple helper for show_alloc_mem() output.
+** Everything is formatted into a stack buffer and written out when it is
+** full or when the dump ends, so a dump costs one write() per
+** FT_SHOW_BUF_SIZE bytes instead of several per block. Nothing here may
+** call malloc(): the allocator lock is held while printing.
 */
 
-static void	ft_putstr(const char *s)
+#define FT_SHOW_BUF_SIZE	8192
+
+typedef struct s_show_buf
 {
+	int		fd;
 	size_t	len;
+	char	data[FT_SHOW_BUF_SIZE];
+}	t_show_buf;
+
+/*
+** ft_show_flush()
+**
+** Writes the buffered bytes out, retrying short writes.
+*/
+
+static void	ft_show_flush(t_show_buf *buf)
+{
+	size_t	off;
 	ssize_t	ret;
 
+	off = 0;
+	while (off < buf->len)
+	{
+		ret = write(buf->fd, buf->data + off, buf->len - off);
+		if (ret <= 0)
+			break ;
+		off += (size_t)ret;
+	}
+	buf->len = 0;
+}
+
+static void	ft_putchar(t_show_buf *buf, char c)
+{
+	if (buf->len == FT_SHOW_BUF_SIZE)
+		ft_show_flush(buf);
+	buf->data[buf->len++] = c;
+}
+
+/*
+** ft_putstr()
+**
+** Appends a string to the output buffer.
+*/
+
+static void	ft_putstr(t_show_buf *buf, const char *s)
+{
 	if (!s)
 		return ;
-	len = 0;
-	while (s[len])
-		len++;
-	ret = write(1, s, len);
-	(void)ret;
+	while (*s)
+		ft_putchar(buf, *s++);
 }
 
 /*
 ** ft_puthex()
 **
-** Writes a hexadecimal number to stdout.
+** Appends a hexadecimal number (digits only, as show_alloc_mem() always
+** printed them).
 ** Used for displaying memory addresses.
 */
 
-static void	ft_puthex(uintptr_t n)
+static void	ft_puthex(t_show_buf *buf, uintptr_t n)
 {
 	const char	*hex = "0123456789ABCDEF";
-	char		buf[18];
+	char		tmp[18];
 	int			i;
 
-	buf[0] = '0';
-	buf[1] = 'x';
+	tmp[0] = '0';
+	tmp[1] = 'x';
 	i = 17;
-	buf[i--] = '\0';
+	tmp[i--] = '\0';
 	if (n == 0)
 	{
-		buf[i--] = '0';
+		tmp[i--] = '0';
 	}
 	else
 	{
 		while (n > 0 && i >= 2)
 		{
-			buf[i--] = hex[n % 16];
+			tmp[i--] = hex[n % 16];
 			n /= 16;
 		}
 	}
-	ft_putstr(&buf[i + 1]);
+	ft_putstr(buf, &tmp[i + 1]);
 }
 
 /*
 ** ft_putnbr()
 **
-** Writes a decimal number to stdout.
+** Appends a decimal number, right-aligned in 'width' columns (0: none).
 ** Used for displaying byte counts.
 */
 
-static void	ft_putnbr(size_t n)
+static void	ft_putnbr_w(t_show_buf *buf, size_t n, int width)
 {
-	char	buf[32];
+	char	tmp[32];
 	int		i;
 
 	i = 31;
-	buf[i--] = '\0';
+	tmp[i--] = '\0';
 	if (n == 0)
 	{
-		buf[i--] = '0';
+		tmp[i--] = '0';
 	}
 	else
 	{
 		while (n > 0 && i >= 0)
 		{
-			buf[i--] = '0' + (n % 10);
+			tmp[i--] = '0' + (n % 10);
 			n /= 10;
 		}
 	}
-	ft_putstr(&buf[i + 1]);
+	while (30 - i < width)
+		tmp[i--] = ' ';
+	ft_putstr(buf, &tmp[i + 1]);
+}
+
+static void	ft_putnbr(t_show_buf *buf, size_t n)
+{
+	ft_putnbr_w(buf, n, 0);
+}
+
+/*
+** ft_show_hexdump()
+**
+** Dumps the first FT_SHOW_HEXDUMP_MAX bytes of an allocation, 16 per
+** line, with their printable characters.
+*/
+
+static void	ft_show_hexdump(t_show_buf *buf, const uint8_t *data, size_t size)
+{
+	const char	*hex = "0123456789abcdef";
+	size_t		off;
+	size_t		i;
+
+	if (size > FT_SHOW_HEXDUMP_MAX)
+		size = FT_SHOW_HEXDUMP_MAX;
+	off = 0;
+	while (off < size)
+	{
+		ft_putstr(buf, "  ");
+		ft_puthex(buf, (uintptr_t)(data + off));
+		ft_putstr(buf, " ");
+		i = 0;
+		while (i < 16)
+		{
+			ft_putchar(buf, ' ');
+			ft_putchar(buf, off + i < size ? hex[data[off + i] >> 4] : ' ');
+			ft_putchar(buf, off + i < size ? hex[data[off + i] & 15] : ' ');
+			i++;
+		}
+		ft_putstr(buf, "  |");
+		i = 0;
+		while (i < 16 && off + i < size)
+		{
+			ft_putchar(buf, (data[off + i] >= 32 && data[off + i] < 127)
+				? (char)data[off + i] : '.');
+			i++;
+		}
+		ft_putstr(buf, "|\n");
+		off += 16;
+	}
+}
+
+/*
+** ft_show_range()
+**
+** One "start - end : N bytes" line.
+*/
+
+static void	ft_show_range(t_show_buf *buf, void *start, size_t size,
+	const char *suffix)
+{
+	ft_puthex(buf, (uintptr_t)start);
+	ft_putstr(buf, " - ");
+	ft_puthex(buf, (uintptr_t)start + size);
+	ft_putstr(buf, " : ");
+	ft_putnbr(buf, size);
+	ft_putstr(buf, suffix);
+}
+
+/*
+** ft_show_summary()
+**
+** Per-zone summary line (FT_SHOW_SUMMARY).
+*/
+
+static void	ft_show_summary(t_show_buf *buf, ft_zone_t *zone)
+{
+	ft_block_t	*block;
+	size_t		used;
+	size_t		free_bytes;
+	size_t		free_blocks;
+	size_t		largest;
+
+	used = 0;
+	free_bytes = 0;
+	free_blocks = 0;
+	largest = 0;
+	block = zone->first_block;
+	while (block)
+	{
+		if (block->is_free)
+		{
+			free_bytes += block->size;
+			free_blocks++;
+			if (block->size > largest)
+				largest = block->size;
+		}
+		else
+			used += block->size;
+		block = block->next;
+	}
+	ft_putstr(buf, "  zone ");
+	ft_putnbr(buf, zone->total_size);
+	ft_putstr(buf, " bytes, ");
+	ft_putnbr(buf, zone->block_count);
+	ft_putstr(buf, " allocations, requested ");
+	ft_putnbr(buf, zone->used_size);
+	ft_putstr(buf, ", in blocks ");
+	ft_putnbr(buf, used);
+	ft_putstr(buf, ", free ");
+	ft_putnbr(buf, free_bytes);
+	ft_putstr(buf, " in ");
+	ft_putnbr(buf, free_blocks);
+	ft_putstr(buf, " blocks (largest ");
+	ft_putnbr(buf, largest);
+	ft_putstr(buf, ")\n");
+}
+
+/*
+** Size histogram (FT_SHOW_HISTOGRAM): requested sizes in power-of-two
+** buckets, bucket i holding sizes in (2^(i-1), 2^i].
+*/
+
+#define FT_SHOW_HIST_BUCKETS	48
+#define FT_SHOW_HIST_BAR		40
+
+typedef struct s_show_hist
+{
+	size_t	count[FT_SHOW_HIST_BUCKETS];
+	size_t	bytes[FT_SHOW_HIST_BUCKETS];
+}	t_show_hist;
+
+static void	ft_hist_add(t_show_hist *hist, size_t size)
+{
+	int	bucket;
+
+	bucket = 0;
+	while (bucket < FT_SHOW_HIST_BUCKETS - 1 && ((size_t)1 << bucket) < size)
+		bucket++;
+	hist->count[bucket]++;
+	hist->bytes[bucket] += size;
+}
+
+static void	ft_show_histogram(t_show_buf *buf, const t_show_hist *hist)
+{
+	size_t	max;
+	size_t	bar;
+	int		i;
+
+	max = 0;
+	i = 0;
+	while (i < FT_SHOW_HIST_BUCKETS)
+	{
+		if (hist->count[i] > max)
+			max = hist->count[i];
+		i++;
+	}
+	ft_putstr(buf, "Histogram (requested size: count, bytes)\n");
+	i = 0;
+	while (i < FT_SHOW_HIST_BUCKETS)
+	{
+		if (hist->count[i])
+		{
+			ft_putstr(buf, "  <= ");
+			ft_putnbr_w(buf, (size_t)1 << i, 12);
+			ft_putstr(buf, " : ");
+			ft_putnbr_w(buf, hist->count[i], 9);
+			ft_putstr(buf, " ");
+			ft_putnbr_w(buf, hist->bytes[i], 14);
+			ft_putstr(buf, " ");
+			bar = (hist->count[i] * FT_SHOW_HIST_BAR + max - 1) / max;
+			while (bar--)
+				ft_putchar(buf, '#');
+			ft_putchar(buf, '\n');
+		}
+		i++;
+	}
 }
 
 /*
@@ -95,56 +313,61 @@ static void	ft_putnbr(size_t n)
 ** 0xA0020 - 0xA004A : 42 bytes
 */
 
-static size_t ft_show_zone_type(ft_zone_t *zone_list, const char *type_name)
+static size_t ft_show_zone_type(t_show_buf *buf, ft_zone_t *zone_list,
+	const char *type_name, int flags, t_show_hist *hist)
 {
 	ft_zone_t   *zone = zone_list;
 	size_t      total = 0;
 
 	while (zone)
 	{
-		ft_putstr(type_name);
-		ft_putstr(" : ");
-		ft_puthex((uintptr_t)zone);
-		ft_putstr("\n");
+		ft_putstr(buf, type_name);
+		ft_putstr(buf, " : ");
+		ft_puthex(buf, (uintptr_t)zone);
+		ft_putstr(buf, "\n");
+		if (flags & FT_SHOW_SUMMARY)
+			ft_show_summary(buf, zone);
 
 		ft_block_t *block = zone->first_block;
 		while (block)
 		{
 			if (!block->is_free)
 			{
-				void *header_ptr = (void*)block;
+				void *header_ptr = ft_block_start(block);
 				void *user_ptr = ft_block_data_ptr(block);
 
 				/* compute sizes */
 				size_t user_size;
 #if SHOW_MORE
-				user_size = block->user_size;
+				user_size = ft_block_requested(block);
 #else
 				size_t header_size = (uintptr_t)user_ptr - (uintptr_t)header_ptr;
 				user_size = block->size - header_size;
 #endif
-				void *user_end = (void*)((uintptr_t)user_ptr + user_size);
 
-				if (user_size > 0)
+				if (user_size > 0 && (flags & FT_SHOW_ALLOCS))
 				{
 #if SHOW_MORE
 					/* Verbose mode: show header + raw block size */
-					ft_putstr("HEADER: ");
-					ft_puthex((uintptr_t)header_ptr);
-					ft_putstr(" (total block: ");
-					ft_putnbr(block->size);
-					ft_putstr(" bytes)\n");
+					ft_putstr(buf, "HEADER: ");
+					ft_puthex(buf, (uintptr_t)header_ptr);
+					ft_putstr(buf, " (total block: ");
+					ft_putnbr(buf, block->size);
+					ft_putstr(buf, " bytes)\n");
 #endif
 					/* Always show user range */
-					ft_puthex((uintptr_t)user_ptr);
-					ft_putstr(" - ");
-					ft_puthex((uintptr_t)user_end);
-					ft_putstr(" : ");
-					ft_putnbr(user_size);
-					ft_putstr(" bytes\n");
+					ft_show_range(buf, user_ptr, user_size, " bytes\n");
+					if (flags & FT_SHOW_HEXDUMP)
+						ft_show_hexdump(buf, user_ptr,
+							ft_block_requested(block));
 				}
+				if (hist)
+					ft_hist_add(hist, ft_block_requested(block));
 				total += user_size;
 			}
+			else if (flags & FT_SHOW_FREE)
+				ft_show_range(buf, ft_block_start(block), block->size,
+					" bytes free\n");
 			block = block->next;
 		}
 		zone = zone->next;
@@ -153,23 +376,57 @@ static size_t ft_show_zone_type(ft_zone_t *zone_list, const char *type_name)
 }
 
 /*
-** show_alloc_mem()
+** show_alloc_mem_ex()
 **
-** Displays all allocated memory zones sorted by type (TINY, SMALL, LARGE).
-** Shows each allocation's address range and size.
-** Ends with total bytes allocated.
+** Dumps the zones, sorted by type (TINY, SMALL, MEDIUM, LARGE), as selected
+** by 'flags', to 'fd'. Runs under the allocator lock so the output is one
+** consistent snapshot.
 */
 
-void	show_alloc_mem(void)
+void	show_alloc_mem_ex(int flags, int fd)
 {
-	size_t	total;
+	t_show_buf	buf;
+	t_show_hist	hist;
+	t_show_hist	*histp;
+	size_t		total;
 
+	buf.fd = fd;
+	buf.len = 0;
+	histp = NULL;
+	if (flags & FT_SHOW_HISTOGRAM)
+	{
+		histp = &hist;
+		hist = (t_show_hist){{0}, {0}};
+	}
+	if (MALLOC_PREACTION != 0)
+		return ;
 	total = 0;
-	total += ft_show_zone_type(g_zone_mgr.tiny_zones, "TINY");
-	total += ft_show_zone_type(g_zone_mgr.small_zones, "SMALL");
-	total += ft_show_zone_type(g_zone_mgr.large_zones, "LARGE");
-	ft_putstr("Total : ");
-	ft_putnbr(total);
-	ft_putstr(" bytes\n");
+	total += ft_show_zone_type(&buf, g_zone_mgr.tiny_zones, "TINY", flags,
+		histp);
+	total += ft_show_zone_type(&buf, g_zone_mgr.small_zones, "SMALL", flags,
+		histp);
+	total += ft_show_zone_type(&buf, g_zone_mgr.medium_zones, "MEDIUM",
+		flags, histp);
+	total += ft_show_zone_type(&buf, g_zone_mgr.large_zones, "LARGE", flags,
+		histp);
+	(void)MALLOC_POSTACTION;
+	ft_putstr(&buf, "Total : ");
+	ft_putnbr(&buf, total);
+	ft_putstr(&buf, " bytes\n");
+	if (histp)
+		ft_show_histogram(&buf, histp);
+	ft_show_flush(&buf);
 }
 
+/*
+** show_alloc_mem()
+**
+** Displays all allocated memory zones sorted by type (TINY, SMALL, MEDIUM,
+** LARGE). Shows each allocation's address range and size.
+** Ends with total bytes allocated.
+*/
+
+void	show_alloc_mem(void)
+{
+	show_alloc_mem_ex(FT_SHOW_ALLOCS, 1);
+}
@@ -0,0 +1,281 @@
+#include "malloc.h"
+#include "stats.h"
+#include "conf.h"
+#include "lock.h"
+#include "utils.h"
+#include <pthread.h>
+#include <sys/mman.h>
+
+/*
+** Global statistics - updated by malloc.c and zone.c
+*/
+
+ft_stats_t	g_ft_stats = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+/*
+** Per-size-class shards
+*/
+
+__thread ft_class_shard_t	*t_ft_shard
+	__attribute__((tls_model("initial-exec"))) = NULL;
+
+ft_class_shard_t		g_ft_class_overflow;
+
+static ft_class_shard_t	g_class_shards[FT_CLASS_SHARDS];
+static uint64_t			g_class_shards_busy = 0;
+static pthread_key_t	g_class_shard_key;
+static int				g_class_shard_keyed = 0;
+static pthread_once_t	g_class_shard_once = PTHREAD_ONCE_INIT;
+
+/*
+** ft_class_shard_release()
+**
+** Thread-exit destructor of the shard key: hands the shard back. Release
+** ordering publishes the counts to the next thread that claims it.
+*/
+
+static void	ft_class_shard_release(void *shard)
+{
+	size_t	idx;
+
+	idx = (size_t)((ft_class_shard_t *)shard - g_class_shards);
+	__atomic_fetch_and(&g_class_shards_busy, ~((uint64_t)1 << idx),
+		__ATOMIC_RELEASE);
+	t_ft_shard = NULL;
+}
+
+static void	ft_class_shard_key_init(void)
+{
+	g_class_shard_keyed = (pthread_key_create(&g_class_shard_key,
+		ft_class_shard_release) == 0);
+}
+
+/*
+** ft_class_shard_attach()
+**
+** Claims the lowest free shard by setting its bit in the busy mask, so
+** two threads attaching at once never share one. Without a pthread key
+** the shard is simply never handed back.
+*/
+
+ft_class_shard_t	*ft_class_shard_attach(void)
+{
+	uint64_t	busy;
+	uint64_t	bit;
+
+	pthread_once(&g_class_shard_once, ft_class_shard_key_init);
+	busy = __atomic_load_n(&g_class_shards_busy, __ATOMIC_RELAXED);
+	while (~busy & (~(uint64_t)0 >> (64 - FT_CLASS_SHARDS)))
+	{
+		bit = ~busy & (busy + 1);
+		if (__atomic_compare_exchange_n(&g_class_shards_busy, &busy,
+			busy | bit, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		{
+			t_ft_shard = &g_class_shards[__builtin_ctzll(bit)];
+			if (g_class_shard_keyed)
+				pthread_setspecific(g_class_shard_key, t_ft_shard);
+			return (t_ft_shard);
+		}
+	}
+	t_ft_shard = &g_ft_class_overflow;
+	return (t_ft_shard);
+}
+
+/*
+** ft_malloc_class_stats()
+**
+** Sums the counters of every shard, free ones included: they keep the
+** counts of exited threads. Other threads may be counting meanwhile: each
+** value read is one they wrote at some point.
+*/
+
+void	ft_malloc_class_stats(ft_class_stats_t *out)
+{
+	unsigned int		i;
+	size_t				c;
+	ft_class_stats_t	*src;
+
+	c = 0;
+	while (c < FT_CLASS_COUNT)
+	{
+		out[c] = (ft_class_stats_t){0, 0, 0, 0, 0, 0};
+		i = 0;
+		while (i <= FT_CLASS_SHARDS)
+		{
+			src = &g_ft_class_overflow.classes[c];
+			if (i < FT_CLASS_SHARDS)
+				src = &g_class_shards[i].classes[c];
+			out[c].allocs += src->allocs;
+			out[c].frees += src->frees;
+			out[c].requested += src->requested;
+			out[c].consumed += src->consumed;
+			out[c].realloc_hits += src->realloc_hits;
+			out[c].realloc_misses += src->realloc_misses;
+			i++;
+		}
+		c++;
+	}
+}
+
+/*
+** ft_size_class_max()
+**
+** Largest size mapped to the class: the class size, as ft_size_class()
+** rounds every request up to the next class.
+*/
+
+size_t	ft_size_class_max(uint8_t size_class)
+{
+	return (ft_class_size(size_class));
+}
+
+/*
+** ft_resident_bytes()
+**
+** Asks the kernel with mincore(), a chunk of pages at a time.
+*/
+
+#define FT_MINCORE_CHUNK	256
+
+size_t	ft_resident_bytes(const void *addr, size_t size)
+{
+	unsigned char	vec[FT_MINCORE_CHUNK];
+	size_t			page;
+	size_t			off;
+	size_t			len;
+	size_t			i;
+	size_t			resident;
+
+	page = ft_pagesize();
+	resident = 0;
+	off = 0;
+	while (off < size)
+	{
+		len = size - off;
+		if (len > FT_MINCORE_CHUNK * page)
+			len = FT_MINCORE_CHUNK * page;
+		if (mincore((uint8_t *)addr + off, len, vec) != 0)
+			return (resident);
+		i = 0;
+		while (i < (len + page - 1) / page)
+			resident += (vec[i++] & 1) * page;
+		off += len;
+	}
+	return (resident);
+}
+
+/*
+** ft_malloc_frag_stats()
+**
+** Walks every zone for the largest free blocks and the resident size;
+** the rest comes from the counters.
+*/
+
+int	ft_malloc_frag_stats(ft_frag_stats_t *out)
+{
+	const ft_zone_t		*zone;
+	const ft_block_t	*block;
+	uint8_t				type;
+	size_t				largest;
+
+	*out = (ft_frag_stats_t){0, 0, 0, {0}, 0, 0, 0.0, 0.0, 0.0};
+	if (MALLOC_PREACTION != 0)
+		return (-1);
+	out->requested = g_ft_stats.requested_bytes;
+	out->allocated = g_ft_stats.inuse_bytes + g_ft_stats.large_bytes;
+	out->free = g_ft_stats.free_bytes;
+	out->mapped = g_ft_stats.zone_bytes + g_ft_stats.large_bytes;
+	type = FT_ZONE_TINY;
+	while (type <= FT_ZONE_LARGE)
+	{
+		zone = *ft_zone_get_list(type);
+		while (zone)
+		{
+			block = zone->free_head;
+			while (block)
+			{
+				if (block->size > out->largest_free[type])
+					out->largest_free[type] = block->size;
+				block = block->next_free;
+			}
+			out->resident += ft_resident_bytes(ft_zone_base(zone),
+				zone->total_size);
+			zone = zone->next;
+		}
+		type++;
+	}
+	(void)MALLOC_POSTACTION;
+	largest = 0;
+	type = FT_ZONE_TINY;
+	while (type < FT_ZONE_LARGE)
+	{
+		if (out->largest_free[type] > largest)
+			largest = out->largest_free[type];
+		type++;
+	}
+	if (out->allocated)
+		out->internal = 1.0 - (double)out->requested / (double)out->allocated;
+	if (out->free)
+		out->external = 1.0 - (double)largest / (double)out->free;
+	if (out->resident)
+		out->overhead = 1.0 - (double)out->requested / (double)out->resident;
+	return (0);
+}
+
+/*
+** mallinfo2()
+**
+** Maps the counters onto glibc's fields: zones play the part of the
+** main arena, LARGE zones the part of mmap()ed chunks.
+*/
+
+struct mallinfo2	mallinfo2(void)
+{
+	struct mallinfo2	info;
+
+	info = (struct mallinfo2){0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	if (MALLOC_PREACTION != 0)
+		return (info);
+	info.arena = g_ft_stats.zone_bytes;
+	info.ordblks = g_ft_stats.free_blocks;
+	info.smblks = 0;
+	info.hblks = g_ft_stats.large_count;
+	info.hblkhd = g_ft_stats.large_bytes;
+	info.usmblks = 0;
+	info.fsmblks = 0;
+	info.uordblks = g_ft_stats.inuse_bytes;
+	info.fordblks = g_ft_stats.free_bytes;
+	info.keepcost = g_ft_stats.empty_bytes;
+	(void)MALLOC_POSTACTION;
+	return (info);
+}
+
+/*
+** mallopt()
+**
+** Parameters without an ft_malloc equivalent (M_TOP_PAD, M_MMAP_MAX,
+** arena settings, ...) are rejected, as glibc does for unknown ones.
+** M_MMAP_THRESHOLD below the SMALL limit lowers that limit too.
+*/
+
+int	mallopt(int param, int value)
+{
+	int	ret;
+
+	if (value < 0)
+		return (0);
+	ret = 0;
+	if (MALLOC_PREACTION != 0)
+		return (0);
+	if (param == M_MMAP_THRESHOLD
+		&& (size_t)value >= ft_conf_get()->tiny_max)
+	{
+		if ((size_t)value < ft_conf_get()->small_max)
+			ft_conf_set("small_max", (size_t)value);
+		ret = (ft_conf_set("mmap_threshold", (size_t)value) == 0);
+	}
+	else if (param == M_TRIM_THRESHOLD)
+		ret = (ft_conf_set("trim_threshold", (size_t)value) == 0);
+	(void)MALLOC_POSTACTION;
+	return (ret);
+}
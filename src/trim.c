@@ -0,0 +1,116 @@
+#include "malloc.h"
+#include "zone.h"
+#include "block.h"
+#include "align.h"
+#include "lock.h"
+#include "stats.h"
+#include "trim.h"
+#include "utils.h"
+#include <sys/mman.h>
+
+/*
+** ft_trim_block()
+**
+** Gives back the whole pages strictly inside a free block. A page that
+** holds an inline header is kept, so the block lists stay intact; released
+** pages read back as zeros when the block is reused. 'pad' is the free
+** resident memory still to keep: blocks are left alone until it is used
+** up.
+*/
+
+static size_t	ft_trim_block(ft_block_t *block, size_t *pad)
+{
+	const size_t	page = ft_pagesize();
+	uintptr_t		start;
+	uintptr_t		end;
+	size_t			resident;
+
+	start = FT_ALIGN_UP((uintptr_t)ft_block_data_ptr(block), page);
+	end = ((uintptr_t)ft_block_start(block) + block->size)
+		& ~(uintptr_t)(page - 1);
+	if (end <= start)
+		return (0);
+	resident = ft_resident_bytes((void *)start, end - start);
+	if (resident == 0)
+		return (0);
+	if (resident <= *pad)
+	{
+		*pad -= resident;
+		return (0);
+	}
+	*pad = 0;
+	if (madvise((void *)start, end - start, MADV_DONTNEED) != 0)
+		return (0);
+	return (resident);
+}
+
+size_t	ft_trim_zone(ft_zone_t *zone, size_t *pad)
+{
+	ft_block_t	*block;
+	size_t		released;
+
+	released = 0;
+	block = zone->free_head;
+	while (block)
+	{
+		released += ft_trim_block(block, pad);
+		block = block->next_free;
+	}
+	zone->dirty = 0;
+	return (released);
+}
+
+/*
+** ft_trim_list()
+**
+** Trims the free blocks of every zone in one list. Zones other than LARGE
+** with no allocation left are unmapped whole.
+*/
+
+static size_t	ft_trim_list(ft_zone_t *zone, size_t *pad)
+{
+	ft_zone_t	*next;
+	size_t		released;
+
+	released = 0;
+	while (zone)
+	{
+		next = zone->next;
+		if (zone->block_count == 0 && zone->type != FT_ZONE_LARGE
+			&& *pad == 0)
+		{
+			released += ft_resident_bytes(ft_zone_base(zone),
+				zone->total_size);
+			ft_zone_remove(zone);
+		}
+		else
+			released += ft_trim_zone(zone, pad);
+		zone = next;
+	}
+	return (released);
+}
+
+/*
+** ft_malloc_trim()
+**
+** Walks every zone under the lock, O(zones + free blocks).
+*/
+
+size_t	ft_malloc_trim(size_t pad)
+{
+	size_t	released;
+
+	if (MALLOC_PREACTION != 0)
+		return (0);
+	released = ft_trim_list(g_zone_mgr.tiny_zones, &pad);
+	released += ft_trim_list(g_zone_mgr.small_zones, &pad);
+	released += ft_trim_list(g_zone_mgr.medium_zones, &pad);
+	released += ft_trim_list(g_zone_mgr.large_zones, &pad);
+	(void)MALLOC_POSTACTION;
+	return (released);
+}
+
+int	malloc_trim(size_t pad)
+{
+	return (ft_malloc_trim(pad) != 0);
+}
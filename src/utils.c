@@ -3,6 +3,8 @@
 #include "zone.h"
 #include "block.h"
 #include "alloc_hdr.h"
+#include "conf.h"
+#include "size_class.h"
 #include <unistd.h>
 
 /*
@@ -31,20 +33,26 @@ size_t	ft_pagesize(void)
 **
 ** For TINY zones: FT_TINY_ZONE_PAGES * pagesize
 ** For SMALL zones: FT_SMALL_ZONE_PAGES * pagesize
+** For MEDIUM zones: FT_MEDIUM_ZONE_PAGES * pagesize
+** (page counts possibly overridden through FT_MALLOC_CONF)
 ** For LARGE zones: Round up (zone_hdr + block_hdr + alloc_hdr + size) to pagesize
 */
 
 size_t	ft_calculate_zone_size(uint8_t type, size_t request_size)
 {
 	const size_t	ps = ft_pagesize();
+	const ft_conf_t	*conf = ft_conf_get();
 
 	if (type == FT_ZONE_TINY)
-		return (FT_TINY_ZONE_PAGES * ps);
+		return (conf->tiny_zone_pages * ps);
 	else if (type == FT_ZONE_SMALL)
-		return (FT_SMALL_ZONE_PAGES * ps);
+		return (conf->small_zone_pages * ps);
+	else if (type == FT_ZONE_MEDIUM)
+		return (conf->medium_zone_pages * ps);
 	else
 	{
-		const size_t	needed = FT_ZONE_HDR_SIZE + request_size;
+		const size_t	needed = FT_ZONE_HDR_SIZE + FT_LARGE_META_SIZE
+			+ request_size;
 		return (FT_ALIGN_UP(needed, ps));
 	}
 }
@@ -54,12 +62,18 @@ size_t	ft_calculate_zone_size(uint8_t type, size_t request_size)
 **
 ** Total size = block_header + alloc_header + user_size (all aligned)
 ** We align the total to ensure the next block will be properly aligned.
+** Requests on the size-class ladder are served at their class size, so
+** a freed block fits any later request of its class. LARGE requests get
+** their own mapping and are not rounded.
 */
 
 size_t	ft_calculate_alloc_size(size_t user_size)
 {
 	size_t	total;
 
+	if (user_size <= FT_CLASS_LADDER_MAX
+		&& user_size <= ft_conf_get()->mmap_threshold)
+		user_size = ft_class_size(ft_size_class(user_size));
 	total = FT_BLOCK_HDR_SIZE + user_size;
 	return (FT_ALIGN_UP(total, FT_ALIGN_SIZE));
 }
@@ -2,6 +2,17 @@
 #include "block.h"
 #include "utils.h"
 #include "align.h"
+#include "prefault.h"
+#include "conf.h"
+#include "stats.h"
+#include "pagemap.h"
+#include "numa.h"
+#ifdef MALLOC_LOGGING
+# include "mem_trace.h"
+#endif
+#ifdef USE_REGION
+# include "region.h"
+#endif
 #include <sys/mman.h>
 #include <stddef.h>
 
@@ -9,23 +20,20 @@
 ** Global zone manager - tracks all zones by type
 */
 
-ft_zone_mgr_t	g_zone_mgr = {NULL, NULL, NULL};
+ft_zone_mgr_t	g_zone_mgr = {NULL, NULL, NULL, NULL};
 
 /*
 ** ft_zone_get_type()
 **
 ** Determines zone type based on allocation size.
-** Categorizes into TINY (1-128), SMALL (129-1024), or LARGE (1025+).
+** Categorizes into TINY (1-128), SMALL (129-1024), MEDIUM (1025-256K) or
+** LARGE, with the limits possibly overridden through FT_MALLOC_CONF.
+** The type of every size class is tabulated by the configuration.
 */
 
 uint8_t	ft_zone_get_type(size_t size)
 {
-	if (size <= FT_TINY_MAX)
-		return (FT_ZONE_TINY);
-	else if (size <= FT_SMALL_MAX)
-		return (FT_ZONE_SMALL);
-	else
-		return (FT_ZONE_LARGE);
+	return (ft_conf_get()->class_zone[ft_size_class(size)]);
 }
 
 /*
@@ -40,6 +48,8 @@ ft_zone_t	**ft_zone_get_list(uint8_t type)
 		return (&g_zone_mgr.tiny_zones);
 	else if (type == FT_ZONE_SMALL)
 		return (&g_zone_mgr.small_zones);
+	else if (type == FT_ZONE_MEDIUM)
+		return (&g_zone_mgr.medium_zones);
 	else
 		return (&g_zone_mgr.large_zones);
 }
@@ -75,11 +85,25 @@ static void	ft_zone_init_block_list(ft_zone_t *zone)
 {
 	size_t		usable_size;
 	void		*block_addr;
+	uint8_t		*data;
 	ft_block_t	*block;
 
 	block_addr = (uint8_t *)zone + FT_ZONE_HDR_SIZE;
 	block_addr = ft_align_up_ptr(block_addr, FT_ALIGN_SIZE);
-	usable_size = zone->total_size - ((uint8_t *)block_addr - (uint8_t *)zone);
+	data = block_addr;
+#ifdef FT_OOB_META
+	if (zone->meta_index)
+		block_addr = ft_block_desc_new(zone, data);
+	else
+	{
+		data = ft_align_up_ptr((uint8_t *)block_addr + sizeof(ft_block_t),
+			FT_ALIGN_SIZE);
+		((ft_block_t *)block_addr)->data = data;
+		((ft_block_t *)block_addr)->zone = zone;
+	}
+#endif
+	usable_size = zone->total_size
+		- (data - (uint8_t *)ft_zone_base(zone));
 #if SHOW_MORE
 	block = ft_block_init(block_addr, usable_size, 0); // Arbitrary user size 0 (it's free so won't matter)
 #else
@@ -89,12 +113,125 @@ static void	ft_zone_init_block_list(ft_zone_t *zone)
 	zone->free_head = block;
 }
 
+#ifdef FT_OOB_META
+
+/*
+** ft_zone_meta_map()
+**
+** Maps the side table of a TINY/SMALL/MEDIUM zone: one index entry and
+** room for one descriptor per granule, the most blocks the zone can hold.
+** Only the pages actually used become resident. LARGE zones get none.
+*/
+
+static int	ft_zone_meta_map(ft_zone_t *zone)
+{
+	size_t	granules;
+	void	*side;
+
+	zone->meta_index = NULL;
+	zone->meta = NULL;
+	zone->meta_free = NULL;
+	zone->meta_used = 0;
+	zone->meta_size = 0;
+	zone->data = ft_align_up_ptr((uint8_t *)zone + FT_ZONE_HDR_SIZE,
+		FT_ALIGN_SIZE);
+	if (zone->type == FT_ZONE_LARGE)
+		return (0);
+	granules = zone->total_size / FT_ALIGN_SIZE;
+	zone->meta_size = FT_ALIGN_UP(granules
+		* (sizeof(uint32_t) + sizeof(ft_block_t)), ft_pagesize());
+	side = mmap(NULL, zone->meta_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (side == MAP_FAILED)
+		return (-1);
+	zone->meta_index = side;
+	zone->meta = (ft_block_t *)(zone->meta_index + granules);
+	return (0);
+}
+
+#endif
+
+/*
+** ft_zone_map()
+**
+** Obtains read/write memory for a new zone.
+** With USE_REGION the zone is committed from the reserved heap region,
+** falling back to a dedicated mmap() once the region is exhausted.
+** The prefault policy decides whether the pages are populated right away.
+** With NUMA placement the range is bound to 'node' before any page is
+** touched, so MAP_POPULATE is not used then.
+*/
+
+static void	*ft_zone_map(uint8_t type, size_t total_size, int node)
+{
+	void	*addr;
+	int		populate;
+	int		numa;
+
+	populate = ft_prefault_wanted(type, total_size);
+	numa = ft_numa_active();
+#ifdef USE_REGION
+	addr = ft_region_map(total_size);
+	if (addr)
+	{
+		if (numa)
+			ft_numa_bind(addr, total_size, node);
+		if (populate)
+			ft_prefault_zone(addr, total_size, type, 0);
+		return (addr);
+	}
+#endif
+	addr = mmap(NULL, total_size, PROT_READ | PROT_WRITE, MAP_PRIVATE
+		| MAP_ANONYMOUS | (populate && !numa ? FT_MAP_POPULATE : 0), -1, 0);
+	if (addr == MAP_FAILED)
+		return (NULL);
+	if (numa)
+		ft_numa_bind(addr, total_size, node);
+	if (populate)
+		ft_prefault_zone(addr, total_size, type,
+			!numa && FT_MAP_POPULATE != 0);
+	return (addr);
+}
+
+/*
+** ft_zone_unmap()
+**
+** Returns a zone's memory to the region it came from, or to the OS.
+*/
+
+static void	ft_zone_unmap(void *addr, size_t total_size)
+{
+#ifdef USE_REGION
+	if (ft_region_unmap(addr, total_size))
+		return ;
+#endif
+	munmap(addr, total_size);
+}
+
+/*
+** ft_zone_color()
+**
+** Header offset for the next zone of a type: each non-LARGE zone takes
+** the next of the FT_ZONE_COLORS cache-line offsets.
+*/
+
+static uint32_t	g_zone_color = 0;
+
+static size_t	ft_zone_color(uint8_t type)
+{
+	if (type == FT_ZONE_LARGE)
+		return (0);
+	return ((g_zone_color++ % FT_ZONE_COLORS) * FT_CACHE_LINE);
+}
+
 /*
 ** ft_zone_create()
 **
 ** Creates a new zone using mmap().
-** For TINY/SMALL: allocates multiple pages
+** For TINY/SMALL/MEDIUM: allocates multiple pages
 ** For LARGE: allocates exact size needed (rounded to pagesize)
+** The zone's pages are entered in the page map before it is used, and
+** belong to the calling thread's NUMA node.
 */
 
 ft_zone_t	*ft_zone_create(uint8_t type, size_t size)
@@ -102,14 +239,24 @@ ft_zone_t	*ft_zone_create(uint8_t type, size_t size)
 	ft_zone_t	*zone;
 	size_t		total_size;
 	void		*addr;
+	int			node;
 
 	total_size = ft_calculate_zone_size(type, size);
-	addr = mmap(NULL, total_size, PROT_READ | PROT_WRITE,
-		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-	if (addr == MAP_FAILED)
+	node = ft_numa_node();
+	addr = ft_zone_map(type, total_size, node);
+	if (!addr)
+		return (NULL);
+	zone = (ft_zone_t *)((uint8_t *)addr + ft_zone_color(type));
+	if (ft_pagemap_set(addr, total_size, zone) != 0)
+	{
+		ft_pagemap_set(addr, total_size, NULL);
+		ft_zone_unmap(addr, total_size);
 		return (NULL);
-	zone = (ft_zone_t *)addr;
+	}
 	zone->type = type;
+	zone->node = (uint8_t)node;
+	zone->nursery = 0;
+	zone->color = (uint16_t)((uint8_t *)zone - (uint8_t *)addr);
 	zone->total_size = total_size;
 	zone->used_size = 0;
 	zone->block_count = 0;
@@ -117,8 +264,20 @@ ft_zone_t	*ft_zone_create(uint8_t type, size_t size)
 	zone->free_head = NULL;
 	zone->prev = NULL;
 	zone->next = NULL;
+#ifdef FT_OOB_META
+	if (ft_zone_meta_map(zone) != 0)
+	{
+		ft_pagemap_set(addr, total_size, NULL);
+		ft_zone_unmap(addr, total_size);
+		return (NULL);
+	}
+#endif
 	ft_zone_init_block_list(zone);
 	ft_zone_add(zone);
+	ft_stats_zone_add(zone);
+#ifdef MALLOC_LOGGING
+	mem_trace_zone(FT_TRACE_ZONE_NEW, zone);
+#endif
 	return (zone);
 }
 
@@ -126,7 +285,8 @@ ft_zone_t	*ft_zone_create(uint8_t type, size_t size)
 ** ft_zone_remove()
 **
 ** Removes a zone from its list and unmaps it.
-** Used when a LARGE zone is freed or potentially for empty TINY/SMALL zones.
+** Used when a LARGE zone is freed, and for empty zones of the other types
+** once the trim policy lets them go.
 */
 
 void	ft_zone_remove(ft_zone_t *zone)
@@ -140,7 +300,40 @@ void	ft_zone_remove(ft_zone_t *zone)
 		*list_head = zone->next;
 	if (zone->next)
 		zone->next->prev = zone->prev;
-	munmap(zone, zone->total_size);
+	ft_stats_zone_del(zone);
+#ifdef MALLOC_LOGGING
+	mem_trace_zone(FT_TRACE_ZONE_DEL, zone);
+#endif
+	ft_pagemap_set(ft_zone_base(zone), zone->total_size, NULL);
+#ifdef FT_OOB_META
+	if (zone->meta_index)
+		munmap(zone->meta_index, zone->meta_size);
+#endif
+	ft_zone_unmap(ft_zone_base(zone), zone->total_size);
+}
+
+/*
+** ft_zone_has_spare()
+**
+** Walks the list of the zone's type for another empty zone of the same
+** nursery kind, the only one that could serve the same requests. Only
+** reached when a MEDIUM or nursery zone just became empty: MEDIUM lists are
+** short, their zones are megabytes each.
+*/
+
+int	ft_zone_has_spare(const ft_zone_t *zone)
+{
+	const ft_zone_t	*other;
+
+	other = *ft_zone_get_list(zone->type);
+	while (other)
+	{
+		if (other != zone && other->block_count == 0
+			&& other->nursery == zone->nursery)
+			return (1);
+		other = other->next;
+	}
+	return (0);
 }
 
 /*
@@ -6,6 +6,12 @@
 /* ************************************************************************** */
 
 #include "malloc.h"
+#include "pagemap.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -83,10 +89,10 @@ void	test_large_allocations(void)
 	void	*ptrs[3];
 	int		i;
 
-	WRITE("\n=== Testing LARGE allocations (1025+ bytes) ===\n");
+	WRITE("\n=== Testing LARGE allocations (above mmap_threshold) ===\n");
 	for (i = 0; i < 3; i++)
 	{
-		ptrs[i] = malloc(5000);
+		ptrs[i] = malloc(300000);
 		if (!ptrs[i])
 		{
 			WRITE("ERROR: malloc failed\n");
@@ -94,7 +100,7 @@ void	test_large_allocations(void)
 		}
 	}
 
-	WRITE("Allocated 3 blocks of 5000 bytes each\n");
+	WRITE("Allocated 3 blocks of 300000 bytes each\n");
 	show_alloc_mem();
 
 	WRITE("\nFreeing all blocks...\n");
@@ -160,6 +166,382 @@ void	test_edge_cases(void)
 		WRITE("FAIL\n");
 }
 
+/*
+** Blocks from libc's own allocator, as a program holds them when they were
+** allocated before the library was preloaded: free() and realloc() must
+** hand them back to libc instead of reading an ft_malloc header.
+*/
+
+extern void	*__libc_malloc(size_t size);
+
+/*
+** Invalid pointers go through a volatile so the compiler does not reject
+** the free() of an object it can see was never allocated.
+*/
+
+static char			g_static_buf[64];
+static char *volatile	g_invalid[2];
+
+void	test_foreign_pointers(void)
+{
+	char	stack_buf[64];
+	char	*ptr;
+
+	WRITE("\n=== Testing foreign pointers ===\n");
+
+	WRITE("realloc() of a libc block keeps its data: ");
+	ptr = __libc_malloc(64);
+	memcpy(ptr, "foreign", 8);
+	ptr = realloc(ptr, 4096);
+	if (ptr && memcmp(ptr, "foreign", 8) == 0)
+		WRITE("PASS\n");
+	else
+		WRITE("FAIL\n");
+
+	WRITE("free() of a libc block should not crash: ");
+	free(ptr);
+	WRITE("PASS\n");
+
+	WRITE("free() of a pointer nobody allocated is ignored: ");
+	memset(stack_buf, 0, sizeof(stack_buf));
+	g_invalid[0] = g_static_buf + 16;
+	g_invalid[1] = stack_buf + 16;
+	free(g_invalid[0]);
+	free(g_invalid[1]);
+	WRITE("PASS\n");
+
+	WRITE("realloc() of a pointer nobody allocated fails: ");
+	errno = 0;
+	ptr = realloc(g_invalid[0], 64);
+	if (ptr == NULL && errno == EINVAL && realloc(g_invalid[1], 64) == NULL)
+		WRITE("PASS\n");
+	else
+		WRITE("FAIL\n");
+}
+
+/*
+** Fills four fresh SMALL zones; successive zones must not put their
+** headers at the same offset within a page.
+*/
+
+#define COLOR_BLOCKS	400
+
+void	test_zone_coloring(void)
+{
+	void		*ptrs[COLOR_BLOCKS];
+	ft_zone_t	*zones[4];
+	int			nzones;
+	int			colored;
+	int			i;
+
+	WRITE("\n=== Testing zone cache coloring ===\n");
+	nzones = 0;
+	for (i = 0; i < COLOR_BLOCKS; i++)
+	{
+		ptrs[i] = malloc(1000);
+		if (nzones < 4 && ptrs[i] && (nzones == 0
+				|| ft_pagemap_get(ptrs[i]) != zones[nzones - 1]))
+			zones[nzones++] = ft_pagemap_get(ptrs[i]);
+	}
+	colored = (nzones >= 2);
+	for (i = 1; i < nzones; i++)
+		if (((uintptr_t)zones[i] & 4095) == ((uintptr_t)zones[i - 1] & 4095))
+			colored = 0;
+	WRITE("Successive zone headers use different cache sets: ");
+	if (colored)
+		WRITE("PASS\n");
+	else
+		WRITE("FAIL\n");
+	for (i = 0; i < COLOR_BLOCKS; i++)
+		free(ptrs[i]);
+}
+
+/*
+** show_alloc_mem_ex() is captured through a pipe. The write end is
+** non-blocking: a dump the pipe cannot hold comes back truncated and
+** fails the comparison instead of hanging the test.
+*/
+
+#define SHOW_CAP		(64 * 1024)
+#define SHOW_MANY		400
+
+static char	g_show[SHOW_CAP];
+static char	g_expect[SHOW_CAP];
+
+static size_t	show_capture(int flags)
+{
+	int		fds[2];
+	int		saved;
+	size_t	len;
+	ssize_t	ret;
+
+	if (pipe(fds) != 0)
+		return (0);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	if (flags < 0)
+	{
+		saved = dup(1);
+		dup2(fds[1], 1);
+		show_alloc_mem();
+		dup2(saved, 1);
+		close(saved);
+	}
+	else
+		show_alloc_mem_ex(flags, fds[1]);
+	close(fds[1]);
+	len = 0;
+	while (len < SHOW_CAP - 1
+		&& (ret = read(fds[0], g_show + len, SHOW_CAP - 1 - len)) > 0)
+		len += (size_t)ret;
+	close(fds[0]);
+	g_show[len] = '\0';
+	return (len);
+}
+
+/*
+** Appends to g_expect; once it is full, further output is dropped and
+** the length stays past SHOW_CAP so no comparison can match.
+*/
+
+static size_t	show_append(size_t len, const char *fmt, ...)
+{
+	va_list	ap;
+	int		n;
+
+	if (len >= SHOW_CAP)
+		return (len);
+	va_start(ap, fmt);
+	n = vsnprintf(g_expect + len, SHOW_CAP - len, fmt, ap);
+	va_end(ap);
+	return (n < 0 ? SHOW_CAP : len + (size_t)n);
+}
+
+/*
+** The show_alloc_mem() format, rebuilt from the zone lists: one line per
+** zone, one per allocation, then the total. Sets 'allocs' to the number
+** of allocations.
+*/
+
+static size_t	show_expected(size_t *allocs)
+{
+	static const char	*names[4] = {"TINY", "SMALL", "MEDIUM", "LARGE"};
+	ft_zone_t			*lists[4];
+	ft_zone_t			*zone;
+	ft_block_t			*block;
+	size_t				len;
+	size_t				size;
+	size_t				total;
+	int					i;
+
+	lists[0] = g_zone_mgr.tiny_zones;
+	lists[1] = g_zone_mgr.small_zones;
+	lists[2] = g_zone_mgr.medium_zones;
+	lists[3] = g_zone_mgr.large_zones;
+	len = 0;
+	total = 0;
+	*allocs = 0;
+	for (i = 0; i < 4; i++)
+		for (zone = lists[i]; zone; zone = zone->next)
+		{
+			len = show_append(len, "%s : %lX\n", names[i],
+				(unsigned long)zone);
+			for (block = zone->first_block; block; block = block->next)
+			{
+				if (block->is_free)
+					continue ;
+#if SHOW_MORE
+				size = ft_block_requested(block);
+#else
+				size = block->size - FT_BLOCK_HDR_SIZE;
+#endif
+				if (size == 0)
+					continue ;
+#if SHOW_MORE
+				len = show_append(len,
+					"HEADER: %lX (total block: %zu bytes)\n",
+					(unsigned long)ft_block_start(block), block->size);
+#endif
+				len = show_append(len, "%lX - %lX : %zu bytes\n",
+					(unsigned long)ft_block_data_ptr(block),
+					(unsigned long)ft_block_data_ptr(block) + size, size);
+				total += size;
+				(*allocs)++;
+			}
+		}
+	len = show_append(len, "Total : %zu bytes\n", total);
+	return (len);
+}
+
+static void	show_result(int ok)
+{
+	if (ok)
+		WRITE("PASS\n");
+	else
+		WRITE("FAIL\n");
+}
+
+/*
+** Line of 'out' that starts with 'prefix', or NULL
+*/
+
+static const char	*show_line(const char *out, const char *prefix)
+{
+	size_t	n;
+
+	n = strlen(prefix);
+	while (*out)
+	{
+		if (strncmp(out, prefix, n) == 0)
+			return (out);
+		out = strchr(out, '\n');
+		if (!out)
+			return (NULL);
+		out++;
+	}
+	return (NULL);
+}
+
+static void	test_show_summary(char *a, uintptr_t b)
+{
+	char		line[128];
+	const char	*at;
+	ft_zone_t	*zone;
+	size_t		v[7];
+	int			ok;
+
+	WRITE("FT_SHOW_SUMMARY gives the zone totals: ");
+	zone = ft_pagemap_get(a);
+	show_capture(FT_SHOW_SUMMARY);
+	snprintf(line, sizeof(line), "TINY : %lX\n", (unsigned long)zone);
+	at = show_line(g_show, line);
+	ok = (at && sscanf(at + strlen(line), "  zone %zu bytes, %zu "
+			"allocations, requested %zu, in blocks %zu, free %zu in %zu "
+			"blocks (largest %zu)\n", &v[0], &v[1], &v[2], &v[3], &v[4],
+			&v[5], &v[6]) == 7 && v[0] == zone->total_size
+		&& v[1] == zone->block_count && v[2] == zone->used_size
+		&& v[5] >= 1 && v[6] <= v[4]);
+	snprintf(line, sizeof(line), "%lX - ", (unsigned long)a);
+	show_result(ok && !show_line(g_show, line));
+
+	WRITE("FT_SHOW_FREE maps the freed block: ");
+	show_capture(FT_SHOW_FREE);
+	at = g_show;
+	v[0] = 0;
+	while (at)
+	{
+		if (sscanf(at, "%lX - %lX : %zu bytes free\n", &v[1], &v[2],
+				&v[3]) == 3 && v[1] < b && b < v[2] && v[2] - v[1] == v[3])
+			v[0]++;
+		at = strchr(at, '\n');
+		at = at ? at + 1 : NULL;
+	}
+	show_result(v[0] == 1);
+}
+
+static void	test_show_hexdump(char *a, char *c)
+{
+	char		line[256];
+	const char	*at;
+	int			n;
+
+	WRITE("FT_SHOW_HEXDUMP dumps the requested bytes: ");
+	show_capture(FT_SHOW_ALLOCS | FT_SHOW_HEXDUMP);
+	snprintf(line, sizeof(line), "%lX - ", (unsigned long)a);
+	at = show_line(g_show, line);
+	if (at)
+		at = strchr(at, '\n') + 1;
+	snprintf(line, sizeof(line), "  %lX  73 68 6f 77 5f 61 6c 6c 6f 63 "
+		"5f 6d 65 6d 5f 65  |show_alloc_mem_e|\n  %lX  78 21 21 00%36s"
+		"  |x!!.|\n", (unsigned long)a, (unsigned long)a + 16, "");
+	show_result(at && strncmp(at, line, strlen(line)) == 0);
+
+	WRITE("The hexdump stops after FT_SHOW_HEXDUMP_MAX bytes: ");
+	snprintf(line, sizeof(line), "%lX - ", (unsigned long)c);
+	at = show_line(g_show, line);
+	n = 0;
+	while (at && (at = strchr(at, '\n')) && strncmp(++at, "  ", 2) == 0)
+		n++;
+	show_result(n == FT_SHOW_HEXDUMP_MAX / 16);
+}
+
+static void	test_show_histogram(size_t allocs)
+{
+	const char	*at;
+	size_t		v[3];
+	size_t		count;
+	int			ok;
+
+	WRITE("FT_SHOW_HISTOGRAM buckets every allocation: ");
+	show_capture(FT_SHOW_HISTOGRAM);
+	at = strstr(g_show, " bytes\nHistogram (requested size: count, bytes)\n");
+	ok = (at != NULL);
+	count = 0;
+	while (ok && (at = show_line(at, "  <= ")))
+	{
+		ok = (sscanf(at, "  <= %zu : %zu %zu", &v[0], &v[1], &v[2]) == 3
+			&& v[2] <= v[0] * v[1] && v[2] > v[0] / 2 * v[1]);
+		count += v[1];
+		at++;
+	}
+	show_result(ok && count == allocs
+		&& show_line(g_show, "  <=           32 :")
+		&& show_line(g_show, "  <=         1024 :"));
+}
+
+/*
+** 'a' spans two hexdump lines, 'b' is freed, 'c' is longer than the
+** hexdump. The last check holds more allocations than FT_SHOW_BUF_SIZE
+** (8 KB in show.c) can take, so the buffer is flushed on the way.
+*/
+
+void	test_show_alloc_mem_ex(void)
+{
+	char		*ptrs[SHOW_MANY];
+	char		*a;
+	char		*b;
+	char		*c;
+	uintptr_t	freed;
+	size_t		allocs;
+	size_t		len;
+	int			i;
+
+	WRITE("\n=== Testing show_alloc_mem_ex ===\n");
+	a = malloc(20);
+	b = malloc(100);
+	c = malloc(600);
+	if (!a || !b || !c)
+	{
+		WRITE("ERROR: malloc failed\n");
+		return ;
+	}
+	memcpy(a, "show_alloc_mem_ex!!", 20);
+	memset(b, 'b', 100);
+	memset(c, 'c', 600);
+	freed = (uintptr_t)b + 1;
+	free(b);
+
+	WRITE("show_alloc_mem() keeps its format: ");
+	len = show_expected(&allocs);
+	show_result(show_capture(-1) == len && memcmp(g_show, g_expect, len) == 0);
+	WRITE("FT_SHOW_ALLOCS alone is show_alloc_mem(): ");
+	show_result(show_capture(FT_SHOW_ALLOCS) == len
+		&& memcmp(g_show, g_expect, len) == 0);
+	test_show_summary(a, freed);
+	test_show_hexdump(a, c);
+	test_show_histogram(allocs);
+
+	WRITE("A dump larger than the output buffer is complete: ");
+	for (i = 0; i < SHOW_MANY; i++)
+		ptrs[i] = malloc(24);
+	len = show_expected(&allocs);
+	show_result(len > 8192 && show_capture(FT_SHOW_ALLOCS) == len
+		&& memcmp(g_show, g_expect, len) == 0);
+	for (i = 0; i < SHOW_MANY; i++)
+		free(ptrs[i]);
+	free(a);
+	free(c);
+}
+
 int	main(void)
 {
 	WRITE("====================================\n");
@@ -171,6 +553,9 @@ int	main(void)
 	test_large_allocations();
 	test_realloc();
 	test_edge_cases();
+	test_foreign_pointers();
+	test_zone_coloring();
+	test_show_alloc_mem_ex();
 
 	WRITE("\n====================================\n");
 	WRITE("  ALL TESTS COMPLETED\n");
@@ -0,0 +1,121 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*   test_class_shards.c                                                      */
+/*   Test for the per-thread size-class counter shards                        */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "malloc.h"
+#include "size_class.h"
+#include "stats.h"
+#include "test_util.h"
+#include <pthread.h>
+#include <stdio.h>
+
+#define REQUEST		40
+#define ROUNDS		10
+#define SEQUENTIAL	200
+#define CONCURRENT	(FT_CLASS_SHARDS + 16)
+
+/*
+** Without USE_MALLOC_LOCK the allocator is not thread-safe: the threads
+** below take turns through g_turn, the shards only see distinct threads.
+*/
+
+static pthread_mutex_t		g_turn = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t	g_all_attached;
+static int					g_overflowed;
+
+static size_t	allocs(void)
+{
+	ft_class_stats_t	st[FT_CLASS_COUNT];
+
+	ft_malloc_class_stats(st);
+	return (st[ft_size_class(REQUEST)].allocs);
+}
+
+static void	churn(void)
+{
+	int	i;
+
+	pthread_mutex_lock(&g_turn);
+	for (i = 0; i < ROUNDS; i++)
+		free(keep(malloc(REQUEST)));
+	if (t_ft_shard == &g_ft_class_overflow)
+		g_overflowed++;
+	pthread_mutex_unlock(&g_turn);
+}
+
+static void	*short_lived(void *arg)
+{
+	(void)arg;
+	churn();
+	return (NULL);
+}
+
+static void	*long_lived(void *arg)
+{
+	(void)arg;
+	churn();
+	pthread_barrier_wait(&g_all_attached);
+	churn();
+	return (NULL);
+}
+
+static void	test_recycling(void)
+{
+	pthread_t	thread;
+	size_t		before;
+	int			i;
+
+	printf("\n=== Testing shards of exited threads are reused ===\n");
+	g_overflowed = 0;
+	before = allocs();
+	for (i = 0; i < SEQUENTIAL; i++)
+	{
+		if (pthread_create(&thread, NULL, short_lived, NULL) != 0)
+			break ;
+		pthread_join(thread, NULL);
+	}
+	check(i == SEQUENTIAL, "threads created");
+	check(g_overflowed == 0, "no thread ends up in the overflow shard");
+	check(allocs() - before == (size_t)SEQUENTIAL * ROUNDS,
+		"counts of exited threads are kept");
+}
+
+static void	test_overflow(void)
+{
+	static pthread_t	threads[CONCURRENT];
+	pthread_t			late;
+	size_t				before;
+	int					n;
+	int					i;
+
+	printf("\n=== Testing more live threads than shards ===\n");
+	g_overflowed = 0;
+	before = allocs();
+	pthread_barrier_init(&g_all_attached, NULL, CONCURRENT);
+	for (n = 0; n < CONCURRENT; n++)
+		if (pthread_create(&threads[n], NULL, long_lived, NULL) != 0)
+			break ;
+	check(n == CONCURRENT, "threads created");
+	for (i = 0; i < n; i++)
+		pthread_join(threads[i], NULL);
+	pthread_barrier_destroy(&g_all_attached);
+	check(g_overflowed >= 2 * (CONCURRENT - FT_CLASS_SHARDS),
+		"threads past the pool share the overflow shard");
+	check(allocs() - before == (size_t)CONCURRENT * 2 * ROUNDS,
+		"no count is lost, in private or shared shards");
+	g_overflowed = 0;
+	pthread_create(&late, NULL, short_lived, NULL);
+	pthread_join(late, NULL);
+	check(g_overflowed == 0, "once they exit, a new thread gets its own");
+}
+
+int	main(void)
+{
+	setvbuf(stdout, NULL, _IONBF, 0);
+	test_recycling();
+	test_overflow();
+	return (test_summary());
+}
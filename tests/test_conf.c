@@ -0,0 +1,191 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*   test_conf.c                                                              */
+/*   Test for FT_MALLOC_CONF parsing and the configuration fixups             */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "malloc.h"
+#include "conf.h"
+#include "size_class.h"
+#include "utils.h"
+#include "zone.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+** FT_MALLOC_CONF is parsed once, at load: every case runs in a fresh copy
+** of this program, which reports its configuration on stdout.
+*/
+
+static char	g_out[4096];
+
+static int	child_report(void)
+{
+	const ft_conf_t	*c;
+	char			*p;
+
+	c = ft_conf_get();
+	printf("tiny_max=%zu\nsmall_max=%zu\nmmap_threshold=%zu\n"
+		"tiny_zone_pages=%zu\nsmall_zone_pages=%zu\nmedium_zone_pages=%zu\n"
+		"trim_threshold=%zu\nprof_sample=%zu\nlife_sample=%zu\n",
+		c->tiny_max, c->small_max, c->mmap_threshold, c->tiny_zone_pages,
+		c->small_zone_pages, c->medium_zone_pages, c->trim_threshold,
+		c->prof_sample, c->life_sample);
+	p = malloc(c->small_max);
+	printf("malloc=%s\n", p ? "ok" : "failed");
+	free(p);
+	return (0);
+}
+
+/*
+** Runs this program with FT_MALLOC_CONF set to 'conf' and keeps what it
+** wrote to stdout and stderr in g_out, after a newline so every line of
+** it starts with one.
+*/
+
+static void	run(const char *self, const char *conf)
+{
+	int		fds[2];
+	pid_t	pid;
+	size_t	len;
+	ssize_t	n;
+
+	fflush(stdout);
+	if (pipe(fds) != 0)
+		return ;
+	pid = fork();
+	if (pid == 0)
+	{
+		dup2(fds[1], 1);
+		dup2(fds[1], 2);
+		close(fds[0]);
+		setenv(FT_CONF_ENV, conf, 1);
+		execl(self, self, "--report", (char *)NULL);
+		_exit(127);
+	}
+	close(fds[1]);
+	g_out[0] = '\n';
+	len = 1;
+	while (len < sizeof(g_out) - 1
+		&& (n = read(fds[0], g_out + len, sizeof(g_out) - 1 - len)) > 0)
+		len += (size_t)n;
+	g_out[len] = '\0';
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+}
+
+static size_t	value(const char *key)
+{
+	char	pattern[64];
+	char	*p;
+
+	snprintf(pattern, sizeof(pattern), "\n%s=", key);
+	p = strstr(g_out, pattern);
+	if (!p)
+		return ((size_t)-2);
+	return ((size_t)strtoull(p + strlen(pattern), NULL, 10));
+}
+
+static size_t	class_of(size_t size)
+{
+	return (ft_class_size(ft_size_class(size)));
+}
+
+static void	test_suffixes(const char *self)
+{
+	printf("\n=== Testing values and suffixes ===\n");
+	run(self, "trim_threshold:3k,prof_sample:2M,life_sample:1g");
+	check(value("trim_threshold") == 3 * 1024, "k is 1024");
+	check(value("prof_sample") == 2 * 1024 * 1024, "M is 1024^2");
+	check(value("life_sample") == (size_t)1024 * 1024 * 1024, "g is 1024^3");
+	run(self, "trim_threshold:18446744073709551615");
+	check(value("trim_threshold") == (size_t)-1, "SIZE_MAX is accepted");
+	check(!strstr(g_out, "ft_malloc:"), "without a warning");
+}
+
+static void	test_malformed(const char *self)
+{
+	size_t	prof;
+
+	printf("\n=== Testing rejected pairs ===\n");
+	run(self, "");
+	prof = value("prof_sample");
+	run(self, "tiny_max:12x,small_max:2048");
+	check(strstr(g_out, "malformed pair: tiny_max:12x") != NULL,
+		"a trailing junk character is reported");
+	check(value("tiny_max") == FT_TINY_MAX, "and the value is ignored");
+	check(value("small_max") == 2048, "the next pair still applies");
+	run(self, "tiny_max:,:5,tiny_max,bogus:5");
+	check(strstr(g_out, "malformed pair: tiny_max:\n")
+		&& strstr(g_out, "malformed pair: tiny_max\n"),
+		"empty values and missing colons are reported");
+	check(strstr(g_out, "unknown key: bogus\n")
+		&& strstr(g_out, "unknown key: \n"), "unknown keys are reported");
+	check(value("tiny_max") == FT_TINY_MAX, "nothing changes");
+	run(self, "prof_sample:18446744073709551616");
+	check(strstr(g_out, "malformed pair") && value("prof_sample") == prof,
+		"a decimal overflow is rejected");
+	run(self, "prof_sample:17179869184g");
+	check(strstr(g_out, "malformed pair") && value("prof_sample") == prof,
+		"a suffix overflow is rejected");
+	run(self, "prof_sample:17179869183g");
+	check(!strstr(g_out, "malformed pair")
+		&& value("prof_sample") == (size_t)17179869183 << 30,
+		"the largest g value is accepted");
+}
+
+static void	test_fixups(const char *self)
+{
+	const size_t	ps = ft_pagesize();
+
+	printf("\n=== Testing the fixups ===\n");
+	run(self, "tiny_max:100");
+	check(value("tiny_max") == class_of(100), "limits end on a size class");
+	run(self, "tiny_max:0");
+	check(value("tiny_max") == class_of(1), "TINY is at least one byte");
+	run(self, "tiny_max:512,small_max:100");
+	check(value("small_max") == 512, "SMALL is at least as wide as TINY");
+	run(self, "mmap_threshold:0");
+	check(value("mmap_threshold") == value("small_max"),
+		"the mmap threshold is at least the SMALL limit");
+	run(self, "small_max:1g,tiny_max:1g");
+	check(value("small_max") == class_of(FT_CONF_SMALL_LIMIT)
+		&& value("tiny_max") == class_of(FT_CONF_SMALL_LIMIT),
+		"small_max and tiny_max are capped");
+	check(strstr(g_out, "malloc=ok") != NULL, "SMALL requests still work");
+	run(self, "mmap_threshold:1g");
+	check(value("mmap_threshold") == class_of(FT_CONF_MMAP_LIMIT),
+		"mmap_threshold is capped");
+	check(strstr(g_out, "malloc=ok") != NULL, "allocations still work");
+	run(self, "small_zone_pages:1,tiny_zone_pages:1,medium_zone_pages:1");
+	check(value("tiny_zone_pages") * ps >= FT_ZONE_MIN_ALLOCS
+		* value("tiny_max") && value("small_zone_pages") * ps
+		>= FT_ZONE_MIN_ALLOCS * value("small_max"),
+		"TINY/SMALL zones hold FT_ZONE_MIN_ALLOCS requests");
+	check(value("medium_zone_pages") * ps
+		>= FT_MEDIUM_MIN_ALLOCS * value("mmap_threshold"),
+		"MEDIUM zones hold FT_MEDIUM_MIN_ALLOCS requests");
+}
+
+int	main(int argc, char **argv)
+{
+	char	self[4096];
+	ssize_t	len;
+
+	if (argc > 1 && strcmp(argv[1], "--report") == 0)
+		return (child_report());
+	len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	if (len <= 0)
+		return (1);
+	self[len] = '\0';
+	unsetenv(FT_CONF_ENV);
+	test_suffixes(self);
+	test_malformed(self);
+	test_fixups(self);
+	return (test_summary());
+}
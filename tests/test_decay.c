@@ -0,0 +1,136 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*   test_decay.c                                                             */
+/*   Test for decay-based background purging (decay_ms)                       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "malloc.h"
+#include "conf.h"
+#include "stats.h"
+#include "trim.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BLOCKS		512
+#define KEEP_EVERY	64
+
+static size_t	resident(void)
+{
+	ft_frag_stats_t	fs;
+
+	ft_malloc_frag_stats(&fs);
+	return (fs.resident);
+}
+
+static void	sleep_ms(long ms)
+{
+	const struct timespec	ts = {ms / 1000, (ms % 1000) * 1000000L};
+
+	nanosleep(&ts, NULL);
+}
+
+/*
+** Fills BLOCKS SMALL blocks, then frees all but one in KEEP_EVERY
+*/
+
+static void	make_holes(char **ptrs)
+{
+	int	i;
+
+	for (i = 0; i < BLOCKS; i++)
+	{
+		ptrs[i] = malloc(1000);
+		memset(ptrs[i], 'a' + i % 26, 1000);
+	}
+	for (i = 0; i < BLOCKS; i++)
+		if (i % KEEP_EVERY)
+			free(ptrs[i]);
+}
+
+static int	intact(char **ptrs)
+{
+	int	ok;
+	int	i;
+
+	ok = 1;
+	for (i = 0; i < BLOCKS; i += KEEP_EVERY)
+		ok &= (ptrs[i][0] == 'a' + i % 26 && ptrs[i][999] == ptrs[i][0]);
+	return (ok);
+}
+
+static void	release(char **ptrs)
+{
+	int	i;
+
+	for (i = 0; i < BLOCKS; i += KEEP_EVERY)
+		free(ptrs[i]);
+}
+
+static void	test_curve(void)
+{
+	char	*ptrs[BLOCKS];
+	size_t	before;
+	size_t	released;
+	int		steps;
+
+	printf("\n=== Testing the decay curve (manual steps) ===\n");
+	make_holes(ptrs);
+	before = resident();
+	check(ft_decay_tick() == 0, "memory freed during the step is kept");
+	released = ft_decay_tick();
+	printf("one step: released=%zu of resident=%zu\n", released, before);
+	check(released > 0, "the next step purges some of it");
+	check(released < before / 2, "one step does not purge everything");
+	steps = 2;
+	while (ft_decay_tick() != 0)
+		steps++;
+	printf("purged after %d steps, resident %zu -> %zu\n", steps, before,
+		resident());
+	check(steps > 2 && resident() < before / 2,
+		"further steps purge the rest");
+	check(intact(ptrs), "live blocks keep their data");
+	release(ptrs);
+}
+
+static void	test_thread(void)
+{
+	char	*ptrs[BLOCKS];
+	size_t	before;
+	size_t	arena;
+	int		waited;
+
+	printf("\n=== Testing the decay thread (decay_ms:50) ===\n");
+	check(ft_conf_set("decay_ms", 50) == 0, "decay_ms accepted");
+	make_holes(ptrs);
+	before = resident();
+	waited = 0;
+	while (resident() > before / 4 && waited < 3000)
+	{
+		sleep_ms(50);
+		waited += 50;
+	}
+	printf("resident %zu -> %zu after %d ms\n", before, resident(), waited);
+	check(resident() <= before / 4, "free pages are purged in the background");
+	check(intact(ptrs), "live blocks keep their data");
+	arena = mallinfo2().arena;
+	release(ptrs);
+	waited = 0;
+	while (mallinfo2().arena >= arena && waited < 3000)
+	{
+		sleep_ms(50);
+		waited += 50;
+	}
+	printf("arena %zu -> %zu after %d ms\n", arena, mallinfo2().arena, waited);
+	check(mallinfo2().arena < arena, "empty zones are unmapped");
+	ft_conf_set("decay_ms", 0);
+}
+
+int	main(void)
+{
+	test_curve();
+	test_thread();
+	return (test_summary());
+}
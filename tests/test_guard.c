@@ -0,0 +1,155 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*   test_guard.c                                                             */
+/*   Test for sampled guard-page allocations (make GUARD=1)                   */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "malloc.h"
+#include "conf.h"
+#include "guard.h"
+#include "test_util.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+** expect_crash()
+**
+** Runs 'fn' in a child with every allocation sampled and checks that it
+** dies from 'sig' with 'report' on stderr.
+*/
+
+static void	expect_crash(const char *what, void (*fn)(void), int sig,
+	const char *report)
+{
+	char	buf[8192];
+	size_t	len;
+	ssize_t	n;
+	int		fds[2];
+	int		status;
+	pid_t	pid;
+
+	if (pipe(fds) != 0)
+		return ;
+	fflush(stdout);
+	pid = fork();
+	if (pid == 0)
+	{
+		dup2(fds[1], 2);
+		close(fds[0]);
+		fn();
+		_exit(0);
+	}
+	close(fds[1]);
+	len = 0;
+	while (len < sizeof(buf) - 1
+		&& (n = read(fds[0], buf + len, sizeof(buf) - 1 - len)) > 0)
+		len += (size_t)n;
+	buf[len] = '\0';
+	close(fds[0]);
+	waitpid(pid, &status, 0);
+	check(WIFSIGNALED(status) && WTERMSIG(status) == sig
+		&& strstr(buf, report) && strstr(buf, "allocated by thread"), what);
+	if (g_failures)
+		fputs(buf, stdout);
+}
+
+static void	overflow(void)
+{
+	char	*p;
+
+	p = keep(malloc(32));
+	p[32] = 'x';
+}
+
+static void	use_after_free(void)
+{
+	char	*p;
+
+	p = keep(malloc(100));
+	free(p);
+	p = g_sink;
+	g_sink = (void *)(uintptr_t)*(volatile char *)p;
+}
+
+static void	double_free(void)
+{
+	char	*p;
+
+	p = keep(malloc(100));
+	free(p);
+	free(g_sink);
+}
+
+static void	underflow(void)
+{
+	char	*p;
+
+	ft_conf_set("guard_left", 1);
+	p = keep(malloc(64));
+	p[-1] = 'x';
+}
+
+static void	test_sampled_allocations(void)
+{
+	char	*p;
+	char	*q;
+	char	*big;
+
+	printf("\n=== Testing sampled allocations ===\n");
+	p = keep(malloc(100));
+	check(ft_guard_owns(p), "guard_sample:1 samples every allocation");
+	check(((uintptr_t)p & 15) == 0, "guarded pointer is 16-byte aligned");
+	memset(p, 'a', 100);
+	q = keep(realloc(p, 3000));
+	check(q != p && ft_guard_owns(q) && q[0] == 'a' && q[99] == 'a',
+		"realloc moves the data to another slot");
+	free(q);
+	big = keep(malloc(FT_GUARD_SLOT_PAGES * 4096 + 1));
+	check(big && !ft_guard_owns(big), "larger than a slot goes to the zones");
+	free(big);
+}
+
+static void	test_quarantine(void)
+{
+	void	*first;
+	void	*p;
+	int		reused;
+	int		i;
+
+	printf("\n=== Testing quarantine ===\n");
+	first = keep(malloc(48));
+	free(first);
+	reused = 0;
+	for (i = 0; i < FT_GUARD_SLOTS / 2; i++)
+	{
+		p = keep(malloc(48));
+		reused |= (p == first);
+		free(p);
+	}
+	check(!reused, "freed slot not reused while others are free");
+}
+
+int	main(void)
+{
+	if (ft_conf_set("guard_sample", 1) != 0)
+	{
+		printf("guard_sample key missing: FAIL\n");
+		return (1);
+	}
+	test_sampled_allocations();
+	test_quarantine();
+	printf("\n=== Testing fault reports ===\n");
+	expect_crash("overflow past the block faults", overflow, SIGSEGV,
+		"heap-buffer-overflow");
+	expect_crash("read after free faults", use_after_free, SIGSEGV,
+		"heap-use-after-free");
+	expect_crash("double free aborts", double_free, SIGABRT, "double-free");
+	expect_crash("guard_left catches underflow", underflow, SIGSEGV,
+		"heap-buffer-underflow");
+	return (test_summary());
+}
@@ -0,0 +1,161 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*   test_heap_prof.c                                                         */
+/*   Test for the sampling heap profiler (build with make PROFILING=1)        */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "malloc.h"
+#include "conf.h"
+#include "heap_prof.h"
+#include "test_util.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define KEPT		40
+#define FREED		25
+#define SIZE		100
+
+/*
+** One parsed line of the profile: counts, then the call stack
+*/
+
+typedef struct s_entry
+{
+	size_t	inuse_objs;
+	size_t	inuse_bytes;
+	size_t	alloc_objs;
+	size_t	alloc_bytes;
+	int		depth;
+}	t_entry;
+
+static __attribute__((noinline)) void	*kept_site(size_t size)
+{
+	return (keep(malloc(size)));
+}
+
+static __attribute__((noinline)) void	*freed_site(size_t size)
+{
+	char	*ptr;
+
+	ptr = keep(malloc(size));
+	if (ptr)
+		ptr[0] = 'f';
+	return (ptr);
+}
+
+static int	parse_counts(const char *line, t_entry *e)
+{
+	int		n;
+
+	n = 0;
+	if (sscanf(line, " %zu: %zu [ %zu: %zu] @%n", &e->inuse_objs,
+		&e->inuse_bytes, &e->alloc_objs, &e->alloc_bytes, &n) != 4 || n == 0)
+		return (-1);
+	return (n);
+}
+
+/*
+** Counts the hex addresses after '@'; -1 if anything else is there
+*/
+
+static int	parse_stack(const char *s)
+{
+	uintptr_t	pc;
+	int			depth;
+	int			n;
+
+	depth = 0;
+	while (sscanf(s, " 0x%" SCNxPTR "%n", &pc, &n) == 1)
+	{
+		depth++;
+		s += n;
+	}
+	return (*s == '\n' || *s == '\0' ? depth : -1);
+}
+
+static void	test_profile(const char *path)
+{
+	static char	line[8192];
+	FILE		*f;
+	t_entry		total;
+	t_entry		e;
+	t_entry		sum;
+	int			n;
+	int			stacks;
+	int			ok;
+	int			kept;
+	int			freed;
+	int			maps;
+
+	f = fopen(path, "r");
+	check(f != NULL, "the profile was written");
+	if (!f)
+		return ;
+	n = -1;
+	if (fgets(line, sizeof(line), f)
+		&& strncmp(line, "heap profile: ", 14) == 0)
+		n = parse_counts(line + 14, &total);
+	check(n > 0 && strcmp(line + 14 + n, " heap_v2/1\n") == 0,
+		"the header gives the totals and the sampling rate");
+	memset(&sum, 0, sizeof(sum));
+	stacks = 0;
+	ok = 1;
+	kept = 0;
+	freed = 0;
+	maps = 0;
+	while (fgets(line, sizeof(line), f) && line[0] == ' ')
+	{
+		n = parse_counts(line, &e);
+		e.depth = n > 0 ? parse_stack(line + n) : -1;
+		ok &= (e.depth > 0 && e.alloc_objs >= e.inuse_objs);
+		stacks++;
+		sum.inuse_objs += e.inuse_objs;
+		sum.inuse_bytes += e.inuse_bytes;
+		sum.alloc_objs += e.alloc_objs;
+		sum.alloc_bytes += e.alloc_bytes;
+		kept += (e.inuse_objs == KEPT && e.inuse_bytes == KEPT * SIZE
+			&& e.alloc_objs == KEPT);
+		freed += (e.inuse_objs == 0 && e.alloc_objs == FREED
+			&& e.alloc_bytes == FREED * SIZE);
+	}
+	while (fgets(line, sizeof(line), f))
+		maps += (strcmp(line, "MAPPED_LIBRARIES:\n") == 0);
+	fclose(f);
+	check(stacks >= 2 && ok, "every stack line has counts and addresses");
+	check(sum.inuse_objs == total.inuse_objs
+		&& sum.inuse_bytes == total.inuse_bytes
+		&& sum.alloc_objs == total.alloc_objs
+		&& sum.alloc_bytes == total.alloc_bytes,
+		"the header is the sum of the stack lines");
+	check(kept == 1, "the kept site is one line with its live blocks");
+	check(freed == 1, "the freed site is another, with nothing in use");
+	check(maps == 1, "the mappings follow the stacks");
+}
+
+int	main(void)
+{
+	void	*ptrs[KEPT];
+	char	path[64];
+	int		i;
+
+	setvbuf(stdout, NULL, _IONBF, 0);
+	printf("\n=== Testing the profile format ===\n");
+	snprintf(path, sizeof(path), "/tmp/test_heap_prof_%d.heap", (int)getpid());
+	ft_conf_set("prof_sample", 1);
+	for (i = 0; i < KEPT; i++)
+		ptrs[i] = kept_site(SIZE);
+	for (i = 0; i < FREED; i++)
+		free(freed_site(SIZE));
+	check(ft_malloc_prof_dump(path) == 0, "ft_malloc_prof_dump() succeeds");
+	ft_conf_set("prof_sample", 0);
+	test_profile(path);
+	unlink(path);
+	setenv(FT_PROF_ENV, "/dev/null", 1);
+	for (i = 0; i < KEPT; i++)
+		free(ptrs[i]);
+	return (test_summary());
+}
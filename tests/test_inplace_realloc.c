@@ -6,9 +6,13 @@
 /* ************************************************************************** */
 
 #include "malloc.h"
+#include "test_util.h"
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 
 static void	ft_write(const char *s, size_t len)
 {
@@ -173,6 +177,46 @@ void	test_extend_too_large(void)
 	free(new_ptr);
 }
 
+/*
+** A moved block copies only its own bytes. A LARGE block is sized to end
+** on a page boundary, and a child maps a PROT_NONE page right after it:
+** reading past the end of the old block faults the child.
+*/
+
+#define MOVE_SIZE	(1 << 20)
+
+void	test_move_at_page_end(void)
+{
+	size_t	page;
+	size_t	size;
+	char	*ptr;
+	pid_t	pid;
+	int		status;
+
+	WRITE("\n=== Test 4: Moving a block that ends on a page boundary ===\n");
+	page = (size_t)getpagesize();
+	ptr = keep(malloc(MOVE_SIZE));
+	size = MOVE_SIZE + page - ((uintptr_t)ptr & (page - 1));
+	free(ptr);
+	ptr = keep(malloc(size));
+	memset(ptr, 'M', size);
+	pid = fork();
+	if (pid == 0)
+	{
+		if (mmap(ptr + size, page, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS
+			| MAP_FIXED, -1, 0) == MAP_FAILED)
+			_exit(2);
+		ptr = realloc(ptr, size * 2);
+		_exit(!ptr || ptr[0] != 'M' || ptr[size - 1] != 'M');
+	}
+	waitpid(pid, &status, 0);
+	check(((uintptr_t)(ptr + size) & (page - 1)) == 0,
+		"the block ends on a page boundary");
+	check(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+		"realloc() does not read past the old block");
+	free(ptr);
+}
+
 int	main(void)
 {
 	WRITE("====================================\n");
@@ -182,11 +226,12 @@ int	main(void)
 	test_inplace_extension();
 	test_cannot_extend();
 	test_extend_too_large();
+	test_move_at_page_end();
 
 	WRITE("\n====================================\n");
 	WRITE("  ALL TESTS COMPLETED\n");
 	WRITE("====================================\n");
 
-	return (0);
+	return (g_failures != 0);
 }
 
@@ -0,0 +1,221 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*   test_lifetime.c                                                          */
+/*   Test for call-site lifetime prediction (build with make LIFETIME=1)      */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "malloc.h"
+#include "conf.h"
+#include "lifetime.h"
+#include "pagemap.h"
+#include "zone.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <string.h>
+
+/*
+** One call site each: the return address inside these functions is what
+** the allocator learns about. Their bodies differ so the compiler cannot
+** fold them into one function, and one site.
+*/
+
+static __attribute__((noinline)) void	*short_site(size_t size)
+{
+	return (keep(malloc(size)));
+}
+
+static __attribute__((noinline)) void	*long_site(size_t size)
+{
+	char	*ptr;
+
+	ptr = keep(malloc(size));
+	if (ptr)
+		memset(ptr, 'l', size);
+	return (ptr);
+}
+
+static __attribute__((noinline)) void	*grow_site(void *ptr, size_t size)
+{
+	return (keep(realloc(ptr, size)));
+}
+
+static __attribute__((noinline)) void	filler_site(size_t bytes)
+{
+	size_t	done;
+
+	for (done = 0; done < bytes; done += 100000)
+		free(keep(malloc(100000)));
+}
+
+static int	in_nursery(void *ptr)
+{
+	return (((ft_zone_t *)ft_pagemap_get(ptr))->nursery != 0);
+}
+
+static void	teach_short(int rounds)
+{
+	int	i;
+
+	for (i = 0; i < rounds; i++)
+		free(short_site(64));
+}
+
+static void	test_prediction(void)
+{
+	void	*ptrs[32];
+	void	*p;
+	void	*q;
+	int		i;
+
+	printf("\n=== Testing sites are told apart ===\n");
+	p = short_site(64);
+	check(!in_nursery(p), "an unknown site is not a nursery site");
+	free(p);
+	teach_short(2 * FT_LIFE_NURSERY);
+	for (i = 0; i < 32; i++)
+		ptrs[i] = long_site(64);
+	filler_site(2 * FT_LIFE_SHORT);
+	for (i = 0; i < 32; i++)
+		free(ptrs[i]);
+	p = short_site(64);
+	q = long_site(64);
+	check(in_nursery(p), "a site freeing at once goes to a nursery zone");
+	check(!in_nursery(q), "a site keeping its objects does not");
+	check(ft_pagemap_get(p) != ft_pagemap_get(q), "they share no zone");
+	free(p);
+	free(q);
+}
+
+static void	test_demotion(void)
+{
+	void	*ptrs[8];
+	void	*p;
+	int		i;
+
+	printf("\n=== Testing a site that changes its mind ===\n");
+	teach_short(FT_LIFE_SCORE_MAX);
+	for (i = 0; i < 8; i++)
+		ptrs[i] = short_site(64);
+	filler_site(2 * FT_LIFE_SHORT);
+	for (i = 0; i < 8; i++)
+		free(ptrs[i]);
+	p = short_site(64);
+	check(!in_nursery(p), "long lifetimes take the nursery status back");
+	free(p);
+	teach_short(4 * FT_LIFE_SCORE_MAX);
+}
+
+/*
+** One buffer grown by realloc() for the whole run: every move must carry
+** its sample along instead of ending it as a short life. A kept object of
+** the same size follows each step, so the next one cannot grow in place.
+*/
+
+static void	test_realloc_growth(void)
+{
+	void	*walls[12];
+	char	*buf;
+	char	*prev;
+	int		moves;
+	int		i;
+
+	printf("\n=== Testing a buffer grown by realloc() ===\n");
+	buf = NULL;
+	moves = 0;
+	for (i = 0; i < 12; i++)
+	{
+		prev = buf;
+		buf = grow_site(buf, (size_t)64 << i);
+		buf[64 * i] = (char)i;
+		moves += (prev && buf != prev);
+		walls[i] = long_site((size_t)64 << i);
+	}
+	check(moves > FT_LIFE_NURSERY, "the buffer moved many times");
+	prev = grow_site(NULL, 64);
+	check(!in_nursery(prev), "moves are not short lives");
+	free(prev);
+	for (i = 0; i < 12 && buf[64 * i] == (char)i; i++)
+		;
+	check(i == 12, "contents kept");
+	free(buf);
+	for (i = 0; i < 12; i++)
+		free(walls[i]);
+}
+
+/*
+** The list head is read through a volatile: the compiler assumes malloc()
+** and free() leave globals alone.
+*/
+
+static void	count_nurseries(int *zones, int *empty)
+{
+	ft_zone_t	*zone;
+
+	*zones = 0;
+	*empty = 0;
+	zone = *(ft_zone_t *volatile *)&g_zone_mgr.tiny_zones;
+	while (zone)
+	{
+		*zones += (zone->nursery != 0);
+		*empty += (zone->nursery != 0 && zone->block_count == 0);
+		zone = zone->next;
+	}
+}
+
+static void	test_release(void)
+{
+	static void	*ptrs[4096];
+	int			zones;
+	int			empty;
+	int			ok;
+	int			i;
+
+	printf("\n=== Testing nursery zones empty out ===\n");
+	ok = 1;
+	for (i = 0; i < 4096; i++)
+	{
+		ptrs[i] = short_site(64);
+		memset(ptrs[i], 'n', 64);
+		ok &= in_nursery(ptrs[i]);
+	}
+	check(ok, "every object of a nursery site is in a nursery zone");
+	count_nurseries(&zones, &empty);
+	check(zones >= 2, "4096 objects need several nursery zones");
+	for (i = 0; i < 4096; i++)
+		free(ptrs[i]);
+	count_nurseries(&zones, &empty);
+	check(zones == empty, "nothing pins a nursery zone once freed");
+	check(zones <= 1, "only one empty nursery zone stays mapped");
+}
+
+static void	test_off(void)
+{
+	void	*ptrs[8];
+	void	*p;
+	int		i;
+
+	printf("\n=== Testing life_sample:0 ===\n");
+	ft_conf_set("life_sample", 0);
+	for (i = 0; i < 8; i++)
+		ptrs[i] = short_site(64);
+	filler_site(2 * FT_LIFE_SHORT);
+	for (i = 0; i < 8; i++)
+		free(ptrs[i]);
+	p = short_site(64);
+	check(in_nursery(p), "nothing is learned, predictions stay");
+	free(p);
+	ft_conf_set("life_sample", FT_LIFE_SAMPLE);
+}
+
+int	main(void)
+{
+	setvbuf(stdout, NULL, _IONBF, 0);
+	ft_conf_set("life_sample", 1);
+	test_prediction();
+	test_demotion();
+	test_realloc_growth();
+	test_release();
+	test_off();
+	return (test_summary());
+}
@@ -0,0 +1,179 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*   test_mallinfo.c                                                          */
+/*   Test for mallinfo2() / mallopt() statistics                              */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "malloc.h"
+#include "stats.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <string.h>
+
+static void	print_info(const char *label, struct mallinfo2 mi)
+{
+	printf("%-14s arena=%zu ordblks=%zu hblks=%zu hblkhd=%zu "
+		"uordblks=%zu fordblks=%zu keepcost=%zu\n", label, mi.arena,
+		mi.ordblks, mi.hblks, mi.hblkhd, mi.uordblks, mi.fordblks,
+		mi.keepcost);
+}
+
+void	test_counters(void)
+{
+	struct mallinfo2	before;
+	struct mallinfo2	mid;
+	struct mallinfo2	after;
+	void				*ptrs[20];
+	void				*large;
+	int					i;
+
+	printf("\n=== Testing mallinfo2 counters ===\n");
+	before = mallinfo2();
+	print_info("before", before);
+	for (i = 0; i < 20; i++)
+		ptrs[i] = keep(malloc(i % 2 ? 40 : 400));
+	large = keep(malloc(1000000));
+	mid = mallinfo2();
+	print_info("allocated", mid);
+	check(mid.uordblks >= before.uordblks + 10 * 40 + 10 * 400,
+		"uordblks grows by at least the requested bytes");
+	check(mid.hblks == before.hblks + 1, "one more LARGE allocation");
+	check(mid.hblkhd >= before.hblkhd + 1000000, "hblkhd covers it");
+	check(mid.uordblks + mid.fordblks <= mid.arena,
+		"in use + free fits in the zones");
+	for (i = 0; i < 20; i += 2)
+		free(ptrs[i]);
+	free(large);
+	after = mallinfo2();
+	print_info("half freed", after);
+	check(after.hblks == before.hblks, "LARGE allocation released");
+	check(after.ordblks > before.ordblks, "freed holes are free blocks");
+	for (i = 1; i < 20; i += 2)
+		free(ptrs[i]);
+	after = mallinfo2();
+	print_info("all freed", after);
+	check(after.uordblks == before.uordblks, "uordblks back to start");
+	check(after.fordblks + after.uordblks == mid.fordblks + mid.uordblks,
+		"free bytes absorbed everything");
+	check(after.keepcost == after.arena, "every zone is empty again");
+}
+
+void	test_mallopt(void)
+{
+	struct mallinfo2	mi;
+	void				*ptr;
+
+	printf("\n=== Testing mallopt ===\n");
+	check(mallopt(M_TOP_PAD, 0) == 0, "M_TOP_PAD is rejected");
+	check(mallopt(M_MMAP_THRESHOLD, 512) == 1, "M_MMAP_THRESHOLD accepted");
+	mi = mallinfo2();
+	ptr = keep(malloc(800));
+	check(mallinfo2().hblks == mi.hblks + 1, "800 bytes is now LARGE");
+	free(ptr);
+	check(mallopt(M_TRIM_THRESHOLD, 0) == 1, "M_TRIM_THRESHOLD accepted");
+	ptr = keep(malloc(40));
+	free(ptr);
+	ptr = keep(malloc(400));
+	free(ptr);
+	mi = mallinfo2();
+	print_info("trimmed", mi);
+	check(mi.keepcost == 0 && mi.arena == 0, "empty zones are unmapped");
+}
+
+void	test_frag_stats(void)
+{
+	ft_frag_stats_t	before;
+	ft_frag_stats_t	fs;
+	char			*ptrs[64];
+	int				i;
+
+	printf("\n=== Testing ft_malloc_frag_stats ===\n");
+	check(ft_malloc_frag_stats(&before) == 0, "frag stats readable");
+	for (i = 0; i < 64; i++)
+	{
+		ptrs[i] = keep(malloc(100));
+		memset(ptrs[i], 'x', 100);
+	}
+	ptrs[0] = keep(realloc(ptrs[0], 60));
+	ft_malloc_frag_stats(&fs);
+	printf("requested=%zu allocated=%zu free=%zu mapped=%zu resident=%zu "
+		"internal=%.3f external=%.3f overhead=%.3f\n", fs.requested,
+		fs.allocated, fs.free, fs.mapped, fs.resident, fs.internal,
+		fs.external, fs.overhead);
+	check(fs.requested == before.requested + 63 * 100 + 60,
+		"requested bytes are exact, realloc included");
+	check(fs.allocated > fs.requested, "blocks are larger than requests");
+	check(fs.internal > 0.0 && fs.internal < 1.0, "internal ratio in (0,1)");
+	check(fs.resident > 0 && fs.resident <= fs.mapped,
+		"resident bytes within the mappings");
+	for (i = 0; i < 64; i += 2)
+		free(ptrs[i]);
+	ft_malloc_frag_stats(&fs);
+	printf("holes: free=%zu largest_tiny=%zu external=%.3f\n", fs.free,
+		fs.largest_free[0], fs.external);
+	check(fs.external > 0.0, "holes show up as external fragmentation");
+	for (i = 1; i < 64; i += 2)
+		free(ptrs[i]);
+	ft_malloc_frag_stats(&fs);
+	check(fs.requested == before.requested, "requested bytes back to start");
+}
+
+#define TRIM_BLOCKS	512
+
+void	test_trim(void)
+{
+	ft_frag_stats_t	before;
+	ft_frag_stats_t	after;
+	char			*ptrs[TRIM_BLOCKS];
+	size_t			released;
+	int				intact;
+	int				i;
+
+	printf("\n=== Testing malloc_trim ===\n");
+	for (i = 0; i < TRIM_BLOCKS; i++)
+	{
+		ptrs[i] = keep(malloc(1000));
+		memset(ptrs[i], 'a' + i % 26, 1000);
+	}
+	for (i = 0; i < TRIM_BLOCKS; i++)
+		if (i % 64)
+			free(ptrs[i]);
+	ft_malloc_frag_stats(&before);
+	released = ft_malloc_trim(0);
+	ft_malloc_frag_stats(&after);
+	printf("released=%zu resident before=%zu after=%zu\n", released,
+		before.resident, after.resident);
+	check(released > 0, "free pages inside live zones are released");
+	check(after.resident < before.resident, "resident memory goes down");
+	intact = 1;
+	for (i = 0; i < TRIM_BLOCKS; i += 64)
+		intact &= (ptrs[i][0] == 'a' + i % 26 && ptrs[i][999] == ptrs[i][0]);
+	check(intact, "live blocks keep their data");
+	check(ft_malloc_trim(0) == 0, "a second trim has nothing left to do");
+	check(malloc_trim(0) == 0, "malloc_trim() reports 0 when nothing moved");
+	ptrs[1] = keep(malloc(1000));
+	memset(ptrs[1], 'z', 1000);
+	check(ptrs[1][500] == 'z', "trimmed blocks can be reused");
+	free(ptrs[1]);
+	for (i = 0; i < TRIM_BLOCKS; i += 64)
+		free(ptrs[i]);
+	check(ft_malloc_trim(0) > 0 && mallinfo2().arena == 0,
+		"cached empty zones are unmapped");
+}
+
+int	main(void)
+{
+	setvbuf(stdout, NULL, _IONBF, 0); /* no stdio buffer in the zones */
+	printf("====================================\n");
+	printf("  MALLINFO2 / MALLOPT TEST\n");
+	printf("====================================\n");
+	test_counters();
+	test_frag_stats();
+	test_trim();
+	test_mallopt();
+	printf("\n====================================\n");
+	printf("  %s\n", g_failures ? "SOME TESTS FAILED" : "ALL TESTS PASSED");
+	printf("====================================\n");
+	return (g_failures != 0);
+}
@@ -0,0 +1,142 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*   test_medium.c                                                            */
+/*   Test for MEDIUM zones (requests between small_max and mmap_threshold)    */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "malloc.h"
+#include "conf.h"
+#include "utils.h"
+#include "zone.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <string.h>
+
+static size_t	medium_zone_size(void)
+{
+	return (ft_conf_get()->medium_zone_pages * ft_pagesize());
+}
+
+/*
+** MEDIUM zones in the list, all of them or only the empty ones. stdio
+** buffers are MEDIUM requests too, so the counts are compared, not
+** expected to be zero. The list head is read through a volatile: the
+** compiler assumes malloc() and free() leave globals alone.
+*/
+
+static int	count_zones(int empty_only)
+{
+	ft_zone_t	*zone;
+	int			n;
+
+	n = 0;
+	zone = *(ft_zone_t *volatile *)&g_zone_mgr.medium_zones;
+	while (zone)
+	{
+		if (!empty_only || zone->block_count == 0)
+			n++;
+		zone = zone->next;
+	}
+	return (n);
+}
+
+static void	test_shared_zone(void)
+{
+	struct mallinfo2	before;
+	struct mallinfo2	mid;
+	char				*ptrs[64];
+	char				*lo;
+	char				*hi;
+	int					zones;
+	int					i;
+
+	printf("\n=== Testing MEDIUM requests share a zone ===\n");
+	before = mallinfo2();
+	zones = count_zones(0);
+	lo = NULL;
+	hi = NULL;
+	for (i = 0; i < 64; i++)
+	{
+		ptrs[i] = keep(malloc(2048));
+		memset(ptrs[i], 'm', 2048);
+		if (!lo || ptrs[i] < lo)
+			lo = ptrs[i];
+		if (!hi || ptrs[i] > hi)
+			hi = ptrs[i];
+	}
+	mid = mallinfo2();
+	check(mid.hblks == before.hblks, "2 KiB requests are not LARGE");
+	check(count_zones(0) <= zones + 1 && mid.arena <= before.arena
+		+ medium_zone_size(), "64 requests map at most one MEDIUM zone");
+	check((size_t)(hi - lo) < medium_zone_size(), "all in one zone");
+	for (i = 0; i < 64; i++)
+		free(ptrs[i]);
+	check(mallinfo2().arena == mid.arena, "an empty zone is kept as spare");
+}
+
+static void	test_realloc_growth(void)
+{
+	char	*p;
+	char	*q;
+
+	printf("\n=== Testing realloc growth inside a MEDIUM zone ===\n");
+	p = keep(malloc(2000));
+	memset(p, 'g', 2000);
+	q = keep(realloc(p, 100000));
+	check(q == p, "growing into free space stays in place");
+	check(q[0] == 'g' && q[1999] == 'g', "contents kept");
+	free(q);
+}
+
+static void	test_spare(void)
+{
+	char	*ptrs[80];
+	int		zones;
+	int		i;
+
+	printf("\n=== Testing empty MEDIUM zones are released ===\n");
+	zones = count_zones(0);
+	for (i = 0; i < 80; i++)
+		ptrs[i] = keep(malloc(200000));
+	check(count_zones(0) >= zones + 2,
+		"80 x 200000 bytes need more MEDIUM zones");
+	for (i = 0; i < 80; i++)
+		free(ptrs[i]);
+	check(count_zones(1) == 1, "only one empty zone stays mapped");
+	check(count_zones(0) <= zones + 1, "the others are unmapped");
+}
+
+static void	test_threshold(void)
+{
+	struct mallinfo2	before;
+	void				*medium;
+	void				*large;
+
+	printf("\n=== Testing the mmap threshold ===\n");
+	before = mallinfo2();
+	medium = keep(malloc(FT_MMAP_THRESHOLD));
+	check(mallinfo2().hblks == before.hblks, "FT_MMAP_THRESHOLD is MEDIUM");
+	large = keep(malloc(FT_MMAP_THRESHOLD + 1));
+	check(mallinfo2().hblks == before.hblks + 1, "one byte more is LARGE");
+	free(medium);
+	free(large);
+	ft_conf_set("mmap_threshold", 8192);
+	check(ft_zone_get_type(8192) == FT_ZONE_MEDIUM
+		&& ft_zone_get_type(8193) == FT_ZONE_LARGE,
+		"mmap_threshold moves the limit");
+	ft_conf_set("mmap_threshold", 0);
+	check(ft_conf_get()->mmap_threshold == ft_conf_get()->small_max
+		&& ft_zone_get_type(ft_conf_get()->small_max + 1) == FT_ZONE_LARGE,
+		"mmap_threshold below small_max turns MEDIUM off");
+	ft_conf_set("mmap_threshold", FT_MMAP_THRESHOLD);
+}
+
+int	main(void)
+{
+	test_shared_zone();
+	test_realloc_growth();
+	test_spare();
+	test_threshold();
+	return (test_summary());
+}
@@ -0,0 +1,101 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*   test_numa.c                                                              */
+/*   Test for NUMA-aware zone placement on a simulated topology               */
+/*                                                                            */
+/* ************************************************************************** */
+
+#define _GNU_SOURCE
+#include "malloc.h"
+#include "conf.h"
+#include "numa.h"
+#include "pagemap.h"
+#include "test_util.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define THREADS		8
+#define PER_THREAD	64
+
+typedef struct s_worker
+{
+	int		node;
+	void	*ptrs[PER_THREAD];
+}	t_worker;
+
+static void	*worker(void *arg)
+{
+	t_worker	*w;
+	int			i;
+
+	w = arg;
+	w->node = (int)(syscall(SYS_gettid) % 2);
+	for (i = 0; i < PER_THREAD; i++)
+		w->ptrs[i] = malloc(i % 2 ? 48 : 600);
+	return (NULL);
+}
+
+static void	test_fallback(void)
+{
+	printf("\n=== Testing single-node fallback ===\n");
+	ft_conf_set("numa", 1);
+	ft_conf_set("numa_nodes", 1);
+	check(!ft_numa_active(), "one node: placement stays off");
+	check(ft_numa_node() == 0, "one node: every thread is on node 0");
+	ft_conf_set("numa", 0);
+}
+
+static void	test_simulated_nodes(void)
+{
+	pthread_t	tids[THREADS];
+	t_worker	w[THREADS];
+	ft_zone_t	*zone;
+	int			local;
+	int			shared;
+	int			i;
+	int			j;
+	int			k;
+
+	printf("\n=== Testing placement on 2 simulated nodes ===\n");
+	ft_conf_set("numa_nodes", 2);
+	ft_conf_set("numa", 1);
+	check(ft_numa_active(), "two nodes: placement is on");
+	for (i = 0; i < THREADS; i++)
+	{
+		pthread_create(&tids[i], NULL, worker, &w[i]);
+		pthread_join(tids[i], NULL);
+	}
+	k = 0;
+	for (i = 0; i < THREADS; i++)
+		k |= 1 << w[i].node;
+	check(k == 3, "threads ran on both nodes");
+	local = 1;
+	shared = 0;
+	for (i = 0; i < THREADS; i++)
+		for (j = 0; j < PER_THREAD; j++)
+		{
+			zone = ft_pagemap_get(w[i].ptrs[j]);
+			local &= (zone && zone->node == w[i].node);
+			for (k = 0; k < THREADS; k++)
+				if (w[k].node != w[i].node
+					&& ft_pagemap_get(w[k].ptrs[j]) == zone)
+					shared = 1;
+		}
+	check(local, "every block lives in a zone of its thread's node");
+	check(!shared, "threads on different nodes never share a zone");
+	for (i = 0; i < THREADS; i++)
+		for (j = 0; j < PER_THREAD; j++)
+			free(w[i].ptrs[j]);
+	ft_conf_set("numa", 0);
+	ft_conf_set("numa_nodes", 0);
+}
+
+int	main(void)
+{
+	test_fallback();
+	test_simulated_nodes();
+	return (test_summary());
+}
@@ -0,0 +1,79 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*   test_oob.c                                                               */
+/*   Test for out-of-band block metadata (make OOB=1)                         */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "malloc.h"
+#include "stats.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <string.h>
+
+static void	test_packing(void)
+{
+	char	*ptrs[8];
+	int		packed;
+	int		i;
+
+	printf("\n=== Testing packed user data ===\n");
+	for (i = 0; i < 8; i++)
+		ptrs[i] = keep(malloc(32));
+	packed = 1;
+	for (i = 1; i < 8; i++)
+		packed &= (ptrs[i] == ptrs[i - 1] + 32);
+	check(packed, "32-byte blocks are 32 bytes apart");
+	for (i = 0; i < 8; i++)
+		free(ptrs[i]);
+}
+
+static void	test_overrun(void)
+{
+	struct mallinfo2	before;
+	char				*a;
+	char				*b;
+	char				*c;
+
+	printf("\n=== Testing an overrun into the next block ===\n");
+	before = mallinfo2();
+	a = keep(malloc(32));
+	b = keep(malloc(32));
+	memset(b, 'b', 32);
+	memset(a, 0xff, 40);
+	check(b[8] == 'b' && b[7] == (char)0xff, "the overrun hit user data only");
+	free(a);
+	a = keep(malloc(32));
+	c = keep(realloc(b, 64));
+	free(a);
+	free(c);
+	check(mallinfo2().uordblks == before.uordblks
+		&& mallinfo2().ordblks == before.ordblks,
+		"the allocator lists survived the overrun");
+}
+
+static void	test_trim_whole_blocks(void)
+{
+	char	*ptrs[3];
+	size_t	released;
+
+	printf("\n=== Testing trim without inline headers ===\n");
+	ptrs[0] = keep(malloc(1000));
+	ptrs[1] = keep(malloc(1000));
+	ptrs[2] = keep(malloc(1000));
+	memset(ptrs[1], 'x', 1000);
+	free(ptrs[0]);
+	free(ptrs[1]);
+	released = ft_malloc_trim(0);
+	printf("released=%zu\n", released);
+	check(released > 0, "free pages are released");
+	free(ptrs[2]);
+}
+
+int	main(void)
+{
+	test_packing();
+	test_overrun();
+	test_trim_whole_blocks();
+	return (test_summary());
+}
@@ -0,0 +1,194 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*   test_prefault.c                                                          */
+/*   Test for the prefault policy and its counters                            */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "malloc.h"
+#include "prefault.h"
+#include "utils.h"
+#include "test_util.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/*
+** LARGE blocks stay under 2 MiB so transparent huge pages cannot make a
+** lazily mapped block resident as a whole.
+*/
+
+#define LARGE_SIZE		(600 * 1024)
+#define LARGE_MIN		(512 * 1024)
+#define MEDIUM_SIZE		200000
+
+/*
+** Resident pages among the whole pages of [ptr, ptr + len)
+*/
+
+static size_t	resident(const void *ptr, size_t len)
+{
+	static unsigned char	vec[1024];
+	uintptr_t				start;
+	uintptr_t				end;
+	size_t					pages;
+	size_t					n;
+	size_t					i;
+
+	start = ((uintptr_t)ptr + ft_pagesize() - 1) & ~(ft_pagesize() - 1);
+	end = ((uintptr_t)ptr + len) & ~(ft_pagesize() - 1);
+	if (end <= start)
+		return (0);
+	pages = (end - start) / ft_pagesize();
+	if (pages > sizeof(vec)
+		|| mincore((void *)start, end - start, vec) != 0)
+		return ((size_t)-1);
+	n = 0;
+	for (i = 0; i < pages; i++)
+		n += vec[i] & 1;
+	return (n);
+}
+
+/*
+** Whole pages any block of 'len' bytes covers, wherever it starts
+*/
+
+static size_t	pages_in(size_t len)
+{
+	return (len / ft_pagesize() - 1);
+}
+
+static int	all_resident(const void *ptr, size_t len)
+{
+	size_t	n;
+
+	n = resident(ptr, len);
+	return (n != (size_t)-1 && n >= pages_in(len));
+}
+
+static ft_prefault_stats_t	stats(void)
+{
+	ft_prefault_stats_t	st;
+
+	ft_malloc_prefault_stats(&st);
+	return (st);
+}
+
+static void	test_none(void)
+{
+	ft_prefault_stats_t	before;
+	ft_prefault_stats_t	after;
+	char				*p;
+
+	printf("\n=== Testing FT_PREFAULT_NONE ===\n");
+	ft_malloc_prefault(FT_PREFAULT_NONE, 0);
+	before = stats();
+	p = keep(malloc(LARGE_SIZE));
+	after = stats();
+	check(resident(p, LARGE_SIZE) < pages_in(LARGE_SIZE),
+		"an untouched LARGE block is not resident");
+	check(memcmp(&before, &after, sizeof(before)) == 0, "no counter moves");
+	free(p);
+}
+
+static void	test_large(void)
+{
+	ft_prefault_stats_t	before;
+	char				*p;
+	char				*small;
+
+	printf("\n=== Testing FT_PREFAULT_LARGE ===\n");
+	ft_malloc_prefault(FT_PREFAULT_LARGE, LARGE_MIN);
+	before = stats();
+	p = keep(malloc(LARGE_SIZE));
+	check(all_resident(p, LARGE_SIZE),
+		"a LARGE block over the threshold is resident");
+	check(stats().large_pages >= before.large_pages + pages_in(LARGE_SIZE),
+		"large_pages counts its pages");
+	before = stats();
+	small = keep(malloc(LARGE_MIN / 2 + MEDIUM_SIZE));
+	check(stats().large_pages == before.large_pages,
+		"a LARGE block under the threshold is left alone");
+	check(stats().zone_pages == before.zone_pages,
+		"zones are left alone");
+	free(p);
+	free(small);
+}
+
+/*
+** Enough MEDIUM blocks to need a new zone: the last one is in it
+*/
+
+static void	test_zones(void)
+{
+	ft_prefault_stats_t	before;
+	char				*ptrs[64];
+	int					i;
+
+	printf("\n=== Testing FT_PREFAULT_ZONES ===\n");
+	ft_malloc_prefault(FT_PREFAULT_ZONES, 0);
+	before = stats();
+	for (i = 0; i < 64; i++)
+		ptrs[i] = keep(malloc(MEDIUM_SIZE));
+	check(stats().zone_pages > before.zone_pages,
+		"zone_pages counts the new zones");
+	check(all_resident(ptrs[63], MEDIUM_SIZE),
+		"an untouched block of a new zone is resident");
+	check(stats().large_pages == before.large_pages,
+		"large_pages does not move");
+	for (i = 0; i < 64; i++)
+		free(ptrs[i]);
+}
+
+/*
+** A block whose pages malloc_trim() gave back; 'anchor' keeps the zone
+** mapped.
+*/
+
+static void	test_reuse(void)
+{
+	ft_prefault_stats_t	before;
+	char				*anchor;
+	char				*p;
+	char				*where;
+	char				*q;
+
+	printf("\n=== Testing FT_PREFAULT_REUSE ===\n");
+	ft_malloc_prefault(FT_PREFAULT_REUSE, 0);
+	anchor = keep(malloc(MEDIUM_SIZE));
+	p = keep(malloc(MEDIUM_SIZE));
+	memset(p, 'r', MEDIUM_SIZE);
+	where = keep(p);
+	free(p);
+	ft_malloc_trim(0);
+	check(resident(where, MEDIUM_SIZE) == 0,
+		"trim gives the block's pages back");
+	before = stats();
+	q = keep(malloc(MEDIUM_SIZE));
+	check(q == where, "the freed block is reused");
+	check(all_resident(q, MEDIUM_SIZE), "its pages are resident again");
+	check(stats().reuse_pages >= before.reuse_pages + pages_in(MEDIUM_SIZE),
+		"reuse_pages counts them");
+	check(stats().zone_pages == before.zone_pages
+		&& stats().large_pages == before.large_pages,
+		"nothing else is populated");
+	free(q);
+	before = stats();
+	q = keep(malloc(MEDIUM_SIZE));
+	check(stats().reuse_pages == before.reuse_pages,
+		"resident pages are not counted");
+	free(q);
+	free(anchor);
+	ft_malloc_prefault(FT_PREFAULT_NONE, FT_PREFAULT_LARGE_MIN);
+}
+
+int	main(void)
+{
+	setvbuf(stdout, NULL, _IONBF, 0);
+	test_none();
+	test_large();
+	test_zones();
+	test_reuse();
+	return (test_summary());
+}
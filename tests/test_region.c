@@ -0,0 +1,111 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*   test_region.c                                                            */
+/*   Test for the reserved heap region (make USE_REGION=1 REGION_SIZE=64m)    */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "malloc.h"
+#include "region.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <string.h>
+
+#define LARGE_SIZE	(1 << 20)
+
+/*
+** The compiler assumes malloc() and free() leave globals alone, so the
+** region descriptor is read through volatiles.
+*/
+
+static size_t	holes(void)
+{
+	return (*(volatile size_t *)&g_region.n_holes);
+}
+
+static int	in_region(const void *ptr)
+{
+	return ((const uint8_t *)ptr >= *(uint8_t *volatile *)&g_region.base
+		&& (const uint8_t *)ptr < *(uint8_t *volatile *)&g_region.end);
+}
+
+static void	test_zones(void)
+{
+	void	*tiny;
+	void	*large;
+
+	printf("\n=== Testing zones come from the region ===\n");
+	tiny = keep(malloc(32));
+	large = keep(malloc(LARGE_SIZE));
+	check(in_region(tiny), "a TINY zone is committed from the region");
+	check(in_region(large), "a LARGE zone is committed from the region");
+	free(tiny);
+	free(large);
+}
+
+static void	test_holes(void)
+{
+	char	*a;
+	char	*b;
+	char	*c;
+	size_t	before;
+
+	printf("\n=== Testing freed zones are reused ===\n");
+	before = holes();
+	a = keep(malloc(LARGE_SIZE));
+	b = keep(malloc(LARGE_SIZE));
+	memset(a, 'a', LARGE_SIZE);
+	free(a);
+	check(holes() == before + 1, "a freed zone below brk becomes a hole");
+	c = keep(malloc(LARGE_SIZE));
+	check(c == a, "the next zone of that size takes the hole");
+	check(holes() == before, "the hole is used up");
+	check(c[0] == 0 && c[LARGE_SIZE - 1] == 0,
+		"memory from a hole is zero-filled");
+	free(b);
+	free(c);
+}
+
+/*
+** Allocates LARGE blocks until one no longer fits in the region: it must
+** still be served, by a dedicated mmap().
+*/
+
+static void	test_exhaustion(void)
+{
+	static char	*ptrs[256];
+	size_t		region;
+	int			n;
+	int			i;
+
+	printf("\n=== Testing exhaustion falls back to mmap() ===\n");
+	region = (size_t)(*(uint8_t *volatile *)&g_region.end
+		- *(uint8_t *volatile *)&g_region.base);
+	n = 0;
+	while (n < 256 && (n == 0 || in_region(ptrs[n - 1])))
+	{
+		ptrs[n] = keep(malloc(LARGE_SIZE));
+		if (!ptrs[n])
+			break ;
+		ptrs[n][LARGE_SIZE - 1] = 'x';
+		n++;
+	}
+	check(n > 0 && n < 256 && ptrs[n - 1] && !in_region(ptrs[n - 1]),
+		"a block past the end of the region is mapped on its own");
+	check((size_t)n * LARGE_SIZE >= region / 2,
+		"the region was filled first");
+	for (i = 0; i < n; i++)
+		free(ptrs[i]);
+	ptrs[0] = keep(malloc(LARGE_SIZE));
+	check(in_region(ptrs[0]), "freed space is used again afterwards");
+	free(ptrs[0]);
+}
+
+int	main(void)
+{
+	setvbuf(stdout, NULL, _IONBF, 0);
+	test_zones();
+	test_holes();
+	test_exhaustion();
+	return (test_summary());
+}
@@ -0,0 +1,106 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*   test_size_classes.c                                                      */
+/*   Test for the generated size-class table                                  */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "malloc.h"
+#include "conf.h"
+#include "size_class.h"
+#include "utils.h"
+#include "zone.h"
+#include "test_util.h"
+#include <stdio.h>
+
+/*
+** Every size lands in the smallest class that holds it
+*/
+
+static int	tight(size_t size)
+{
+	uint8_t	c;
+
+	c = ft_size_class(size);
+	return (ft_class_size(c) >= size
+		&& (c <= 1 || ft_class_size((uint8_t)(c - 1)) < size));
+}
+
+static void	test_lookup(void)
+{
+	size_t	size;
+	int		ok;
+	int		lg;
+
+	printf("\n=== Testing size -> class lookup ===\n");
+	ok = tight(0) && ft_size_class(0) == 0;
+	for (size = 1; size <= (1 << 20); size++)
+		ok &= tight(size);
+	check(ok, "sizes up to 1 MiB map to their smallest class");
+	ok = 1;
+	for (lg = 21; lg < 64; lg++)
+	{
+		size = (size_t)1 << lg;
+		ok &= tight(size - 1) && tight(size) && tight(size + 1);
+	}
+	ok &= tight((size_t)-1) && ft_size_class((size_t)-1) == FT_CLASS_COUNT - 1;
+	check(ok, "large sizes map to their smallest class");
+}
+
+static void	test_ladder(void)
+{
+	size_t	size;
+	int		ok;
+	int		c;
+
+	printf("\n=== Testing the ladder ===\n");
+	ok = 1;
+	for (c = 1; ft_class_size((uint8_t)c) <= FT_CLASS_LINEAR_MAX; c++)
+		ok &= (ft_class_size((uint8_t)c) == (size_t)c * FT_CLASS_STEP);
+	check(ok, "evenly spaced classes up to FT_CLASS_LINEAR_MAX");
+	ok = 1;
+	for (size = FT_CLASS_LINEAR_MAX; size < FT_CLASS_LADDER_MAX; size *= 2)
+		ok &= (ft_size_class(size * 2) - ft_size_class(size)
+			== FT_CLASS_PER_DOUBLING);
+	check(ok, "FT_CLASS_PER_DOUBLING classes per power of two");
+	ok = 1;
+	for (c = 1; c < FT_CLASS_COUNT; c++)
+		ok &= (ft_class_size((uint8_t)c) % 16 == 0
+			|| ft_class_size((uint8_t)c) == (size_t)-1);
+	check(ok, "class sizes keep 16-byte alignment");
+	ok = 1;
+	for (size = FT_CLASS_LINEAR_MAX + 1; size <= FT_CLASS_LADDER_MAX; size++)
+		ok &= (ft_class_size(ft_size_class(size)) - size
+			< size / FT_CLASS_PER_DOUBLING);
+	check(ok, "rounding wastes less than 1/FT_CLASS_PER_DOUBLING");
+}
+
+static void	test_allocator(void)
+{
+	size_t	odd;
+	size_t	tiny;
+
+	printf("\n=== Testing the allocator on top of the table ===\n");
+	odd = FT_CLASS_LINEAR_MAX + 1;
+	check(ft_calculate_alloc_size(odd)
+		== ft_calculate_alloc_size(ft_class_size(ft_size_class(odd))),
+		"blocks are carved at their class size");
+	tiny = ft_class_size(ft_size_class(100));
+	ft_conf_set("tiny_max", 100);
+	check(ft_conf_get()->tiny_max == tiny, "tiny_max is rounded to a class");
+	check(ft_zone_get_type(tiny) == FT_ZONE_TINY
+		&& ft_zone_get_type(tiny + 1) == FT_ZONE_SMALL
+		&& ft_zone_get_type(ft_conf_get()->small_max + 1) == FT_ZONE_MEDIUM
+		&& ft_zone_get_type(ft_conf_get()->mmap_threshold + 1)
+		== FT_ZONE_LARGE,
+		"zone types follow the classes");
+	ft_conf_set("tiny_max", FT_TINY_MAX);
+}
+
+int	main(void)
+{
+	test_lookup();
+	test_ladder();
+	test_allocator();
+	return (test_summary());
+}
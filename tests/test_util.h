@@ -0,0 +1,53 @@
+#ifndef TEST_UTIL_H
+# define TEST_UTIL_H
+
+# include <stdio.h>
+
+/*
+** Harness shared by the standalone test programs in tests/
+**
+** Each program includes this once, from its only translation unit.
+*/
+
+static int				g_failures = 0;
+
+/*
+** Pointers go through a volatile sink so the compiler cannot pair a
+** malloc() with its free() and optimize both away.
+*/
+
+static void *volatile	g_sink;
+
+static inline void	*keep(void *ptr)
+{
+	g_sink = ptr;
+	return (g_sink);
+}
+
+/*
+** check()
+**
+** Prints one PASS/FAIL line and counts the failures.
+*/
+
+static inline void	check(int cond, const char *what)
+{
+	printf("%s: %s\n", what, cond ? "PASS" : "FAIL");
+	if (!cond)
+		g_failures++;
+}
+
+/*
+** test_summary()
+**
+** Prints the verdict; its result is the exit status of main().
+*/
+
+static inline int	test_summary(void)
+{
+	printf("\n%s (%d failure%s)\n", g_failures ? "FAILED" : "ALL PASSED",
+		g_failures, g_failures == 1 ? "" : "s");
+	return (g_failures != 0);
+}
+
+#endif
@@ -0,0 +1,492 @@
+/*
+** ft_record - LD_PRELOAD allocation recorder (builds libft_record.so)
+**
+** Wraps malloc/calloc/realloc/free, forwards each call to the next
+** allocator in the lookup order (dlsym(RTLD_NEXT)) and appends one
+** ft_rec_event_t per call to $FT_RECORD. See include/alloc_record.h.
+**
+** One process writes a file: "%p" in $FT_RECORD is replaced by the pid,
+** so every process gets its own; otherwise the first to lock the file
+** owns it and the others (exec()ed children) do not record. A fork()ed
+** child drops what it inherited and reopens its own file under "%p".
+**
+** Nothing here may allocate through the wrapped functions: the id table
+** is mmap()ed and the output is buffered in a static array. Calls made
+** while dlsym() bootstraps are served from a small static arena.
+*/
+
+#define _GNU_SOURCE
+#include "alloc_record.h"
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REC_BUF_SIZE	(256 * 1024)
+#define REC_BOOT_SIZE	(64 * 1024)
+#define REC_PATH_MAX	4096
+
+typedef struct s_slot
+{
+	uintptr_t	ptr;		/* 0 empty, 1 tombstone */
+	uint64_t	id;
+}	t_slot;
+
+typedef struct s_recorder
+{
+	void			*(*real_malloc)(size_t);
+	void			*(*real_calloc)(size_t, size_t);
+	void			*(*real_realloc)(void *, size_t);
+	void			(*real_free)(void *);
+	int				state;		/* 0: not started, 1: bootstrapping, 2: up */
+	int				fd;			/* -1: not recording */
+	int				per_pid;	/* $FT_RECORD has a "%p" */
+	pthread_mutex_t	lock;
+	uint64_t		start_ns;
+	uint64_t		next_id;
+	uint32_t		threads;
+	t_slot			*slots;
+	size_t			cap;
+	size_t			used;
+	size_t			buf_used;
+	uint8_t			buf[REC_BUF_SIZE];
+}	t_recorder;
+
+static t_recorder	g_rec = {NULL, NULL, NULL, NULL, 0, -1, 0,
+	PTHREAD_MUTEX_INITIALIZER, 0, 1, 0, NULL, 0, 0, 0, {0}};
+
+static uint8_t		g_boot[REC_BOOT_SIZE];
+static size_t		g_boot_used = 0;
+
+static __thread int			t_busy
+	__attribute__((tls_model("initial-exec")));
+static __thread uint32_t	t_thread
+	__attribute__((tls_model("initial-exec")));
+
+static uint64_t	rec_now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+}
+
+static int	rec_is_boot(void *ptr)
+{
+	return ((uint8_t *)ptr >= g_boot && (uint8_t *)ptr < g_boot + REC_BOOT_SIZE);
+}
+
+static void	*rec_boot_alloc(size_t size)
+{
+	void	*p;
+
+	if (size > REC_BOOT_SIZE)
+		return (NULL);
+	size = (size + 15) & ~(size_t)15;
+	if (g_boot_used + size > REC_BOOT_SIZE)
+		return (NULL);
+	p = g_boot + g_boot_used;
+	g_boot_used += size;
+	return (p);
+}
+
+/*
+** rec_flush() - caller holds the lock
+*/
+
+static void	rec_flush(void)
+{
+	size_t	off;
+	ssize_t	ret;
+
+	off = 0;
+	while (g_rec.fd >= 0 && off < g_rec.buf_used)
+	{
+		ret = write(g_rec.fd, g_rec.buf + off, g_rec.buf_used - off);
+		if (ret <= 0)
+		{
+			close(g_rec.fd);
+			g_rec.fd = -1;
+		}
+		else
+			off += (size_t)ret;
+	}
+	g_rec.buf_used = 0;
+}
+
+/*
+** rec_path()
+**
+** Copies 'pat' to 'dst' with each "%p" replaced by the pid; formatted by
+** hand, as snprintf() may allocate. Returns 1 if there was a "%p", 0 if
+** not, -1 if the result does not fit.
+*/
+
+static int	rec_path(char *dst, const char *pat)
+{
+	char	pid[24];
+	size_t	n;
+	size_t	len;
+	int		v;
+	int		found;
+
+	v = (int)getpid();
+	len = sizeof(pid);
+	while (len == sizeof(pid) || v)
+	{
+		pid[--len] = (char)('0' + v % 10);
+		v /= 10;
+	}
+	n = 0;
+	found = 0;
+	while (*pat)
+	{
+		if (pat[0] == '%' && pat[1] == 'p')
+		{
+			if (n + sizeof(pid) - len >= REC_PATH_MAX)
+				return (-1);
+			memcpy(dst + n, pid + len, sizeof(pid) - len);
+			n += sizeof(pid) - len;
+			pat += 2;
+			found = 1;
+			continue ;
+		}
+		if (n + 1 >= REC_PATH_MAX)
+			return (-1);
+		dst[n++] = *pat++;
+	}
+	dst[n] = '\0';
+	return (found);
+}
+
+/*
+** rec_open()
+**
+** The file is truncated only once its lock is held, so a process that
+** loses the race does not wipe the owner's recording. The header goes
+** out at once: a process that leaves through _exit() still leaves a
+** valid, if empty, recording.
+*/
+
+static void	rec_open(void)
+{
+	static char		path[REC_PATH_MAX];
+	const char		*env;
+	ft_rec_hdr_t	hdr;
+	int				ret;
+
+	env = getenv(FT_RECORD_ENV);
+	if (!env || !*env)
+		return ;
+	ret = rec_path(path, env);
+	if (ret < 0)
+		return ;
+	g_rec.per_pid = ret;
+	g_rec.fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (g_rec.fd < 0)
+		return ;
+	if (flock(g_rec.fd, LOCK_EX | LOCK_NB) != 0 || ftruncate(g_rec.fd, 0) != 0)
+	{
+		close(g_rec.fd);
+		g_rec.fd = -1;
+		return ;
+	}
+	memcpy(hdr.magic, FT_RECORD_MAGIC, sizeof(hdr.magic));
+	hdr.version = FT_RECORD_VERSION;
+	hdr.event_size = sizeof(ft_rec_event_t);
+	memcpy(g_rec.buf, &hdr, sizeof(hdr));
+	g_rec.buf_used = sizeof(hdr);
+	rec_flush();
+	g_rec.start_ns = rec_now();
+}
+
+/*
+** fork() handlers
+**
+** The lock is taken across fork() so the child never inherits it held.
+** The child closes its copy of the parent's file (the parent keeps the
+** lock) and forgets the parent's buffer and ids: its frees of inherited
+** blocks are recorded with old_id 0.
+*/
+
+static void	rec_prefork(void)
+{
+	pthread_mutex_lock(&g_rec.lock);
+}
+
+static void	rec_postfork_parent(void)
+{
+	pthread_mutex_unlock(&g_rec.lock);
+}
+
+static void	rec_postfork_child(void)
+{
+	pthread_mutex_init(&g_rec.lock, NULL);
+	if (g_rec.fd < 0 && !g_rec.per_pid)
+		return ;
+	if (g_rec.fd >= 0)
+		close(g_rec.fd);
+	g_rec.fd = -1;
+	g_rec.buf_used = 0;
+	if (g_rec.slots)
+		munmap(g_rec.slots, g_rec.cap * sizeof(t_slot));
+	g_rec.slots = NULL;
+	g_rec.cap = 0;
+	g_rec.used = 0;
+	g_rec.next_id = 1;
+	g_rec.threads = 0;
+	t_thread = 0;
+	if (g_rec.per_pid)
+		rec_open();
+}
+
+static void	rec_init(void)
+{
+	if (g_rec.state != 0)
+		return ;
+	g_rec.state = 1;
+	g_rec.real_malloc = (void *(*)(size_t))dlsym(RTLD_NEXT, "malloc");
+	g_rec.real_calloc = (void *(*)(size_t, size_t))dlsym(RTLD_NEXT, "calloc");
+	g_rec.real_realloc = (void *(*)(void *, size_t))dlsym(RTLD_NEXT,
+			"realloc");
+	g_rec.real_free = (void (*)(void *))dlsym(RTLD_NEXT, "free");
+	rec_open();
+	pthread_atfork(rec_prefork, rec_postfork_parent, rec_postfork_child);
+	g_rec.state = 2;
+}
+
+/*
+** Pointer -> id table, linear probing with tombstones. Caller holds the
+** lock.
+*/
+
+static size_t	rec_hash(uintptr_t p, size_t cap)
+{
+	uint64_t	h;
+
+	h = (uint64_t)p;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return ((size_t)h & (cap - 1));
+}
+
+static int	rec_grow(void)
+{
+	t_slot	*old;
+	size_t	old_cap;
+	size_t	i;
+	size_t	j;
+
+	old = g_rec.slots;
+	old_cap = g_rec.cap;
+	g_rec.cap = old_cap ? old_cap * 2 : 65536;
+	g_rec.slots = mmap(NULL, g_rec.cap * sizeof(t_slot),
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (g_rec.slots == MAP_FAILED)
+	{
+		g_rec.slots = old;
+		g_rec.cap = old_cap;
+		return (-1);
+	}
+	g_rec.used = 0;
+	for (i = 0; i < old_cap; i++)
+	{
+		if (old[i].ptr <= 1)
+			continue ;
+		j = rec_hash(old[i].ptr, g_rec.cap);
+		while (g_rec.slots[j].ptr)
+			j = (j + 1) & (g_rec.cap - 1);
+		g_rec.slots[j] = old[i];
+		g_rec.used++;
+	}
+	if (old)
+		munmap(old, old_cap * sizeof(t_slot));
+	return (0);
+}
+
+static void	rec_put(void *ptr, uint64_t id)
+{
+	size_t	i;
+
+	if ((g_rec.used + 1) * 2 > g_rec.cap && rec_grow() != 0)
+		return ;
+	i = rec_hash((uintptr_t)ptr, g_rec.cap);
+	while (g_rec.slots[i].ptr > 1 && g_rec.slots[i].ptr != (uintptr_t)ptr)
+		i = (i + 1) & (g_rec.cap - 1);
+	if (g_rec.slots[i].ptr == 0)
+		g_rec.used++;
+	g_rec.slots[i].ptr = (uintptr_t)ptr;
+	g_rec.slots[i].id = id;
+}
+
+static uint64_t	rec_take(void *ptr)
+{
+	size_t		i;
+	uint64_t	id;
+
+	if (!g_rec.cap || !ptr)
+		return (0);
+	i = rec_hash((uintptr_t)ptr, g_rec.cap);
+	while (g_rec.slots[i].ptr)
+	{
+		if (g_rec.slots[i].ptr == (uintptr_t)ptr)
+		{
+			id = g_rec.slots[i].id;
+			g_rec.slots[i].ptr = 1;
+			return (id);
+		}
+		i = (i + 1) & (g_rec.cap - 1);
+	}
+	return (0);
+}
+
+/*
+** rec_event()
+**
+** Appends one event. Caller holds the lock. 'ptr' is the returned block
+** (NULL if none), 'old_id' the id of the block passed in.
+*/
+
+static void	rec_event(uint8_t op, void *ptr, uint64_t old_id, size_t size)
+{
+	ft_rec_event_t	ev;
+
+	if (t_thread == 0)
+		t_thread = ++g_rec.threads;
+	memset(&ev, 0, sizeof(ev));
+	ev.op = op;
+	ev.thread = t_thread - 1;
+	ev.ts_ns = rec_now() - g_rec.start_ns;
+	ev.size = size;
+	ev.old_id = old_id;
+	if (ptr)
+	{
+		ev.id = g_rec.next_id++;
+		rec_put(ptr, ev.id);
+	}
+	if (g_rec.buf_used + sizeof(ev) > sizeof(g_rec.buf))
+		rec_flush();
+	memcpy(g_rec.buf + g_rec.buf_used, &ev, sizeof(ev));
+	g_rec.buf_used += sizeof(ev);
+}
+
+/*
+** The lock is held across the forwarded free()/realloc(): once a block is
+** released another thread may get the same address, so its id must be
+** retired first.
+*/
+
+void	*malloc(size_t size)
+{
+	void	*p;
+
+	if (g_rec.state != 2)
+	{
+		if (g_rec.state == 1)
+			return (rec_boot_alloc(size));
+		rec_init();
+	}
+	if (t_busy)
+		return (g_rec.real_malloc(size));
+	t_busy = 1;
+	p = g_rec.real_malloc(size);
+	if (g_rec.fd >= 0)
+	{
+		pthread_mutex_lock(&g_rec.lock);
+		rec_event(FT_REC_MALLOC, p, 0, size);
+		pthread_mutex_unlock(&g_rec.lock);
+	}
+	t_busy = 0;
+	return (p);
+}
+
+void	*calloc(size_t n, size_t size)
+{
+	void	*p;
+
+	if (g_rec.state != 2)
+	{
+		if (g_rec.state == 1)
+			return (size && n > SIZE_MAX / size ? NULL
+				: rec_boot_alloc(n * size));
+		rec_init();
+	}
+	if (t_busy)
+		return (g_rec.real_calloc(n, size));
+	t_busy = 1;
+	p = g_rec.real_calloc(n, size);
+	if (g_rec.fd >= 0)
+	{
+		pthread_mutex_lock(&g_rec.lock);
+		rec_event(FT_REC_MALLOC, p, 0, n * size);
+		pthread_mutex_unlock(&g_rec.lock);
+	}
+	t_busy = 0;
+	return (p);
+}
+
+void	*realloc(void *ptr, size_t size)
+{
+	void		*p;
+	uint64_t	old_id;
+
+	if (g_rec.state != 2)
+		rec_init();
+	if (rec_is_boot(ptr))
+	{
+		p = malloc(size);
+		if (p)
+			memcpy(p, ptr, size < (size_t)(g_boot + REC_BOOT_SIZE
+					- (uint8_t *)ptr) ? size : (size_t)(g_boot + REC_BOOT_SIZE
+					- (uint8_t *)ptr));
+		return (p);
+	}
+	if (t_busy || g_rec.fd < 0)
+		return (g_rec.real_realloc(ptr, size));
+	t_busy = 1;
+	pthread_mutex_lock(&g_rec.lock);
+	old_id = rec_take(ptr);
+	p = g_rec.real_realloc(ptr, size);
+	if (p || size == 0 || !ptr)
+		rec_event(FT_REC_REALLOC, p, old_id, size);
+	else if (old_id)
+		rec_put(ptr, old_id);
+	pthread_mutex_unlock(&g_rec.lock);
+	t_busy = 0;
+	return (p);
+}
+
+void	free(void *ptr)
+{
+	if (!ptr || rec_is_boot(ptr))
+		return ;
+	if (g_rec.state != 2)
+		rec_init();
+	if (t_busy || g_rec.fd < 0)
+	{
+		g_rec.real_free(ptr);
+		return ;
+	}
+	t_busy = 1;
+	pthread_mutex_lock(&g_rec.lock);
+	rec_event(FT_REC_FREE, NULL, rec_take(ptr), 0);
+	g_rec.real_free(ptr);
+	pthread_mutex_unlock(&g_rec.lock);
+	t_busy = 0;
+}
+
+__attribute__((destructor))
+static void	rec_fini(void)
+{
+	pthread_mutex_lock(&g_rec.lock);
+	rec_flush();
+	pthread_mutex_unlock(&g_rec.lock);
+}
@@ -0,0 +1,339 @@
+/*
+** ft_replay - Replays a recorded allocation sequence (see alloc_record.h)
+**
+** Runs every recorded call, in recorded order, on a single thread and
+** against whatever malloc() the process resolves: glibc by default,
+** libft_malloc.so with LD_PRELOAD. Recorded timing is not reproduced;
+** calls are issued back to back.
+**
+** Usage: ft_replay [-q] file.rec
+**   -q   do not write to the blocks (by default new bytes are touched, as
+**        the recorded program would have, so RSS is meaningful)
+**
+** Report (one "key value" pair per line):
+**   ops_per_sec       calls / time spent inside the allocator
+**   lat_p50_ns ...    per-call latency percentiles (timer cost removed;
+**                     above 4 us rounded down to a power of two)
+**   peak_rss_kb       VmHWM growth during the replay
+**   peak_live_kb      largest sum of live requested bytes
+**   fragmentation     peak_rss / peak_live (1.0 = no overhead)
+**
+** Bookkeeping memory is mmap()ed and touched before the measurement
+** starts, so only the allocator under test moves the RSS figures.
+*/
+
+#define _GNU_SOURCE
+#include "alloc_record.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LAT_EXACT	4096		/* 1 ns buckets below this */
+#define LAT_LOG		48			/* then one bucket per power of two */
+
+typedef struct s_replay
+{
+	const ft_rec_event_t	*ev;
+	size_t					n;
+	uint64_t				max_id;
+	uint32_t				threads;
+	void					**ptrs;
+	uint64_t				*sizes;
+	uint64_t				lat[LAT_EXACT + LAT_LOG];
+	uint64_t				lat_max;
+	uint64_t				timer_ns;
+	uint64_t				busy_ns;
+	uint64_t				calls;
+	uint64_t				live;
+	uint64_t				peak_live;
+	int						touch;
+}	t_replay;
+
+static t_replay	g_rp;
+
+static uint64_t	now_ns(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+}
+
+static void	die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void	*map_anon(size_t size)
+{
+	void	*p;
+
+	p = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (p == MAP_FAILED)
+		die("mmap");
+	return (p);
+}
+
+/*
+** proc_status_kb()
+**
+** Reads one "Name:   N kB" line of /proc/self/status with raw syscalls,
+** so that it does not allocate while the replay is measured.
+*/
+
+static long	proc_status_kb(const char *name)
+{
+	char	buf[4096];
+	ssize_t	len;
+	int		fd;
+	char	*p;
+
+	fd = open("/proc/self/status", O_RDONLY);
+	if (fd < 0)
+		return (-1);
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return (-1);
+	buf[len] = '\0';
+	p = strstr(buf, name);
+	if (!p)
+		return (-1);
+	return (strtol(p + strlen(name), NULL, 10));
+}
+
+/*
+** reset_peak_rss()
+**
+** Makes VmHWM restart from the current RSS (Linux >= 4.0).
+*/
+
+static void	reset_peak_rss(void)
+{
+	int	fd;
+
+	fd = open("/proc/self/clear_refs", O_WRONLY);
+	if (fd < 0)
+		return ;
+	if (write(fd, "5", 1) != 1)
+		fprintf(stderr, "ft_replay: cannot reset VmHWM, peak RSS includes "
+			"startup\n");
+	close(fd);
+}
+
+static void	load(const char *path)
+{
+	struct stat			st;
+	const ft_rec_hdr_t	*hdr;
+	void				*map;
+	int					fd;
+	size_t				i;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0)
+		die(path);
+	if ((size_t)st.st_size < sizeof(ft_rec_hdr_t))
+	{
+		fprintf(stderr, "ft_replay: %s: truncated\n", path);
+		exit(1);
+	}
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ,
+		MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	if (map == MAP_FAILED)
+		die("mmap");
+	close(fd);
+	hdr = map;
+	if (memcmp(hdr->magic, FT_RECORD_MAGIC, sizeof(hdr->magic)) != 0
+		|| hdr->version != FT_RECORD_VERSION
+		|| hdr->event_size != sizeof(ft_rec_event_t))
+	{
+		fprintf(stderr, "ft_replay: %s: not a version %d recording\n", path,
+			FT_RECORD_VERSION);
+		exit(1);
+	}
+	g_rp.ev = (const ft_rec_event_t *)(hdr + 1);
+	g_rp.n = ((size_t)st.st_size - sizeof(*hdr)) / sizeof(ft_rec_event_t);
+	for (i = 0; i < g_rp.n; i++)
+	{
+		if (g_rp.ev[i].id > g_rp.max_id)
+			g_rp.max_id = g_rp.ev[i].id;
+		if (g_rp.ev[i].thread + 1 > g_rp.threads)
+			g_rp.threads = g_rp.ev[i].thread + 1;
+	}
+	g_rp.ptrs = map_anon((g_rp.max_id + 1) * sizeof(void *));
+	g_rp.sizes = map_anon((g_rp.max_id + 1) * sizeof(uint64_t));
+}
+
+/*
+** calibrate_timer()
+**
+** Smallest back-to-back now_ns() difference, subtracted from every sample.
+*/
+
+static void	calibrate_timer(void)
+{
+	uint64_t	best;
+	uint64_t	t0;
+	uint64_t	d;
+	int			i;
+
+	best = (uint64_t)-1;
+	for (i = 0; i < 10000; i++)
+	{
+		t0 = now_ns();
+		d = now_ns() - t0;
+		if (d < best)
+			best = d;
+	}
+	g_rp.timer_ns = best;
+}
+
+static void	sample(uint64_t t0, uint64_t t1)
+{
+	uint64_t	d;
+	int			bucket;
+
+	d = t1 - t0;
+	d = d > g_rp.timer_ns ? d - g_rp.timer_ns : 0;
+	g_rp.busy_ns += d;
+	g_rp.calls++;
+	if (d > g_rp.lat_max)
+		g_rp.lat_max = d;
+	if (d < LAT_EXACT)
+		bucket = (int)d;
+	else
+	{
+		bucket = LAT_EXACT + (63 - __builtin_clzll(d)) - 12;
+		if (bucket >= LAT_EXACT + LAT_LOG)
+			bucket = LAT_EXACT + LAT_LOG - 1;
+	}
+	g_rp.lat[bucket]++;
+}
+
+static uint64_t	percentile(double q)
+{
+	uint64_t	target;
+	uint64_t	seen;
+	int			i;
+
+	target = (uint64_t)(q * (double)g_rp.calls);
+	seen = 0;
+	for (i = 0; i < LAT_EXACT + LAT_LOG; i++)
+	{
+		seen += g_rp.lat[i];
+		if (seen > target)
+			return (i < LAT_EXACT ? (uint64_t)i
+				: (uint64_t)1 << (i - LAT_EXACT + 12));
+	}
+	return (g_rp.lat_max);
+}
+
+static void	touch(void *p, uint64_t from, uint64_t to, uint64_t id)
+{
+	if (g_rp.touch && p && to > from)
+		memset((char *)p + from, (int)(id & 0xff), to - from);
+}
+
+static void	replay_one(const ft_rec_event_t *e)
+{
+	uint64_t	t0;
+	void		*p;
+	uint64_t	old_size;
+
+	if (e->op == FT_REC_MALLOC && e->id)
+	{
+		t0 = now_ns();
+		p = malloc(e->size);
+		sample(t0, now_ns());
+		touch(p, 0, e->size, e->id);
+		g_rp.ptrs[e->id] = p;
+		g_rp.sizes[e->id] = e->size;
+		g_rp.live += e->size;
+	}
+	else if (e->op == FT_REC_FREE && e->old_id)
+	{
+		t0 = now_ns();
+		free(g_rp.ptrs[e->old_id]);
+		sample(t0, now_ns());
+		g_rp.ptrs[e->old_id] = NULL;
+		g_rp.live -= g_rp.sizes[e->old_id];
+	}
+	else if (e->op == FT_REC_REALLOC)
+	{
+		old_size = e->old_id ? g_rp.sizes[e->old_id] : 0;
+		p = e->old_id ? g_rp.ptrs[e->old_id] : NULL;
+		if (e->old_id)
+			g_rp.ptrs[e->old_id] = NULL;
+		g_rp.live -= old_size;
+		if (!e->id && e->size != 0)
+			return ;
+		t0 = now_ns();
+		p = realloc(p, e->size);
+		sample(t0, now_ns());
+		if (!e->id)
+			return ;
+		touch(p, old_size, e->size, e->id);
+		g_rp.ptrs[e->id] = p;
+		g_rp.sizes[e->id] = e->size;
+		g_rp.live += e->size;
+	}
+	if (g_rp.live > g_rp.peak_live)
+		g_rp.peak_live = g_rp.live;
+}
+
+int	main(int argc, char **argv)
+{
+	long		base_kb;
+	long		peak_kb;
+	uint64_t	wall;
+	size_t		i;
+	int			arg;
+
+	g_rp.touch = 1;
+	arg = 1;
+	if (arg < argc && strcmp(argv[arg], "-q") == 0)
+	{
+		g_rp.touch = 0;
+		arg++;
+	}
+	if (arg + 1 != argc)
+	{
+		fprintf(stderr, "usage: ft_replay [-q] file.rec\n");
+		return (2);
+	}
+	load(argv[arg]);
+	calibrate_timer();
+	printf("events %zu\nthreads_recorded %u\n", g_rp.n, g_rp.threads);
+	fflush(stdout);
+	base_kb = proc_status_kb("VmRSS:");
+	reset_peak_rss();
+	wall = now_ns();
+	for (i = 0; i < g_rp.n; i++)
+		replay_one(&g_rp.ev[i]);
+	wall = now_ns() - wall;
+	peak_kb = proc_status_kb("VmHWM:") - base_kb;
+	printf("calls %llu\n", (unsigned long long)g_rp.calls);
+	printf("wall_ms %.3f\n", (double)wall / 1e6);
+	printf("alloc_ms %.3f\n", (double)g_rp.busy_ns / 1e6);
+	printf("ops_per_sec %.0f\n", g_rp.busy_ns
+		? (double)g_rp.calls * 1e9 / (double)g_rp.busy_ns : 0.0);
+	printf("lat_p50_ns %llu\nlat_p90_ns %llu\nlat_p99_ns %llu\n"
+		"lat_p999_ns %llu\nlat_max_ns %llu\n",
+		(unsigned long long)percentile(0.50),
+		(unsigned long long)percentile(0.90),
+		(unsigned long long)percentile(0.99),
+		(unsigned long long)percentile(0.999),
+		(unsigned long long)g_rp.lat_max);
+	printf("peak_rss_kb %ld\npeak_live_kb %llu\n", peak_kb,
+		(unsigned long long)(g_rp.peak_live / 1024));
+	printf("fragmentation %.3f\n", g_rp.peak_live
+		? (double)peak_kb * 1024.0 / (double)g_rp.peak_live : 0.0);
+	return (0);
+}
@@ -0,0 +1,157 @@
+/*
+** gen_size_classes - Emits the size-class tables of ft_malloc
+**
+** Run by the Makefile at build time; the header it prints is included
+** through include/size_class.h. The ladder is:
+**   - STEP-byte classes up to LINEAR_MAX
+**   - then PER_DOUBLING evenly spaced classes per power of two, up to
+**     LADDER_MAX
+**   - then one class per power of two, up to SIZE_MAX
+**
+** Usage: gen_size_classes STEP LINEAR_MAX PER_DOUBLING LADDER_MAX
+**
+** Every class size must stay a multiple of 16 (FT_ALIGN_SIZE), so STEP
+** and LINEAR_MAX / PER_DOUBLING must be too, and all four are powers of
+** two.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_CLASSES		255
+#define LOOKUP_LIMIT	4096
+#define ALIGN			16
+
+static unsigned long long	g_size[MAX_CLASSES + 1];
+static int					g_count;
+
+static int	is_pow2(unsigned long long v)
+{
+	return (v && (v & (v - 1)) == 0);
+}
+
+static int	log2_of(unsigned long long v)
+{
+	int	lg;
+
+	lg = 0;
+	while ((1ULL << lg) < v)
+		lg++;
+	return (lg);
+}
+
+static void	die(const char *msg)
+{
+	fprintf(stderr, "gen_size_classes: %s\n", msg);
+	exit(1);
+}
+
+static void	add_class(unsigned long long size)
+{
+	if (g_count > MAX_CLASSES)
+		die("too many classes for a uint8_t index");
+	g_size[g_count++] = size;
+}
+
+/*
+** Smallest class whose size is >= size
+*/
+
+static int	class_of(unsigned long long size)
+{
+	int	c;
+
+	for (c = 1; c < g_count; c++)
+		if (g_size[c] >= size)
+			return (c);
+	return (g_count - 1);
+}
+
+static void	build(unsigned long long step, unsigned long long linear_max,
+	unsigned long long per_doubling, unsigned long long ladder_max)
+{
+	unsigned long long	base;
+	unsigned long long	k;
+	int					lg;
+
+	add_class(0);
+	for (k = step; k <= linear_max; k += step)
+		add_class(k);
+	for (base = linear_max; base < ladder_max; base <<= 1)
+		for (k = 1; k <= per_doubling; k++)
+			add_class(base + k * (base / per_doubling));
+	for (lg = log2_of(ladder_max) + 1; lg < 64; lg++)
+		add_class(1ULL << lg);
+	add_class(UINT64_MAX);
+}
+
+static void	emit(unsigned long long step, unsigned long long linear_max,
+	unsigned long long per_doubling, unsigned long long ladder_max)
+{
+	unsigned long long	lookup_max;
+	unsigned long long	i;
+	int					lg;
+	int					shift;
+
+	lookup_max = ladder_max < LOOKUP_LIMIT ? ladder_max : LOOKUP_LIMIT;
+	if (lookup_max < linear_max)
+		lookup_max = linear_max;
+	printf("/* Generated by tools/gen_size_classes.c - do not edit */\n\n");
+	printf("#ifndef SIZE_CLASSES_H\n# define SIZE_CLASSES_H\n\n");
+	printf("# include <stddef.h>\n# include <stdint.h>\n\n");
+	printf("# define FT_CLASS_STEP\t\t\t%llu\n", step);
+	printf("# define FT_CLASS_LINEAR_MAX\t\t%llu\n", linear_max);
+	printf("# define FT_CLASS_PER_DOUBLING\t%llu\n", per_doubling);
+	printf("# define FT_CLASS_LADDER_MAX\t\t%llu\n", ladder_max);
+	printf("# define FT_CLASS_LOOKUP_MAX\t\t%llu\n", lookup_max);
+	printf("# define FT_CLASS_COUNT\t\t\t%d\n\n", g_count);
+	printf("typedef struct s_class_pow2\n{\n\tuint8_t\tbase;\n");
+	printf("\tuint8_t\tshift;\n}\tt_class_pow2;\n\n");
+	printf("static const size_t\tg_ft_class_size[FT_CLASS_COUNT] = {");
+	for (i = 0; i < (unsigned long long)g_count; i++)
+		printf("%s%s%lluULL", i ? "," : "", i % 6 ? " " : "\n\t", g_size[i]);
+	printf("\n};\n\n");
+	printf("static const uint8_t\tg_ft_class_lookup[FT_CLASS_LOOKUP_MAX"
+		" / FT_CLASS_STEP + 1] = {");
+	for (i = 0; i <= lookup_max / step; i++)
+		printf("%s%s%d", i ? "," : "", i % 16 ? " " : "\n\t",
+			i ? class_of(i * step) : 0);
+	printf("\n};\n\n");
+	printf("static const t_class_pow2\tg_ft_class_pow2[65] = {");
+	for (lg = 0; lg <= 64; lg++)
+	{
+		shift = lg ? lg - 1 : 0;
+		if (lg >= 1 && (1ULL << (lg - 1)) >= linear_max
+			&& lg <= log2_of(ladder_max))
+			shift = lg - 1 - log2_of(per_doubling);
+		printf("%s%s{%d, %d}", lg ? "," : "", lg % 6 ? " " : "\n\t",
+			lg < 2 ? 1 : class_of((1ULL << (lg - 1)) + 1), shift);
+	}
+	printf("\n};\n\n#endif\n");
+}
+
+int	main(int argc, char **argv)
+{
+	unsigned long long	v[4];
+	char				*end;
+	int					i;
+
+	if (argc != 5)
+		die("usage: gen_size_classes STEP LINEAR_MAX PER_DOUBLING LADDER_MAX");
+	for (i = 0; i < 4; i++)
+	{
+		v[i] = strtoull(argv[i + 1], &end, 10);
+		if (argv[i + 1][0] < '0' || argv[i + 1][0] > '9' || *end
+			|| !is_pow2(v[i]))
+			die("every parameter must be a power of two");
+	}
+	if (v[2] > v[1])
+		die("PER_DOUBLING must not exceed LINEAR_MAX");
+	if (v[0] % ALIGN || v[1] < v[0] || v[3] < v[1] || v[3] > (1ULL << 40)
+		|| (v[1] / v[2]) % ALIGN)
+		die("classes would not be multiples of 16, or the ladder is empty");
+	build(v[0], v[1], v[2], v[3]);
+	emit(v[0], v[1], v[2], v[3]);
+	return (0);
+}
@@ -0,0 +1,520 @@
+/*
+** trace2json - Converts a binary allocation trace to snapshot JSON
+**
+** Replays the records written with MALLOC_LOG_FORMAT=binary (see
+** include/mem_trace.h) and prints, after each malloc/free/realloc, the
+** same snapshot object the JSON logger writes, so the visualizer can load
+** the result unchanged.
+**
+** Async traces (MALLOC_LOG_FORMAT=async) are sorted by timestamp first.
+**
+** Usage: trace2json [-e N] [-i] trace.bin [out.json]
+**   -e N   only write every Nth snapshot (the last one is always written)
+**   -i     append a snapshot index footer (see mem_logger.h) so the
+**          visualizer can seek in the file; needs an output file
+**
+** Differences with the in-process JSON logger:
+** - used_size is the sum of the zone's allocated block sizes
+** - there is one snapshot per operation in the process, including the
+**   ones libc makes itself, not only per call made through the wrappers
+*/
+
+#include "mem_trace.h"
+#include "mem_logger.h"
+#include "zone.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+** u64 -> (a, b) hash map, linear probing with backward-shift deletion
+*/
+
+typedef struct s_entry
+{
+	uint64_t	key;		/* 0 = empty slot */
+	uint64_t	a;
+	uint64_t	b;
+}	t_entry;
+
+typedef struct s_map
+{
+	t_entry	*slots;
+	size_t	cap;			/* Power of two */
+	size_t	count;
+}	t_map;
+
+static size_t	map_hash(uint64_t key, size_t cap)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return ((size_t)key & (cap - 1));
+}
+
+static void	map_put(t_map *m, uint64_t key, uint64_t a, uint64_t b);
+
+static void	map_grow(t_map *m)
+{
+	t_map	old;
+	size_t	i;
+
+	old = *m;
+	m->cap = old.cap ? old.cap * 2 : 1024;
+	m->count = 0;
+	m->slots = calloc(m->cap, sizeof(t_entry));
+	if (!m->slots)
+	{
+		perror("trace2json");
+		exit(1);
+	}
+	for (i = 0; i < old.cap; i++)
+		if (old.slots[i].key)
+			map_put(m, old.slots[i].key, old.slots[i].a, old.slots[i].b);
+	free(old.slots);
+}
+
+static void	map_put(t_map *m, uint64_t key, uint64_t a, uint64_t b)
+{
+	size_t	i;
+
+	if ((m->count + 1) * 2 > m->cap)
+		map_grow(m);
+	i = map_hash(key, m->cap);
+	while (m->slots[i].key && m->slots[i].key != key)
+		i = (i + 1) & (m->cap - 1);
+	if (!m->slots[i].key)
+		m->count++;
+	m->slots[i].key = key;
+	m->slots[i].a = a;
+	m->slots[i].b = b;
+}
+
+static t_entry	*map_get(t_map *m, uint64_t key)
+{
+	size_t	i;
+
+	if (!m->cap)
+		return (NULL);
+	i = map_hash(key, m->cap);
+	while (m->slots[i].key)
+	{
+		if (m->slots[i].key == key)
+			return (&m->slots[i]);
+		i = (i + 1) & (m->cap - 1);
+	}
+	return (NULL);
+}
+
+static void	map_del(t_map *m, uint64_t key)
+{
+	t_entry	*e;
+	size_t	i;
+	size_t	j;
+	size_t	home;
+
+	e = map_get(m, key);
+	if (!e)
+		return ;
+	i = (size_t)(e - m->slots);
+	j = i;
+	for (;;)
+	{
+		j = (j + 1) & (m->cap - 1);
+		if (!m->slots[j].key)
+			break ;
+		home = map_hash(m->slots[j].key, m->cap);
+		if (((j - home) & (m->cap - 1)) >= ((j - i) & (m->cap - 1)))
+		{
+			m->slots[i] = m->slots[j];
+			i = j;
+		}
+	}
+	m->slots[i].key = 0;
+	m->count--;
+}
+
+/*
+** Replay state
+**
+** zones: address -> (type | seq << 8, total_size)
+** blocks: user pointer -> (block size, zone address)
+*/
+
+typedef struct s_state
+{
+	t_map		zones;
+	t_map		blocks;
+	uint64_t	seq;
+	uint64_t	snapshot;
+	uint64_t	start_ns;
+	uint64_t	*index;			/* -i: offset of every snapshot */
+	size_t		index_cap;
+}	t_state;
+
+typedef struct s_zrow
+{
+	uint64_t	addr;
+	uint64_t	type;
+	uint64_t	seq;
+	uint64_t	total;
+	uint64_t	used;
+	uint64_t	count;
+}	t_zrow;
+
+typedef struct s_brow
+{
+	size_t		zone;		/* Index in the sorted zone rows */
+	uint64_t	ptr;
+	uint64_t	size;
+}	t_brow;
+
+/*
+** The logger walks the TINY, SMALL, MEDIUM then LARGE lists (the order
+** of the type values); new zones are pushed at the front of their list.
+*/
+
+static int	zrow_cmp(const void *pa, const void *pb)
+{
+	const t_zrow	*a = pa;
+	const t_zrow	*b = pb;
+
+	if (a->type != b->type)
+		return (a->type < b->type ? -1 : 1);
+	return (a->seq > b->seq ? -1 : a->seq < b->seq);
+}
+
+static int	brow_cmp(const void *pa, const void *pb)
+{
+	const t_brow	*a = pa;
+	const t_brow	*b = pb;
+
+	if (a->zone != b->zone)
+		return (a->zone < b->zone ? -1 : 1);
+	return (a->ptr < b->ptr ? -1 : a->ptr > b->ptr);
+}
+
+static const char	*zone_type_str(uint64_t type)
+{
+	if (type == FT_ZONE_TINY)
+		return ("TINY");
+	if (type == FT_ZONE_SMALL)
+		return ("SMALL");
+	if (type == FT_ZONE_MEDIUM)
+		return ("MEDIUM");
+	if (type == FT_ZONE_LARGE)
+		return ("LARGE");
+	return ("UNKNOWN");
+}
+
+static size_t	find_zone_row(t_zrow *z, size_t nz, uint64_t addr)
+{
+	size_t	i;
+
+	for (i = 0; i < nz; i++)
+		if (z[i].addr == addr)
+			return (i);
+	return (nz);
+}
+
+/*
+** Index footer (-i): every snapshot is a full one, so a keyframe.
+*/
+
+static void	index_add(t_state *st, FILE *out)
+{
+	if (st->snapshot == st->index_cap)
+	{
+		st->index_cap *= 2;
+		st->index = realloc(st->index, st->index_cap * sizeof(uint64_t));
+		if (!st->index)
+		{
+			perror("trace2json");
+			exit(1);
+		}
+	}
+	st->index[st->snapshot] = (uint64_t)ftell(out) | FT_LOG_INDEX_KEYFRAME;
+}
+
+static void	index_write(t_state *st, FILE *out)
+{
+	ft_log_index_trailer_t	trailer;
+
+	memcpy(trailer.magic, FT_LOG_INDEX_MAGIC, sizeof(trailer.magic));
+	trailer.count = st->snapshot;
+	trailer.index_offset = (uint64_t)ftell(out);
+	fwrite(st->index, sizeof(uint64_t), st->snapshot, out);
+	fwrite(&trailer, sizeof(trailer), 1, out);
+}
+
+static void	emit_snapshot(FILE *out, t_state *st, uint64_t ts_ns)
+{
+	t_zrow	*z;
+	t_brow	*b;
+	t_entry	*e;
+	size_t	nz;
+	size_t	nb;
+	size_t	i;
+	size_t	k;
+
+	z = malloc((st->zones.count + 1) * sizeof(*z));
+	b = malloc((st->blocks.count + 1) * sizeof(*b));
+	if (!z || !b)
+	{
+		perror("trace2json");
+		exit(1);
+	}
+	nz = 0;
+	for (i = 0; i < st->zones.cap; i++)
+	{
+		e = &st->zones.slots[i];
+		if (!e->key)
+			continue ;
+		z[nz].addr = e->key;
+		z[nz].type = e->a & 0xff;
+		z[nz].seq = e->a >> 8;
+		z[nz].total = e->b;
+		z[nz].used = 0;
+		z[nz].count = 0;
+		nz++;
+	}
+	qsort(z, nz, sizeof(*z), zrow_cmp);
+	nb = 0;
+	for (i = 0; i < st->blocks.cap; i++)
+	{
+		e = &st->blocks.slots[i];
+		if (!e->key)
+			continue ;
+		k = find_zone_row(z, nz, e->b);
+		if (k == nz)
+			continue ;
+		z[k].used += e->a;
+		z[k].count++;
+		b[nb].zone = k;
+		b[nb].ptr = e->key;
+		b[nb].size = e->a;
+		nb++;
+	}
+	qsort(b, nb, sizeof(*b), brow_cmp);
+	if (st->index_cap)
+		index_add(st, out);
+	fprintf(out, "{\n  \"snapshot_id\": %llu,\n  \"timestamp_us\": %llu,\n"
+		"  \"zones\": [\n", (unsigned long long)st->snapshot++,
+		(unsigned long long)((ts_ns - st->start_ns) / 1000));
+	k = 0;
+	for (i = 0; i < nz; i++)
+	{
+		fprintf(out, "%s    {\n      \"type\": \"%s\",\n"
+			"      \"address\": \"0x%llx\",\n      \"total_size\": %llu,\n"
+			"      \"used_size\": %llu,\n      \"block_count\": %llu,\n"
+			"      \"allocations\": [\n", i ? ",\n" : "",
+			zone_type_str(z[i].type), (unsigned long long)z[i].addr,
+			(unsigned long long)z[i].total, (unsigned long long)z[i].used,
+			(unsigned long long)z[i].count);
+		while (k < nb && b[k].zone == i)
+		{
+			fprintf(out, "%s        {\"address\": \"0x%llx\", \"size\": %llu}",
+				(k && b[k - 1].zone == i) ? ",\n" : "",
+				(unsigned long long)b[k].ptr, (unsigned long long)b[k].size);
+			k++;
+		}
+		fprintf(out, "\n      ]\n    }");
+	}
+	fprintf(out, "\n  ]\n}\n");
+	free(z);
+	free(b);
+}
+
+/*
+** apply()
+**
+** Updates the state with one record. Returns 1 if the record is an
+** operation after which the logger would have taken a snapshot.
+*/
+
+static int	apply(t_state *st, const ft_trace_rec_t *r)
+{
+	if (r->op == FT_TRACE_ZONE_NEW)
+		map_put(&st->zones, r->zone, r->zone_type | (st->seq++ << 8), r->size);
+	else if (r->op == FT_TRACE_ZONE_DEL)
+		map_del(&st->zones, r->zone);
+	else if (r->op == FT_TRACE_MALLOC)
+		map_put(&st->blocks, r->ptr, r->size, r->zone);
+	else if (r->op == FT_TRACE_FREE)
+		map_del(&st->blocks, r->old_ptr);
+	else if (r->op == FT_TRACE_REALLOC)
+	{
+		if (r->old_ptr)
+			map_del(&st->blocks, r->old_ptr);
+		if (r->ptr)
+			map_put(&st->blocks, r->ptr, r->size, r->zone);
+	}
+	else
+		return (0);
+	return (r->op <= FT_TRACE_REALLOC);
+}
+
+static void	usage(void)
+{
+	fprintf(stderr, "usage: trace2json [-e N] [-i] trace.bin [out.json]\n");
+	exit(2);
+}
+
+/*
+** load_records()
+**
+** Reads every record and orders them by timestamp. Synchronous traces are
+** already in order; async traces interleave per-thread batches. Equal
+** timestamps keep their file order.
+*/
+
+static int	rec_cmp(const void *pa, const void *pb)
+{
+	const ft_trace_rec_t	*a = *(const ft_trace_rec_t *const *)pa;
+	const ft_trace_rec_t	*b = *(const ft_trace_rec_t *const *)pb;
+
+	if (a->ts_ns != b->ts_ns)
+		return (a->ts_ns < b->ts_ns ? -1 : 1);
+	return (a < b ? -1 : a > b);
+}
+
+static ft_trace_rec_t	**load_records(FILE *in, ft_trace_rec_t **storage,
+	size_t *count)
+{
+	ft_trace_rec_t	*recs;
+	ft_trace_rec_t	**order;
+	size_t			cap;
+	size_t			n;
+	size_t			i;
+
+	cap = 4096;
+	n = 0;
+	recs = malloc(cap * sizeof(*recs));
+	while (recs && fread(&recs[n], sizeof(*recs), 1, in) == 1)
+	{
+		if (++n == cap)
+		{
+			cap *= 2;
+			recs = realloc(recs, cap * sizeof(*recs));
+		}
+	}
+	order = recs ? malloc((n + 1) * sizeof(*order)) : NULL;
+	if (!order)
+	{
+		perror("trace2json");
+		exit(1);
+	}
+	for (i = 0; i < n; i++)
+		order[i] = &recs[i];
+	qsort(order, n, sizeof(*order), rec_cmp);
+	*storage = recs;
+	*count = n;
+	return (order);
+}
+
+int	main(int argc, char **argv)
+{
+	FILE			*in;
+	FILE			*out;
+	ft_trace_hdr_t	hdr;
+	ft_trace_rec_t	*recs;
+	ft_trace_rec_t	**order;
+	size_t			nrecs;
+	size_t			r;
+	uint64_t		dropped;
+	t_state			st;
+	unsigned long	every;
+	unsigned long	ops;
+	uint64_t		last_ts;
+	int				pending;
+	int				indexed;
+	int				i;
+
+	every = 1;
+	indexed = 0;
+	i = 1;
+	while (i < argc && argv[i][0] == '-')
+	{
+		if (strcmp(argv[i], "-e") == 0 && i + 1 < argc)
+		{
+			every = strtoul(argv[++i], NULL, 10);
+			if (every == 0)
+				usage();
+		}
+		else if (strcmp(argv[i], "-i") == 0)
+			indexed = 1;
+		else
+			usage();
+		i++;
+	}
+	if (i >= argc || argc - i > 2 || (indexed && argc - i != 2))
+		usage();
+	in = fopen(argv[i], "rb");
+	if (!in)
+	{
+		perror(argv[i]);
+		return (1);
+	}
+	out = (argc - i == 2) ? fopen(argv[i + 1], "w") : stdout;
+	if (!out)
+	{
+		perror(argv[i + 1]);
+		return (1);
+	}
+	if (fread(&hdr, sizeof(hdr), 1, in) != 1
+		|| memcmp(hdr.magic, FT_TRACE_MAGIC, sizeof(hdr.magic)) != 0
+		|| hdr.version != FT_TRACE_VERSION
+		|| hdr.record_size != sizeof(ft_trace_rec_t))
+	{
+		fprintf(stderr, "trace2json: %s: not a version %d trace\n",
+			argv[i], FT_TRACE_VERSION);
+		return (1);
+	}
+	memset(&st, 0, sizeof(st));
+	st.start_ns = hdr.start_ns;
+	if (indexed)
+	{
+		st.index_cap = 4096;
+		st.index = malloc(st.index_cap * sizeof(uint64_t));
+		if (!st.index)
+		{
+			perror("trace2json");
+			return (1);
+		}
+	}
+	ops = 0;
+	pending = 0;
+	last_ts = hdr.start_ns;
+	dropped = 0;
+	order = load_records(in, &recs, &nrecs);
+	for (r = 0; r < nrecs; r++)
+	{
+		if (order[r]->op == FT_TRACE_DROPPED)
+			dropped += order[r]->size;
+		if (!apply(&st, order[r]))
+			continue ;
+		last_ts = order[r]->ts_ns;
+		pending = 1;
+		if (++ops % every == 0)
+		{
+			emit_snapshot(out, &st, last_ts);
+			pending = 0;
+		}
+	}
+	if (pending)
+		emit_snapshot(out, &st, last_ts);
+	if (indexed)
+		index_write(&st, out);
+	if (dropped)
+		fprintf(stderr, "trace2json: warning: %llu events were dropped while "
+			"tracing, snapshots are incomplete\n", (unsigned long long)dropped);
+	free(order);
+	free(recs);
+	fclose(in);
+	if (out != stdout)
+		fclose(out);
+	free(st.zones.slots);
+	free(st.blocks.slots);
+	free(st.index);
+	return (0);
+}